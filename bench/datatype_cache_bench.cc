@@ -0,0 +1,84 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include <mpi.h>
+};
+
+#include "datatype_cache.hpp"
+
+// Compares resolving the size of the datatype of every event through
+// PMPI_Type_size (as the event handler used to) against the datatype cache.
+
+static const int n_events = 1 << 22;
+
+template <typename F>
+static double ns_per_event(const std::vector<MPI_Datatype>& events, F size_of)
+{
+    uint64_t total = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (const auto& type : events) {
+        total += size_of(type);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // Keep the loop from being optimized away
+    if (total == 0) {
+        std::cerr << "No bytes counted" << std::endl;
+    }
+
+    return std::chrono::duration<double, std::nano>(end - begin).count() /
+        events.size();
+}
+
+int main(int argc, char **argv)
+{
+    MPI_Init(&argc, &argv);
+
+    static pfprof::datatype_cache cache;
+    cache.seed_predefined();
+
+    std::vector<MPI_Datatype> types = {
+        MPI_BYTE, MPI_CHAR, MPI_INT, MPI_DOUBLE, MPI_DOUBLE_COMPLEX,
+    };
+
+    MPI_Datatype contiguous, vector;
+    MPI_Type_contiguous(16, MPI_DOUBLE, &contiguous);
+    MPI_Type_commit(&contiguous);
+    cache.insert(contiguous);
+    MPI_Type_vector(8, 2, 4, MPI_INT, &vector);
+    MPI_Type_commit(&vector);
+    cache.insert(vector);
+    types.push_back(contiguous);
+    types.push_back(vector);
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<size_t> pick(0, types.size() - 1);
+    std::vector<MPI_Datatype> events(n_events);
+    for (auto& type : events) {
+        type = types[pick(rng)];
+    }
+
+    double before = ns_per_event(events, [](MPI_Datatype type) {
+        int sz;
+        PMPI_Type_size(type, &sz);
+        return sz;
+    });
+    double after = ns_per_event(events, [](MPI_Datatype type) {
+        return cache.size_of(type);
+    });
+
+    std::cout << "events:              " << n_events << std::endl;
+    std::cout << "PMPI_Type_size:      " << before << " ns/event" << std::endl;
+    std::cout << "datatype_cache:      " << after << " ns/event" << std::endl;
+
+    MPI_Type_free(&contiguous);
+    MPI_Type_free(&vector);
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include <dlfcn.h>
+
+#include "stub.hpp"
+
+// Interposes the few MPI calls the profiler makes on communicators, so that
+// stub::make_comm() communicators of any size can be registered in a job
+// of a single process. Calls on real handles go to the MPI library.
+
+namespace stub {
+
+struct fake_object
+{
+    int size;
+};
+
+static std::mutex mutex;
+static std::deque<fake_object> objects;
+static std::unordered_map<const void *, int> fake_comms;
+static std::unordered_map<const void *, int> fake_groups;
+
+template <typename T>
+static T real(const char *name)
+{
+    return reinterpret_cast<T>(dlsym(RTLD_NEXT, name));
+}
+
+template <typename Handle>
+static bool lookup(const std::unordered_map<const void *, int>& table,
+                   Handle handle, int *size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = table.find(reinterpret_cast<const void *>(handle));
+    if (it == table.end()) {
+        return false;
+    }
+    *size = it->second;
+
+    return true;
+}
+
+MPI_Comm make_comm(int size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    objects.push_back(fake_object{size});
+    fake_comms[&objects.back()] = size;
+
+    return reinterpret_cast<MPI_Comm>(&objects.back());
+}
+
+}
+
+extern "C" int PMPI_Comm_test_inter(MPI_Comm comm, int *flag)
+{
+    int size;
+    if (stub::lookup(stub::fake_comms, comm, &size)) {
+        *flag = 0;
+        return MPI_SUCCESS;
+    }
+
+    return stub::real<int (*)(MPI_Comm, int *)>("PMPI_Comm_test_inter")(
+        comm, flag);
+}
+
+extern "C" int PMPI_Comm_size(MPI_Comm comm, int *size)
+{
+    if (stub::lookup(stub::fake_comms, comm, size)) {
+        return MPI_SUCCESS;
+    }
+
+    return stub::real<int (*)(MPI_Comm, int *)>("PMPI_Comm_size")(comm,
+                                                                  size);
+}
+
+extern "C" int PMPI_Comm_group(MPI_Comm comm, MPI_Group *group)
+{
+    int size;
+    if (stub::lookup(stub::fake_comms, comm, &size)) {
+        std::lock_guard<std::mutex> lock(stub::mutex);
+
+        stub::objects.push_back(stub::fake_object{size});
+        stub::fake_groups[&stub::objects.back()] = size;
+        *group = reinterpret_cast<MPI_Group>(&stub::objects.back());
+
+        return MPI_SUCCESS;
+    }
+
+    return stub::real<int (*)(MPI_Comm, MPI_Group *)>("PMPI_Comm_group")(
+        comm, group);
+}
+
+extern "C" int PMPI_Group_translate_ranks(MPI_Group group1, int n,
+                                          const int ranks1[],
+                                          MPI_Group group2, int ranks2[])
+{
+    int size;
+    if (stub::lookup(stub::fake_groups, group1, &size)) {
+        int world_size;
+        PMPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+        for (int i = 0; i < n; i++) {
+            ranks2[i] = ranks1[i] % world_size;
+        }
+
+        return MPI_SUCCESS;
+    }
+
+    return stub::real<int (*)(MPI_Group, int, const int *, MPI_Group, int *)>(
+        "PMPI_Group_translate_ranks")(group1, n, ranks1, group2, ranks2);
+}
+
+extern "C" int PMPI_Group_free(MPI_Group *group)
+{
+    int size;
+    if (stub::lookup(stub::fake_groups, *group, &size)) {
+        *group = MPI_GROUP_NULL;
+        return MPI_SUCCESS;
+    }
+
+    return stub::real<int (*)(MPI_Group *)>("PMPI_Group_free")(group);
+}
@@ -0,0 +1,89 @@
+/*
+ * Stand-in for Open MPI's peruse.h, for building the benchmarks against the
+ * stub PERUSE layer in peruse_stub.cc on MPI installations without PERUSE.
+ * Types, constants and prototypes follow ompi/peruse/peruse.h.
+ */
+#ifndef _PERUSE_H_
+#define _PERUSE_H_
+
+#include <mpi.h>
+
+typedef void *peruse_event_h;
+
+typedef struct _peruse_comm_spec_t {
+    MPI_Comm comm;
+    void *buf;
+    int count;
+    MPI_Datatype datatype;
+    int peer;
+    int tag;
+    int operation;
+} peruse_comm_spec_t;
+
+typedef int (peruse_comm_callback_f)(peruse_event_h event_h,
+                                     MPI_Aint unique_id,
+                                     peruse_comm_spec_t *spec, void *param);
+
+enum {
+    PERUSE_SUCCESS = 0,
+    PERUSE_ERR_INIT,
+    PERUSE_ERR_GENERIC,
+    PERUSE_ERR_MALLOC,
+    PERUSE_ERR_EVENT,
+    PERUSE_ERR_EVENT_HANDLE,
+    PERUSE_ERR_PARAMETER,
+    PERUSE_ERR_MPI_INIT,
+    PERUSE_ERR_COMM,
+    PERUSE_ERR_MPI_OBJECT
+};
+
+enum {
+    PERUSE_EVENT_INVALID = -1,
+    PERUSE_COMM_REQ_ACTIVATE,
+    PERUSE_COMM_REQ_MATCH_UNEX,
+    PERUSE_COMM_REQ_INSERT_IN_POSTED_Q,
+    PERUSE_COMM_REQ_REMOVE_FROM_POSTED_Q,
+    PERUSE_COMM_REQ_XFER_BEGIN,
+    PERUSE_COMM_REQ_XFER_CONTINUE,
+    PERUSE_COMM_REQ_XFER_END,
+    PERUSE_COMM_REQ_COMPLETE,
+    PERUSE_COMM_REQ_NOTIFY,
+    PERUSE_COMM_MSG_ARRIVED,
+    PERUSE_COMM_MSG_INSERT_IN_UNEX_Q,
+    PERUSE_COMM_MSG_REMOVE_FROM_UNEX_Q,
+    PERUSE_COMM_MSG_MATCH_POSTED_REQ,
+    PERUSE_COMM_SEARCH_POSTED_Q_BEGIN,
+    PERUSE_COMM_SEARCH_POSTED_Q_END,
+    PERUSE_COMM_SEARCH_UNEX_Q_BEGIN,
+    PERUSE_COMM_SEARCH_UNEX_Q_END,
+    PERUSE_CUSTOM_EVENT
+};
+
+enum {
+    PERUSE_PER_COMM = 0,
+    PERUSE_GLOBAL
+};
+
+enum {
+    PERUSE_SEND = 0,
+    PERUSE_RECV,
+    PERUSE_PUT,
+    PERUSE_GET,
+    PERUSE_ACC,
+    PERUSE_IO_READ,
+    PERUSE_IO_WRITE
+};
+
+#define PERUSE_EVENT_HANDLE_NULL ((peruse_event_h)0)
+
+int PERUSE_Init(void);
+int PERUSE_Query_event(const char *event_name, int *event);
+int PERUSE_Event_comm_register(int event, MPI_Comm comm,
+                               peruse_comm_callback_f *callback_fn,
+                               void *param, peruse_event_h *event_h);
+int PERUSE_Event_activate(peruse_event_h event_h);
+int PERUSE_Event_deactivate(peruse_event_h event_h);
+int PERUSE_Event_release(peruse_event_h *event_h);
+int PERUSE_Event_get(peruse_event_h event_h, int *event);
+
+#endif
@@ -0,0 +1,135 @@
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "stub.hpp"
+
+namespace stub {
+
+struct registration
+{
+    int event;
+    MPI_Comm comm;
+    peruse_comm_callback_f *callback;
+    void *param;
+    bool active;
+};
+
+static const char *event_names[] = {
+    "PERUSE_COMM_REQ_ACTIVATE",
+    "PERUSE_COMM_REQ_MATCH_UNEX",
+    "PERUSE_COMM_REQ_INSERT_IN_POSTED_Q",
+    "PERUSE_COMM_REQ_REMOVE_FROM_POSTED_Q",
+    "PERUSE_COMM_REQ_XFER_BEGIN",
+    "PERUSE_COMM_REQ_XFER_CONTINUE",
+    "PERUSE_COMM_REQ_XFER_END",
+    "PERUSE_COMM_REQ_COMPLETE",
+    "PERUSE_COMM_REQ_NOTIFY",
+    "PERUSE_COMM_MSG_ARRIVED",
+    "PERUSE_COMM_MSG_INSERT_IN_UNEX_Q",
+    "PERUSE_COMM_MSG_REMOVE_FROM_UNEX_Q",
+    "PERUSE_COMM_MSG_MATCH_POSTED_REQ",
+    "PERUSE_COMM_SEARCH_POSTED_Q_BEGIN",
+    "PERUSE_COMM_SEARCH_POSTED_Q_END",
+    "PERUSE_COMM_SEARCH_UNEX_Q_BEGIN",
+    "PERUSE_COMM_SEARCH_UNEX_Q_END",
+};
+
+static std::mutex mutex;
+static std::vector<registration *> registrations;
+
+bool find_handler(int event, MPI_Comm comm, handler *h)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (const auto& r : registrations) {
+        if (r->active && r->event == event && r->comm == comm) {
+            h->handle = r;
+            h->callback = r->callback;
+            h->param = r->param;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}
+
+extern "C" int PERUSE_Init(void)
+{
+    return PERUSE_SUCCESS;
+}
+
+extern "C" int PERUSE_Query_event(const char *event_name, int *event)
+{
+    for (int i = 0; i < PERUSE_CUSTOM_EVENT; i++) {
+        if (strcmp(event_name, stub::event_names[i]) == 0) {
+            *event = i;
+            return PERUSE_SUCCESS;
+        }
+    }
+
+    return PERUSE_ERR_EVENT;
+}
+
+extern "C" int PERUSE_Event_comm_register(int event, MPI_Comm comm,
+                                          peruse_comm_callback_f *callback_fn,
+                                          void *param,
+                                          peruse_event_h *event_h)
+{
+    std::lock_guard<std::mutex> lock(stub::mutex);
+
+    stub::registration *r = new stub::registration{
+        event, comm, callback_fn, param, false,
+    };
+    stub::registrations.push_back(r);
+    *event_h = r;
+
+    return PERUSE_SUCCESS;
+}
+
+extern "C" int PERUSE_Event_activate(peruse_event_h event_h)
+{
+    std::lock_guard<std::mutex> lock(stub::mutex);
+
+    static_cast<stub::registration *>(event_h)->active = true;
+
+    return PERUSE_SUCCESS;
+}
+
+extern "C" int PERUSE_Event_deactivate(peruse_event_h event_h)
+{
+    std::lock_guard<std::mutex> lock(stub::mutex);
+
+    if (event_h == PERUSE_EVENT_HANDLE_NULL) {
+        return PERUSE_ERR_EVENT_HANDLE;
+    }
+    static_cast<stub::registration *>(event_h)->active = false;
+
+    return PERUSE_SUCCESS;
+}
+
+extern "C" int PERUSE_Event_release(peruse_event_h *event_h)
+{
+    std::lock_guard<std::mutex> lock(stub::mutex);
+
+    for (auto it = stub::registrations.begin();
+         it != stub::registrations.end(); ++it) {
+        if (*it == *event_h) {
+            delete *it;
+            stub::registrations.erase(it);
+            break;
+        }
+    }
+    *event_h = PERUSE_EVENT_HANDLE_NULL;
+
+    return PERUSE_SUCCESS;
+}
+
+extern "C" int PERUSE_Event_get(peruse_event_h event_h, int *event)
+{
+    *event = static_cast<stub::registration *>(event_h)->event;
+
+    return PERUSE_SUCCESS;
+}
@@ -0,0 +1,467 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pfprof.hpp"
+#include "stub.hpp"
+
+// Replays synthetic PERUSE event streams through the real event handlers,
+// registered by pfprof on communicators created by the MPI shim, and reports
+// handler throughput and latency. The profiler is configured as usual from
+// the PFPROF_* environment variables.
+
+namespace {
+
+// Messages timed together; per-event latencies are batch averages so that
+// reading the clock does not dominate the measurement
+const int batch_size = 256;
+
+struct options
+{
+    long messages;
+    int threads;
+    int procs;
+    std::string scenario;
+};
+
+struct message
+{
+    int comm;
+    int peer;
+    int count;
+    MPI_Datatype datatype;
+    int tag;
+    int operation;
+};
+
+// Handlers of a communicator, as the MPI library would invoke them
+struct comm_handlers
+{
+    MPI_Comm comm;
+    stub::handler activate;
+    stub::handler complete;
+    bool has_complete;
+    // Handlers of receive_events and unexpected_events the profiler
+    // subscribed to
+    std::vector<stub::handler> receive;
+    std::vector<stub::handler> unexpected;
+    // Handlers of transfer_events, all or none of them
+    std::vector<stub::handler> transfer;
+};
+
+// Events a receive raises between activation and completion in Open MPI's
+// ob1 matching, when it is posted before its message arrives
+const int receive_events[] = {
+    PERUSE_COMM_SEARCH_UNEX_Q_BEGIN,
+    PERUSE_COMM_SEARCH_UNEX_Q_END,
+    PERUSE_COMM_REQ_INSERT_IN_POSTED_Q,
+    PERUSE_COMM_SEARCH_POSTED_Q_BEGIN,
+    PERUSE_COMM_REQ_REMOVE_FROM_POSTED_Q,
+    PERUSE_COMM_SEARCH_POSTED_Q_END,
+};
+
+// Likewise, when its message arrives first and waits in the unexpected
+// queue; replayed for every other receive
+const int unexpected_events[] = {
+    PERUSE_COMM_MSG_ARRIVED,
+    PERUSE_COMM_SEARCH_POSTED_Q_BEGIN,
+    PERUSE_COMM_SEARCH_POSTED_Q_END,
+    PERUSE_COMM_MSG_INSERT_IN_UNEX_Q,
+    PERUSE_COMM_SEARCH_UNEX_Q_BEGIN,
+    PERUSE_COMM_MSG_REMOVE_FROM_UNEX_Q,
+    PERUSE_COMM_SEARCH_UNEX_Q_END,
+};
+
+// Events of the payload transfer of a message, sent or received. Messages
+// of more than rendezvous_count elements continue in up to max_fragments
+// fragments after a rendezvous, smaller ones move at once.
+const int transfer_events[] = {
+    PERUSE_COMM_REQ_XFER_BEGIN,
+    PERUSE_COMM_REQ_XFER_CONTINUE,
+    PERUSE_COMM_REQ_XFER_END,
+};
+const int rendezvous_count = 4096;
+const int max_fragments = 4;
+
+int fragments_of(const message& m)
+{
+    return m.count > rendezvous_count ?
+        std::min(max_fragments, m.count / rendezvous_count) : 0;
+}
+
+struct scenario
+{
+    const char *name;
+    const char *description;
+    int n_comms;
+    // 0 means the number of processes given on the command line
+    int comm_size;
+    void (*generate)(std::mt19937_64& rng, int n_comms, int comm_size,
+                     message *m);
+    // Replayed from within an MPI_Allreduce on the first communicator
+    bool in_collective;
+};
+
+void uniform_peers(std::mt19937_64& rng, int, int comm_size, message *m)
+{
+    m->comm = 0;
+    m->peer = rng() % comm_size;
+    m->count = 1024;
+    m->datatype = MPI_BYTE;
+    m->tag = 1;
+}
+
+void hot_peers(std::mt19937_64& rng, int, int comm_size, message *m)
+{
+    const int n_hot = std::min(4, comm_size);
+
+    m->comm = 0;
+    m->peer = rng() % 10 == 0 ? rng() % comm_size : rng() % n_hot;
+    m->count = 1024;
+    m->datatype = MPI_BYTE;
+    m->tag = 1;
+}
+
+void many_sizes(std::mt19937_64& rng, int, int comm_size, message *m)
+{
+    static const MPI_Datatype types[] = {MPI_BYTE, MPI_INT, MPI_DOUBLE};
+
+    m->comm = 0;
+    m->peer = rng() % comm_size;
+    // Log-uniform sizes up to 16 MiB elements
+    m->count = 1 + rng() % (1 << (rng() % 24));
+    m->datatype = types[rng() % 3];
+    m->tag = 1;
+}
+
+void many_tags(std::mt19937_64& rng, int, int comm_size, message *m)
+{
+    m->comm = 0;
+    m->peer = rng() % comm_size;
+    m->count = 1024;
+    m->datatype = MPI_BYTE;
+    // Mostly a few tags, with a long tail beyond PFPROF_TAG_LIMIT
+    m->tag = rng() % 2 == 0 ? rng() % 8 : rng() % 65536;
+}
+
+void collectives(std::mt19937_64& rng, int, int comm_size, message *m)
+{
+    m->comm = 0;
+    m->peer = rng() % comm_size;
+    m->count = 1024;
+    m->datatype = MPI_BYTE;
+    // Half of the messages with the negative tags of Open MPI collectives
+    m->tag = rng() % 2 == 0 ? 1 : -16 - static_cast<int>(rng() % 8);
+}
+
+void many_comms(std::mt19937_64& rng, int n_comms, int comm_size, message *m)
+{
+    m->comm = rng() % n_comms;
+    m->peer = rng() % comm_size;
+    m->count = 1024;
+    m->datatype = MPI_BYTE;
+    m->tag = 1;
+}
+
+const scenario scenarios[] = {
+    {"uniform", "uniform peers", 1, 0, uniform_peers, false},
+    {"hot-peers", "90% of messages to 4 peers", 1, 0, hot_peers, false},
+    {"many-sizes", "log-uniform sizes and 3 datatypes", 1, 0, many_sizes,
+     false},
+    {"many-comms", "256 communicators of 64 ranks", 256, 64, many_comms,
+     false},
+    {"many-tags", "8 hot tags and 64k rare ones", 1, 0, many_tags, false},
+    {"collectives", "half of the messages from a collective", 1, 0,
+     collectives, true},
+};
+
+std::vector<comm_handlers> create_comms(int n_comms, int comm_size)
+{
+    std::vector<comm_handlers> comms(n_comms);
+
+    for (auto& c : comms) {
+        c.comm = stub::make_comm(comm_size);
+        pfprof::register_comm(c.comm);
+        pfprof::register_event_handlers(c.comm);
+
+        if (!stub::find_handler(PERUSE_COMM_REQ_ACTIVATE, c.comm,
+                                &c.activate)) {
+            std::cerr << "No handler registered for activations"
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        c.has_complete = stub::find_handler(PERUSE_COMM_REQ_COMPLETE, c.comm,
+                                            &c.complete);
+
+        for (const auto& event : receive_events) {
+            stub::handler h;
+            if (stub::find_handler(event, c.comm, &h)) {
+                c.receive.push_back(h);
+            }
+        }
+        for (const auto& event : unexpected_events) {
+            stub::handler h;
+            if (stub::find_handler(event, c.comm, &h)) {
+                c.unexpected.push_back(h);
+            }
+        }
+        for (const auto& event : transfer_events) {
+            stub::handler h;
+            if (stub::find_handler(event, c.comm, &h)) {
+                c.transfer.push_back(h);
+            }
+        }
+        if (c.transfer.size() != 3) {
+            c.transfer.clear();
+        }
+    }
+
+    return comms;
+}
+
+inline void invoke(const stub::handler& h, MPI_Aint unique_id,
+                   peruse_comm_spec_t *spec)
+{
+    h.callback(h.handle, unique_id, spec, h.param);
+}
+
+// Replays the stream once and appends the ns/event of every batch
+void replay(const std::vector<comm_handlers>& comms,
+            const std::vector<message>& stream, MPI_Aint first_id,
+            std::vector<double> *batch_ns)
+{
+    peruse_comm_spec_t spec;
+    std::memset(&spec, 0, sizeof(spec));
+
+    for (size_t begin = 0; begin < stream.size(); begin += batch_size) {
+        size_t end = std::min(begin + batch_size, stream.size());
+        size_t n_events = 0;
+
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t i = begin; i < end; i++) {
+            const message& m = stream[i];
+            const comm_handlers& c = comms[m.comm];
+            MPI_Aint unique_id = first_id + i;
+
+            spec.comm = c.comm;
+            spec.count = m.count;
+            spec.datatype = m.datatype;
+            spec.tag = m.tag;
+            spec.peer = m.peer;
+            spec.operation = m.operation;
+
+            invoke(c.activate, unique_id, &spec);
+            n_events++;
+            if (m.operation == PERUSE_RECV) {
+                const std::vector<stub::handler>& handlers =
+                    unique_id % 2 != 0 ? c.unexpected : c.receive;
+                for (const auto& h : handlers) {
+                    invoke(h, unique_id, &spec);
+                    n_events++;
+                }
+            }
+            if (!c.transfer.empty()) {
+                int n_fragments = fragments_of(m);
+
+                invoke(c.transfer[0], unique_id, &spec);
+                for (int f = 0; f < n_fragments; f++) {
+                    spec.count = m.count / n_fragments +
+                        (f == 0 ? m.count % n_fragments : 0);
+                    invoke(c.transfer[1], unique_id, &spec);
+                }
+                spec.count = m.count;
+                invoke(c.transfer[2], unique_id, &spec);
+                n_events += 2 + n_fragments;
+            }
+            if (c.has_complete) {
+                invoke(c.complete, unique_id, &spec);
+                n_events++;
+            }
+        }
+        auto t1 = std::chrono::steady_clock::now();
+
+        if (batch_ns != nullptr) {
+            batch_ns->push_back(
+                std::chrono::duration<double, std::nano>(t1 - t0).count() /
+                n_events);
+        }
+    }
+}
+
+double percentile(std::vector<double>& values, double q)
+{
+    if (values.empty()) {
+        return 0.0;
+    }
+
+    size_t idx = static_cast<size_t>(q * (values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + idx, values.end());
+
+    return values[idx];
+}
+
+void run(const scenario& s, const options& opts)
+{
+    int comm_size = s.comm_size > 0 ? s.comm_size : opts.procs;
+    std::vector<comm_handlers> comms = create_comms(s.n_comms, comm_size);
+    long per_thread = opts.messages / opts.threads;
+
+    std::vector<std::vector<message>> streams(opts.threads);
+    for (int t = 0; t < opts.threads; t++) {
+        std::mt19937_64 rng(t + 1);
+
+        streams[t].resize(per_thread);
+        for (auto& m : streams[t]) {
+            s.generate(rng, s.n_comms, comm_size, &m);
+            m.operation = rng() % 2 == 0 ? PERUSE_SEND : PERUSE_RECV;
+        }
+    }
+
+    std::vector<std::vector<double>> batch_ns(opts.threads);
+    std::vector<std::thread> threads;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int t = 0; t < opts.threads; t++) {
+        threads.emplace_back([&, t]() {
+            MPI_Aint first_id = static_cast<MPI_Aint>(t + 1) << 40;
+            pfprof::collective_context saved;
+            if (s.in_collective) {
+                saved = pfprof::enter_collective(comms[0].comm,
+                                                 pfprof::COLL_ALLREDUCE);
+            }
+
+            // Warm up: allocates shards and counters, fills caches
+            replay(comms, streams[t], first_id, nullptr);
+            replay(comms, streams[t], first_id, &batch_ns[t]);
+
+            if (s.in_collective) {
+                pfprof::leave_collective(saved);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    std::vector<double> all;
+    for (const auto& ns : batch_ns) {
+        all.insert(all.end(), ns.begin(), ns.end());
+    }
+
+    double events = 0.0;
+    for (const auto& stream : streams) {
+        // Unique ids of a stream start even, as in replay()
+        for (size_t i = 0; i < stream.size(); i++) {
+            const message& m = stream[i];
+            const comm_handlers& c = comms[m.comm];
+            events += c.has_complete ? 2 : 1;
+            if (m.operation == PERUSE_RECV) {
+                events += i % 2 != 0 ? c.unexpected.size() :
+                    c.receive.size();
+            }
+            if (!c.transfer.empty()) {
+                events += 2 + fragments_of(m);
+            }
+        }
+    }
+    // Both replays are included in the wall time
+    events *= 2.0;
+    double seconds = std::chrono::duration<double>(t1 - t0).count();
+
+    std::cout << std::left << std::setw(12) << s.name << std::right
+              << std::fixed << std::setprecision(1)
+              << std::setw(14) << events / seconds
+              << std::setw(10) << percentile(all, 0.5)
+              << std::setw(10) << percentile(all, 0.9)
+              << std::setw(10) << percentile(all, 0.99)
+              << std::setw(10) << percentile(all, 1.0)
+              << "  " << s.description << std::endl;
+}
+
+void usage(const char *argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [--messages N] [--threads N]"
+              << " [--procs N] [--scenario NAME|all]" << std::endl;
+    std::cerr << "Scenarios:";
+    for (const auto& s : scenarios) {
+        std::cerr << " " << s.name;
+    }
+    std::cerr << std::endl;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    options opts = {1 << 22, 1, 1024, "all"};
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        if (arg == "--messages") {
+            opts.messages = std::atol(argv[++i]);
+        } else if (arg == "--threads") {
+            opts.threads = std::atoi(argv[++i]);
+        } else if (arg == "--procs") {
+            opts.procs = std::atoi(argv[++i]);
+        } else if (arg == "--scenario") {
+            opts.scenario = argv[++i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (opts.messages < opts.threads || opts.threads < 1 || opts.procs < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+
+    const char *features = std::getenv("PFPROF_FEATURES");
+    std::cout << "messages: " << opts.messages << ", threads: "
+              << opts.threads << ", procs: " << opts.procs
+              << ", PFPROF_FEATURES: "
+              << (features != nullptr ? features : "(default)") << std::endl;
+    std::cout << std::left << std::setw(12) << "scenario" << std::right
+              << std::setw(14) << "events/s" << std::setw(10) << "p50 ns"
+              << std::setw(10) << "p90 ns" << std::setw(10) << "p99 ns"
+              << std::setw(10) << "max ns" << std::endl;
+
+    bool found = false;
+    for (const auto& s : scenarios) {
+        if (opts.scenario == "all" || opts.scenario == s.name) {
+            run(s, opts);
+            found = true;
+        }
+    }
+    if (!found) {
+        usage(argv[0]);
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    MPI_Finalize();
+    auto t1 = std::chrono::steady_clock::now();
+
+    std::cout << "finalize: "
+              << std::chrono::duration<double, std::milli>(t1 - t0).count()
+              << " ms" << std::endl;
+
+    return found ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,130 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+
+#include "config.hpp"
+#include "json.hpp"
+#include "trace.hpp"
+
+// Times writing the per-rank result at MPI_Finalize for growing numbers of
+// processes, every rank having exchanged messages with all the others:
+// streamed compact JSON (write_result) against writing the document
+// indented, as write_result used to. The profiler is configured
+// from the PFPROF_* environment variables.
+
+namespace {
+
+const int n_procs[] = {1000, 10000, 100000};
+const int messages_per_peer = 4;
+const char *path = "result_writer_bench.json";
+
+template <unsigned Features>
+void fill(pfprof::trace& t, int n, std::mt19937_64& rng)
+{
+    std::uniform_int_distribution<int> sizes(0, 1 << 16);
+
+    for (int peer = 0; peer < n; peer++) {
+        for (int i = 0; i < messages_per_peer; i++) {
+            uint64_t len = sizes(rng);
+
+            t.feed_event<pfprof::EV_BEGIN_SEND, Features>(0, n, peer, len, 0,
+                                                          i);
+            t.feed_event<pfprof::EV_BEGIN_RECV, Features>(0, n, peer, len, 0,
+                                                          i);
+            if (Features & pfprof::FEATURE_TIMING) {
+                t.record_latency<pfprof::EV_END_SEND, Features>(
+                    0, n, peer, len, 1000 + len);
+                t.record_latency<pfprof::EV_END_RECV, Features>(
+                    0, n, peer, len, 1000 + len);
+            }
+        }
+    }
+}
+
+double seconds_since(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         begin).count();
+}
+
+uint64_t file_size(const char *p)
+{
+    struct stat st;
+
+    return stat(p, &st) == 0 ? st.st_size : 0;
+}
+
+}
+
+int main()
+{
+    pfprof::config cfg = pfprof::config::from_env();
+
+    std::cout << std::setw(8) << "n_procs"
+              << std::setw(14) << "stream (ms)" << std::setw(14) << "size (B)"
+              << std::setw(14) << "dom (ms)" << std::setw(14) << "size (B)"
+              << std::endl;
+
+    for (const auto& n : n_procs) {
+        std::mt19937_64 rng(n);
+        pfprof::trace t;
+
+        t.set_n_procs(n);
+        t.configure(cfg);
+        // Counters are fed through the instantiation matching the features
+        // that size them
+        const unsigned sizes = pfprof::FEATURE_SIZES;
+        const unsigned timing = sizes | pfprof::FEATURE_TIMING;
+        const unsigned sampling = pfprof::FEATURE_SAMPLING;
+        if (cfg.enabled(pfprof::FEATURE_TIMING)) {
+            if (cfg.enabled(pfprof::FEATURE_SAMPLING)) {
+                fill<timing | sampling>(t, n, rng);
+            } else {
+                fill<timing>(t, n, rng);
+            }
+        } else if (cfg.enabled(pfprof::FEATURE_SAMPLING)) {
+            fill<sizes | sampling>(t, n, rng);
+        } else {
+            fill<sizes>(t, n, rng);
+        }
+        std::vector<int> world_ranks(n);
+        for (int i = 0; i < n; i++) {
+            world_ranks[i] = i;
+        }
+        t.translate(0, world_ranks);
+
+        auto begin = std::chrono::steady_clock::now();
+        t.write_result(path);
+        double stream_time = seconds_since(begin);
+        uint64_t stream_size = file_size(path);
+
+        // Former writer: indented output of the whole document. Building
+        // the document is left out of the time, so this understates it.
+        pfprof::json_writer w;
+        t.write_json(w);
+        nlohmann::json j = nlohmann::json::parse(w.str());
+        begin = std::chrono::steady_clock::now();
+        {
+            std::ofstream ofs(path);
+            ofs << std::setw(4) << j << std::endl;
+        }
+        double dom_time = seconds_since(begin);
+        uint64_t dom_size = file_size(path);
+
+        std::cout << std::setw(8) << n
+                  << std::setw(14) << std::fixed << std::setprecision(1)
+                  << stream_time * 1000 << std::setw(14) << stream_size
+                  << std::setw(14) << dom_time * 1000
+                  << std::setw(14) << dom_size << std::endl;
+    }
+
+    std::remove(path);
+
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef __STUB_HPP__
+#define __STUB_HPP__
+
+extern "C" {
+#include <mpi.h>
+#include <peruse.h>
+};
+
+// Stub PERUSE layer (peruse_stub.cc) and MPI shim (mpi_shim.cc) that let the
+// benchmarks drive the real event handlers without a PERUSE-enabled MPI.
+namespace stub {
+
+// Callback registered and activated for an event on a communicator
+struct handler
+{
+    peruse_event_h handle;
+    peruse_comm_callback_f *callback;
+    void *param;
+};
+
+// Returns false if no active callback is registered
+bool find_handler(int event, MPI_Comm comm, handler *h);
+
+// Intracommunicator of the given size that exists only for the profiler.
+// Its rank i is MPI_COMM_WORLD rank i modulo the real world size.
+MPI_Comm make_comm(int size);
+
+}
+
+#endif
@@ -0,0 +1,586 @@
+#ifndef __BINARY_RESULT_HPP__
+#define __BINARY_RESULT_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pfprof {
+
+// Binary result of a rank, in native byte order:
+//   binary_result_header
+//   binary_result_column of every column (the column table)
+//   column data, each column starting at a multiple of
+//   binary_result_alignment
+// Columns hold the same values as the JSON result under the same names,
+// and are found by id in the table; readers skip ids they do not know, so
+// columns may be added without changing the version. Per-peer columns are
+// aligned with COLUMN_PEERS.
+
+static const char binary_result_magic[8] = {
+    'P', 'F', 'P', 'R', 'O', 'F', 'B', 'R'
+};
+static const uint32_t binary_result_version = 1;
+static const uint64_t binary_result_alignment = 64;
+
+struct binary_result_header
+{
+    // "PFPROFBR"
+    char magic[8];
+    uint32_t version;
+    uint32_t n_columns;
+    int32_t rank;
+    int32_t n_procs;
+    // Features enabled when profiling, see config.hpp
+    uint32_t features;
+    uint32_t sample_rate;
+    uint64_t n_events;
+    double duration;
+    // In s, only with FEATURE_TIMING
+    double first_event_time;
+    double last_event_time;
+};
+
+struct binary_result_column
+{
+    uint32_t id;
+    // Size of an element in bytes, checked by readers
+    uint32_t element_size;
+    uint64_t offset;
+    uint64_t count;
+};
+
+enum column_id : uint32_t
+{
+    // char
+    COLUMN_PROCESSOR_NAME = 1,
+    COLUMN_DESCRIPTION,
+    // int32_t
+    COLUMN_PEERS,
+    // uint64_t, extrapolated totals when sampling
+    COLUMN_TX_BYTES,
+    COLUMN_RX_BYTES,
+    COLUMN_TX_MESSAGES,
+    COLUMN_RX_MESSAGES,
+    // uint64_t, sampling only
+    COLUMN_SAMPLED_TX_BYTES,
+    COLUMN_SAMPLED_RX_BYTES,
+    COLUMN_SAMPLED_TX_MESSAGES,
+    COLUMN_SAMPLED_RX_MESSAGES,
+    // double, sampling only
+    COLUMN_TX_BYTES_CI95,
+    COLUMN_RX_BYTES_CI95,
+    COLUMN_TX_MESSAGES_CI95,
+    COLUMN_RX_MESSAGES_CI95,
+    // size_bucket_record
+    COLUMN_TX_MESSAGE_SIZES,
+    COLUMN_RX_MESSAGE_SIZES,
+    // latency_bucket_record keyed by peer, timing only
+    COLUMN_TX_LATENCY,
+    COLUMN_RX_LATENCY,
+    // latency_bucket_record keyed by the smallest size of a power-of-two
+    // bucket, timing only
+    COLUMN_TX_LATENCY_BY_SIZE,
+    COLUMN_RX_LATENCY_BY_SIZE,
+    // uint64_t, a single epoch width in ns, epochs only
+    COLUMN_EPOCH_NS,
+    // epoch_record, epochs only
+    COLUMN_EPOCHS,
+    // clock_record, a single one when clocks were synchronized
+    COLUMN_CLOCK,
+    // tag_record in increasing tag order, and a single one for the tags
+    // beyond the limit (tag unused), tags only
+    COLUMN_TAGS,
+    COLUMN_TAG_OVERFLOW,
+    // comm_record by communicator id
+    COLUMN_COMMS,
+    // char, the names of all communicators one after the other
+    COLUMN_COMM_NAMES,
+    // comm_peer_record of all communicators one after the other
+    COLUMN_COMM_PEERS,
+    // uint64_t, a single epoch width in ns of queue depths, queues or
+    // unexpected only
+    COLUMN_QUEUE_EPOCH_NS,
+    // queue_record of every communicator that used its matching queues
+    COLUMN_QUEUES,
+    // uint32_t, the posted queue depth series of all of them one after the
+    // other
+    COLUMN_QUEUE_DEPTHS,
+    // uint64_t, messages and bytes from each peer that found no posted
+    // receive, unexpected only
+    COLUMN_UNEXPECTED_MESSAGES,
+    COLUMN_UNEXPECTED_BYTES,
+    // unexpected_record of every communicator that received messages
+    COLUMN_UNEXPECTED,
+    // uint32_t, the unexpected queue depth series of all of them one after
+    // the other
+    COLUMN_UNEXPECTED_DEPTHS,
+    // transfer_record of every peer with timed transfers, keyed by peer,
+    // transfers only
+    COLUMN_TX_TRANSFERS,
+    COLUMN_RX_TRANSFERS,
+    // transfer_record of every power-of-two message size bucket with timed
+    // transfers, keyed by the smallest size of the bucket
+    COLUMN_TX_TRANSFERS_BY_SIZE,
+    COLUMN_RX_TRANSFERS_BY_SIZE,
+    // A single bandwidth_record
+    COLUMN_BANDWIDTH,
+    // collective_record of every collective with calls or traffic,
+    // collectives only
+    COLUMN_COLLECTIVES
+};
+
+struct size_bucket_record
+{
+    uint64_t message_size;
+    uint64_t message_size_max;
+    uint64_t frequency;
+};
+
+// Buckets of every histogram follow each other, in increasing key order
+struct latency_bucket_record
+{
+    uint64_t key;
+    uint64_t latency;
+    uint64_t latency_max;
+    uint64_t frequency;
+};
+
+// Counters of a peer during an epoch, in increasing (epoch, peer) order.
+// Epoch i starts i * epoch width after initialization.
+struct epoch_record
+{
+    uint64_t epoch;
+    uint64_t peer;
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    uint64_t tx_messages;
+    uint64_t rx_messages;
+};
+
+// Traffic of a tag, extrapolated when sampling
+struct tag_record
+{
+    int64_t tag;
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    uint64_t tx_messages;
+    uint64_t rx_messages;
+};
+
+// Communicator and its lineage. Its name is name_length characters of
+// COLUMN_COMM_NAMES from name_offset, its traffic n_peers records of
+// COLUMN_COMM_PEERS from peer_offset.
+struct comm_record
+{
+    int32_t id;
+    // Id of the communicator it was created from, or -1
+    int32_t parent;
+    int32_t size;
+    // 0: predefined, 1: dup, 2: split, 3: create
+    uint32_t creation;
+    uint64_t name_offset;
+    uint64_t name_length;
+    uint64_t peer_offset;
+    uint64_t n_peers;
+};
+
+// Traffic of a communicator with an MPI_COMM_WORLD rank, extrapolated when
+// sampling
+struct comm_peer_record
+{
+    int64_t peer;
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    uint64_t tx_messages;
+    uint64_t rx_messages;
+};
+
+// Matching queues of a communicator. Its largest posted queue depth of
+// every epoch is n_depths elements of COLUMN_QUEUE_DEPTHS from
+// depth_offset. Search times are in ns.
+struct queue_record
+{
+    int32_t comm;
+    uint32_t reserved;
+    uint64_t posted_inserts;
+    uint64_t posted_removes;
+    uint64_t max_posted_depth;
+    uint64_t posted_searches;
+    uint64_t posted_search_time;
+    uint64_t posted_search_max;
+    uint64_t unexpected_searches;
+    uint64_t unexpected_search_time;
+    uint64_t unexpected_search_max;
+    uint64_t depth_offset;
+    uint64_t n_depths;
+};
+
+// Unexpected message queue of a communicator, with its depth series in
+// COLUMN_UNEXPECTED_DEPTHS as for queue_record. Waits are in ns.
+struct unexpected_record
+{
+    int32_t comm;
+    uint32_t reserved;
+    uint64_t arrivals;
+    uint64_t inserts;
+    uint64_t removes;
+    uint64_t max_depth;
+    uint64_t max_bytes;
+    uint64_t waits;
+    uint64_t wait_time;
+    uint64_t wait_max;
+    uint64_t depth_offset;
+    uint64_t n_depths;
+};
+
+// Payload transfers to or from a peer, or of a message size bucket, of
+// which rendezvous ones with their handshake time in ns
+struct transfer_record
+{
+    int64_t key;
+    uint64_t transfers;
+    uint64_t bytes;
+    uint64_t ns;
+    uint64_t fragments;
+    uint64_t rendezvous;
+    uint64_t rendezvous_bytes;
+    uint64_t handshake_ns;
+    uint64_t handshake_max;
+};
+
+// Peak bandwidths in bytes/s over a sliding window of window s
+struct bandwidth_record
+{
+    double window;
+    double tx_peak;
+    double rx_peak;
+};
+
+// Traffic of a collective, see collectives.hpp for the values of
+// collective
+struct collective_record
+{
+    int32_t collective;
+    uint32_t reserved;
+    uint64_t calls;
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    uint64_t tx_messages;
+    uint64_t rx_messages;
+};
+
+// Timestamps of the rank on the clock of rank 0, see trace::set_clock()
+struct clock_record
+{
+    double start;
+    double drift;
+    double error;
+};
+
+// Builds a binary result. Columns are referenced, not copied, and must stay
+// alive until write().
+class binary_result_writer
+{
+public:
+    binary_result_writer()
+    {
+        std::memset(&header_, 0, sizeof(header_));
+        std::memcpy(header_.magic, binary_result_magic,
+                    sizeof(header_.magic));
+        header_.version = binary_result_version;
+    }
+
+    binary_result_header& header()
+    {
+        return header_;
+    }
+
+    template <typename T>
+    void add(column_id id, const T *data, size_t count)
+    {
+        binary_result_column c;
+        c.id = id;
+        c.element_size = sizeof(T);
+        c.offset = 0;
+        c.count = count;
+
+        columns_.push_back(c);
+        data_.push_back(reinterpret_cast<const char *>(data));
+    }
+
+    template <typename T>
+    void add(column_id id, const std::vector<T>& v)
+    {
+        add(id, v.data(), v.size());
+    }
+
+    void add(column_id id, const std::string& s)
+    {
+        add(id, s.data(), s.size());
+    }
+
+    bool write(const std::string& path)
+    {
+        header_.n_columns = columns_.size();
+
+        uint64_t offset = sizeof(header_) +
+            columns_.size() * sizeof(binary_result_column);
+        for (auto& c : columns_) {
+            offset = align(offset);
+            c.offset = offset;
+            offset += c.count * c.element_size;
+        }
+
+        std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+        ofs.write(reinterpret_cast<const char *>(&header_), sizeof(header_));
+        ofs.write(reinterpret_cast<const char *>(columns_.data()),
+                  columns_.size() * sizeof(binary_result_column));
+
+        uint64_t pos = sizeof(header_) +
+            columns_.size() * sizeof(binary_result_column);
+        static const char padding[binary_result_alignment] = {};
+        for (size_t i = 0; i < columns_.size(); i++) {
+            ofs.write(padding, columns_[i].offset - pos);
+            ofs.write(data_[i], columns_[i].count * columns_[i].element_size);
+            pos = columns_[i].offset +
+                columns_[i].count * columns_[i].element_size;
+        }
+
+        ofs.close();
+
+        return !ofs.fail();
+    }
+
+private:
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + binary_result_alignment - 1) &
+            ~(binary_result_alignment - 1);
+    }
+
+    binary_result_header header_;
+    std::vector<binary_result_column> columns_;
+    std::vector<const char *> data_;
+};
+
+// Read-only view of a column, pointing into the mapped file
+template <typename T>
+class column
+{
+public:
+    column() : data_(nullptr), size_(0)
+    {
+    }
+
+    column(const T *data, size_t size) : data_(data), size_(size)
+    {
+    }
+
+    const T *data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    const T& operator[](size_t i) const
+    {
+        return data_[i];
+    }
+
+    const T *begin() const
+    {
+        return data_;
+    }
+
+    const T *end() const
+    {
+        return data_ + size_;
+    }
+
+private:
+    const T *data_;
+    size_t size_;
+};
+
+// Maps a binary result and exposes its columns without parsing or copying
+// them. Standalone: analysis tools only need this header.
+class binary_result
+{
+public:
+    binary_result() : base_(nullptr), size_(0)
+    {
+    }
+
+    ~binary_result()
+    {
+        close();
+    }
+
+    binary_result(const binary_result&) = delete;
+    binary_result& operator=(const binary_result&) = delete;
+
+    // Returns false if the file cannot be mapped or is not a valid result
+    // of a known version
+    bool open(const std::string& path)
+    {
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 ||
+            static_cast<size_t>(st.st_size) < sizeof(binary_result_header)) {
+            ::close(fd);
+            return false;
+        }
+
+        void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+
+        base_ = static_cast<const char *>(base);
+        size_ = st.st_size;
+
+        if (!valid()) {
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void close()
+    {
+        if (base_ != nullptr) {
+            munmap(const_cast<char *>(base_), size_);
+            base_ = nullptr;
+            size_ = 0;
+        }
+    }
+
+    const binary_result_header& header() const
+    {
+        return *reinterpret_cast<const binary_result_header *>(base_);
+    }
+
+    // Empty if the file has no such column of elements of type T
+    template <typename T>
+    column<T> get(column_id id) const
+    {
+        for (const auto& c : columns()) {
+            if (c.id == id && c.element_size == sizeof(T)) {
+                return column<T>(
+                    reinterpret_cast<const T *>(base_ + c.offset), c.count);
+            }
+        }
+
+        return column<T>();
+    }
+
+    std::string processor_name() const
+    {
+        column<char> c = get<char>(COLUMN_PROCESSOR_NAME);
+        return std::string(c.begin(), c.end());
+    }
+
+    std::string description() const
+    {
+        column<char> c = get<char>(COLUMN_DESCRIPTION);
+        return std::string(c.begin(), c.end());
+    }
+
+    column<int32_t> peers() const
+    {
+        return get<int32_t>(COLUMN_PEERS);
+    }
+
+    column<uint64_t> tx_bytes() const
+    {
+        return get<uint64_t>(COLUMN_TX_BYTES);
+    }
+
+    column<uint64_t> rx_bytes() const
+    {
+        return get<uint64_t>(COLUMN_RX_BYTES);
+    }
+
+    column<uint64_t> tx_messages() const
+    {
+        return get<uint64_t>(COLUMN_TX_MESSAGES);
+    }
+
+    column<uint64_t> rx_messages() const
+    {
+        return get<uint64_t>(COLUMN_RX_MESSAGES);
+    }
+
+    column<size_bucket_record> tx_message_sizes() const
+    {
+        return get<size_bucket_record>(COLUMN_TX_MESSAGE_SIZES);
+    }
+
+    column<size_bucket_record> rx_message_sizes() const
+    {
+        return get<size_bucket_record>(COLUMN_RX_MESSAGE_SIZES);
+    }
+
+private:
+    column<binary_result_column> columns() const
+    {
+        return column<binary_result_column>(
+            reinterpret_cast<const binary_result_column *>(
+                base_ + sizeof(binary_result_header)),
+            header().n_columns);
+    }
+
+    bool valid() const
+    {
+        const binary_result_header& h = header();
+
+        if (std::memcmp(h.magic, binary_result_magic, sizeof(h.magic)) != 0 ||
+            h.version != binary_result_version ||
+            h.n_columns > (size_ - sizeof(h)) / sizeof(binary_result_column)) {
+            return false;
+        }
+
+        for (const auto& c : columns()) {
+            if (c.offset % binary_result_alignment != 0 ||
+                c.offset > size_ ||
+                (c.element_size != 0 &&
+                 c.count > (size_ - c.offset) / c.element_size)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    const char *base_;
+    size_t size_;
+};
+
+}
+
+#endif
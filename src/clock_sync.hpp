@@ -0,0 +1,180 @@
+#ifndef __CLOCK_SYNC_HPP__
+#define __CLOCK_SYNC_HPP__
+
+#include <algorithm>
+#include <cstdint>
+
+#include <time.h>
+
+extern "C" {
+#include <mpi.h>
+};
+
+namespace pfprof {
+
+// Offset of the local CLOCK_MONOTONIC from the one of MPI_COMM_WORLD rank
+// 0, measured at a given local time
+struct clock_offset
+{
+    int64_t offset;
+    uint64_t local_time;
+    // Bound on the error of offset
+    uint64_t error;
+};
+
+// Aligns the clocks of all ranks on the clock of rank 0, with an offset
+// measured at initialize() and at finalize() and a linear drift in between.
+//
+// Ranks of a node share their clock, so only one leader per node takes
+// part: leaders are synchronized along a binomial tree, each from its
+// parent, in log2(nodes) levels, then pass their offset on to the other
+// ranks of their node. A child and its parent exchange a number of
+// ping-pongs (Cristian's algorithm): the parent replies with its time and
+// offset, and the round with the shortest round trip gives the offset,
+// within half that round trip.
+class clock_sync
+{
+public:
+    clock_sync() : begin_{0, 0, 0}, end_{0, 0, 0}
+    {
+    }
+
+    static uint64_t now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    // Collective over MPI_COMM_WORLD, at initialize() and finalize()
+    void begin(int rounds)
+    {
+        begin_ = measure(rounds);
+        end_ = begin_;
+    }
+
+    void end(int rounds)
+    {
+        end_ = measure(rounds);
+    }
+
+    // Rate at which the local clock gains on the one of rank 0, e.g. 1e-6
+    // for 1 us per s
+    double drift() const
+    {
+        if (end_.local_time <= begin_.local_time) {
+            return 0.0;
+        }
+
+        return static_cast<double>(end_.offset - begin_.offset) /
+            (end_.local_time - begin_.local_time);
+    }
+
+    // Local CLOCK_MONOTONIC time t on the clock of rank 0
+    int64_t to_global(uint64_t t) const
+    {
+        double elapsed = static_cast<double>(t) - begin_.local_time;
+
+        return static_cast<int64_t>(t) + begin_.offset +
+            static_cast<int64_t>(drift() * elapsed);
+    }
+
+    uint64_t error() const
+    {
+        return std::max(begin_.error, end_.error);
+    }
+
+private:
+    static clock_offset measure(int rounds)
+    {
+        const int tag = 0;
+        int rank, node_rank;
+        MPI_Comm node, leaders;
+
+        PMPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        PMPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank,
+                             MPI_INFO_NULL, &node);
+        PMPI_Comm_rank(node, &node_rank);
+        PMPI_Comm_split(MPI_COMM_WORLD, node_rank == 0 ? 0 : MPI_UNDEFINED,
+                        rank, &leaders);
+
+        // offset, local_time, error
+        int64_t result[3] = {0, static_cast<int64_t>(now()), 0};
+
+        if (leaders != MPI_COMM_NULL) {
+            int leader, n_leaders;
+            PMPI_Comm_rank(leaders, &leader);
+            PMPI_Comm_size(leaders, &n_leaders);
+
+            int top = 1;
+            while (top < n_leaders) {
+                top <<= 1;
+            }
+
+            // Parents are synchronized at a higher level than their
+            // children, so they always reply with their final offset
+            for (int mask = top >> 1; mask > 0; mask >>= 1) {
+                if (leader % (2 * mask) == 0 && leader + mask < n_leaders) {
+                    serve(leaders, leader + mask, tag, rounds, result);
+                } else if (leader % (2 * mask) == mask) {
+                    ping(leaders, leader - mask, tag, rounds, result);
+                }
+            }
+
+            PMPI_Comm_free(&leaders);
+        }
+
+        PMPI_Bcast(result, 3, MPI_INT64_T, 0, node);
+        PMPI_Comm_free(&node);
+
+        return clock_offset{result[0], static_cast<uint64_t>(result[1]),
+                            static_cast<uint64_t>(result[2])};
+    }
+
+    static void serve(MPI_Comm comm, int child, int tag, int rounds,
+                      const int64_t *result)
+    {
+        for (int i = 0; i < rounds; i++) {
+            int64_t reply[3];
+
+            PMPI_Recv(nullptr, 0, MPI_BYTE, child, tag, comm,
+                      MPI_STATUS_IGNORE);
+            reply[0] = now();
+            reply[1] = result[0];
+            reply[2] = result[2];
+            PMPI_Send(reply, 3, MPI_INT64_T, child, tag, comm);
+        }
+    }
+
+    static void ping(MPI_Comm comm, int parent, int tag, int rounds,
+                     int64_t *result)
+    {
+        uint64_t best = UINT64_MAX;
+
+        for (int i = 0; i < rounds; i++) {
+            int64_t reply[3];
+
+            uint64_t t0 = now();
+            PMPI_Send(nullptr, 0, MPI_BYTE, parent, tag, comm);
+            PMPI_Recv(reply, 3, MPI_INT64_T, parent, tag, comm,
+                      MPI_STATUS_IGNORE);
+            uint64_t t1 = now();
+
+            if (t1 - t0 < best) {
+                best = t1 - t0;
+                int64_t mid = t0 + (t1 - t0) / 2;
+                result[0] = reply[0] + reply[1] - mid;
+                result[1] = mid;
+                result[2] = reply[2] + best / 2;
+            }
+        }
+    }
+
+    clock_offset begin_;
+    clock_offset end_;
+};
+
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef __COLLECTIVES_HPP__
+#define __COLLECTIVES_HPP__
+
+#include <cstdint>
+
+namespace pfprof {
+
+// Collective operations the traffic of a request is attributed to
+// (FEATURE_COLLECTIVES). Values are stored in binary results, so new ones
+// go before N_COLLECTIVES only.
+enum collective : int
+{
+    // Application point-to-point
+    COLL_NONE = 0,
+    // Collective traffic (negative tag) with no known calling collective
+    COLL_UNKNOWN,
+    COLL_BARRIER,
+    COLL_BCAST,
+    COLL_GATHER,
+    COLL_GATHERV,
+    COLL_SCATTER,
+    COLL_SCATTERV,
+    COLL_ALLGATHER,
+    COLL_ALLGATHERV,
+    COLL_ALLTOALL,
+    COLL_ALLTOALLV,
+    COLL_ALLTOALLW,
+    COLL_REDUCE,
+    COLL_ALLREDUCE,
+    COLL_REDUCE_SCATTER,
+    COLL_REDUCE_SCATTER_BLOCK,
+    COLL_SCAN,
+    COLL_EXSCAN,
+    COLL_IBARRIER,
+    COLL_IBCAST,
+    COLL_IGATHER,
+    COLL_IGATHERV,
+    COLL_ISCATTER,
+    COLL_ISCATTERV,
+    COLL_IALLGATHER,
+    COLL_IALLGATHERV,
+    COLL_IALLTOALL,
+    COLL_IALLTOALLV,
+    COLL_IALLTOALLW,
+    COLL_IREDUCE,
+    COLL_IALLREDUCE,
+    COLL_IREDUCE_SCATTER,
+    COLL_IREDUCE_SCATTER_BLOCK,
+    COLL_ISCAN,
+    COLL_IEXSCAN,
+    N_COLLECTIVES
+};
+
+inline const char *collective_name(int c)
+{
+    static const char *const names[N_COLLECTIVES] = {
+        "point_to_point", "unknown",
+        "MPI_Barrier", "MPI_Bcast", "MPI_Gather", "MPI_Gatherv",
+        "MPI_Scatter", "MPI_Scatterv", "MPI_Allgather", "MPI_Allgatherv",
+        "MPI_Alltoall", "MPI_Alltoallv", "MPI_Alltoallw", "MPI_Reduce",
+        "MPI_Allreduce", "MPI_Reduce_scatter", "MPI_Reduce_scatter_block",
+        "MPI_Scan", "MPI_Exscan",
+        "MPI_Ibarrier", "MPI_Ibcast", "MPI_Igather", "MPI_Igatherv",
+        "MPI_Iscatter", "MPI_Iscatterv", "MPI_Iallgather",
+        "MPI_Iallgatherv", "MPI_Ialltoall", "MPI_Ialltoallv",
+        "MPI_Ialltoallw", "MPI_Ireduce", "MPI_Iallreduce",
+        "MPI_Ireduce_scatter", "MPI_Ireduce_scatter_block", "MPI_Iscan",
+        "MPI_Iexscan",
+    };
+
+    return c >= 0 && c < N_COLLECTIVES ? names[c] : "unknown";
+}
+
+// Calls of a collective and the point-to-point traffic it caused
+struct collective_stats
+{
+    uint64_t calls;
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    uint64_t tx_messages;
+    uint64_t rx_messages;
+
+    collective_stats()
+        : calls(0), tx_bytes(0), rx_bytes(0), tx_messages(0), rx_messages(0)
+    {
+    }
+
+    bool empty() const
+    {
+        return calls == 0 && tx_messages == 0 && rx_messages == 0;
+    }
+
+    void merge(const collective_stats& other)
+    {
+        calls += other.calls;
+        tx_bytes += other.tx_bytes;
+        rx_bytes += other.rx_bytes;
+        tx_messages += other.tx_messages;
+        rx_messages += other.rx_messages;
+    }
+};
+
+}
+
+#endif
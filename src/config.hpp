@@ -0,0 +1,260 @@
+#ifndef __CONFIG_HPP__
+#define __CONFIG_HPP__
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace pfprof {
+
+// Optional features. Request event handlers are specialized at compile time
+// for every combination of the features up to FEATURE_COLLECTIVES, so
+// disabled features cost nothing on the event path. Later features
+// subscribe to PERUSE events of their own instead.
+enum feature : unsigned
+{
+    // Message size histograms
+    FEATURE_SIZES = 1u << 0,
+    // Timestamped events (subscribes to request completion as well)
+    FEATURE_TIMING = 1u << 1,
+    // Statistical sampling of activations, enabled by PFPROF_SAMPLE_RATE
+    FEATURE_SAMPLING = 1u << 2,
+    // Cycle-counter timing of the profiler itself
+    FEATURE_OVERHEAD = 1u << 3,
+    // Every event appended to a binary trace file
+    FEATURE_EVENTS = 1u << 4,
+    // Traffic binned into time epochs
+    FEATURE_EPOCHS = 1u << 5,
+    // Traffic by message tag
+    FEATURE_TAGS = 1u << 6,
+    // Payload transfer bandwidth and fragments, timed from the activation
+    // of sends
+    FEATURE_TRANSFERS = 1u << 7,
+    // Traffic by the collective operation that caused it
+    FEATURE_COLLECTIVES = 1u << 8,
+    // Posted receive queue depth and matching search times
+    FEATURE_QUEUES = 1u << 9,
+    // Unexpected message queue depth, size and wait times
+    FEATURE_UNEXPECTED = 1u << 10,
+
+    // Features request event handlers are specialized on
+    FEATURE_SPECIALIZED = (1u << 9) - 1,
+    FEATURE_ALL = (1u << 11) - 1
+};
+
+// Result files written at finalize()
+enum output : unsigned
+{
+    // oxton-result<rank>.json by every rank
+    OUTPUT_RANK = 1u << 0,
+    // oxton-result.json for the whole job, gathered to rank 0
+    OUTPUT_GLOBAL = 1u << 1,
+    // oxton-results.bin with the results of all ranks, written with MPI-IO
+    OUTPUT_SHARED = 1u << 2,
+    // oxton-result<rank>.bin by every rank, see binary_result.hpp
+    OUTPUT_BINARY = 1u << 3
+};
+
+// Run-time configuration, read from the environment at initialize()
+struct config
+{
+    unsigned features;
+    // Sub-buckets per power of two (as a power of two) of size histograms
+    int size_precision;
+    // Distinct message sizes counted exactly before falling back to buckets
+    int exact_sizes;
+    // Process one in sample_rate activations per peer on average
+    int sample_rate;
+    // Requests timed concurrently from activation to completion
+    int inflight_capacity;
+    // Size in bytes of each of the two event trace buffers of a thread
+    int event_buffer_size;
+    // Result files to write, a set of output values
+    unsigned outputs;
+    // Width of time epochs in ms, and epochs kept in memory per thread
+    int epoch_ms;
+    int epoch_ring;
+    // Distinct tags counted before the rest goes to an overflow bucket
+    int tag_limit;
+    // Ping-pongs per clock synchronization, 0 to leave clocks unaligned
+    int clock_sync_rounds;
+    // Sliding window of peak transfer bandwidths in ms
+    int bandwidth_window_ms;
+
+    config()
+        : features(FEATURE_SIZES | FEATURE_OVERHEAD), size_precision(4),
+          exact_sizes(256),
+          sample_rate(1), inflight_capacity(65536),
+          event_buffer_size(1 << 20), outputs(OUTPUT_RANK), epoch_ms(100),
+          epoch_ring(64), tag_limit(256), clock_sync_rounds(10),
+          bandwidth_window_ms(100)
+    {
+    }
+
+    bool enabled(feature f) const
+    {
+        return (features & f) != 0;
+    }
+
+    // Whether results hold timestamps, which clock_sync aligns across ranks
+    bool timestamped() const
+    {
+        return (features & (FEATURE_TIMING | FEATURE_EVENTS |
+                            FEATURE_EPOCHS | FEATURE_QUEUES |
+                            FEATURE_UNEXPECTED | FEATURE_TRANSFERS)) != 0;
+    }
+
+    // PFPROF_FEATURES: comma separated list of "sizes", "timing",
+    // "overhead", "events", "epochs", "tags", "queues", "unexpected",
+    // "transfers" and "collectives", "all" for all but "events", or "none"
+    // to count bytes and messages only
+    // PFPROF_SIZE_PRECISION, PFPROF_EXACT_SIZES, PFPROF_SAMPLE_RATE,
+    // PFPROF_INFLIGHT_CAPACITY, PFPROF_EVENT_BUFFER, PFPROF_EPOCH_RING,
+    // PFPROF_TAG_LIMIT, PFPROF_CLOCK_SYNC_ROUNDS: see above
+    // PFPROF_EPOCH_MS: epoch width, from 10 ms to 10 s
+    // PFPROF_BANDWIDTH_WINDOW_MS: peak bandwidth window, from 1 ms to 10 s
+    // PFPROF_OUTPUT: comma separated list of "rank", "global", "shared"
+    // and "binary", or "both" for "rank,global"
+    static config from_env()
+    {
+        config cfg;
+
+        const char *features = std::getenv("PFPROF_FEATURES");
+        if (features != nullptr) {
+            cfg.features = parse_features(features);
+        }
+
+        cfg.size_precision = env_int("PFPROF_SIZE_PRECISION",
+                                     cfg.size_precision);
+        cfg.exact_sizes = env_int("PFPROF_EXACT_SIZES", cfg.exact_sizes);
+        cfg.inflight_capacity = env_int("PFPROF_INFLIGHT_CAPACITY",
+                                        cfg.inflight_capacity);
+        cfg.event_buffer_size = env_int("PFPROF_EVENT_BUFFER",
+                                        cfg.event_buffer_size);
+        cfg.epoch_ring = env_int("PFPROF_EPOCH_RING", cfg.epoch_ring);
+        cfg.tag_limit = env_int("PFPROF_TAG_LIMIT", cfg.tag_limit);
+        cfg.clock_sync_rounds = env_int("PFPROF_CLOCK_SYNC_ROUNDS",
+                                        cfg.clock_sync_rounds);
+
+        int epoch_ms = env_int("PFPROF_EPOCH_MS", cfg.epoch_ms);
+        if (epoch_ms < 10 || epoch_ms > 10000) {
+            std::cout << "PFPROF_EPOCH_MS must be between 10 and 10000"
+                      << std::endl;
+        } else {
+            cfg.epoch_ms = epoch_ms;
+        }
+
+        int window_ms = env_int("PFPROF_BANDWIDTH_WINDOW_MS",
+                                cfg.bandwidth_window_ms);
+        if (window_ms < 1 || window_ms > 10000) {
+            std::cout << "PFPROF_BANDWIDTH_WINDOW_MS must be between 1 and "
+                      << "10000" << std::endl;
+        } else {
+            cfg.bandwidth_window_ms = window_ms;
+        }
+
+        const char *output = std::getenv("PFPROF_OUTPUT");
+        if (output != nullptr) {
+            cfg.outputs = parse_outputs(output, cfg.outputs);
+        }
+
+        cfg.sample_rate = env_int("PFPROF_SAMPLE_RATE", cfg.sample_rate);
+        if (cfg.sample_rate > 1) {
+            cfg.features |= FEATURE_SAMPLING;
+        } else {
+            cfg.features &= ~FEATURE_SAMPLING;
+        }
+
+        return cfg;
+    }
+
+private:
+    static long env_int(const char *name, long default_value)
+    {
+        const char *value = std::getenv(name);
+        if (value == nullptr) {
+            return default_value;
+        }
+
+        char *end;
+        long n = std::strtol(value, &end, 10);
+        if (end == value || *end != '\0' || n < 0) {
+            std::cout << "Invalid value " << value << " for " << name
+                      << std::endl;
+            return default_value;
+        }
+
+        return n;
+    }
+
+    static unsigned parse_outputs(const std::string& list,
+                                  unsigned default_value)
+    {
+        unsigned outputs = 0;
+        std::stringstream ss(list);
+        std::string name;
+
+        while (std::getline(ss, name, ',')) {
+            if (name == "rank") {
+                outputs |= OUTPUT_RANK;
+            } else if (name == "global") {
+                outputs |= OUTPUT_GLOBAL;
+            } else if (name == "shared") {
+                outputs |= OUTPUT_SHARED;
+            } else if (name == "binary") {
+                outputs |= OUTPUT_BINARY;
+            } else if (name == "both") {
+                outputs |= OUTPUT_RANK | OUTPUT_GLOBAL;
+            } else if (!name.empty()) {
+                std::cout << "Unknown output " << name << std::endl;
+            }
+        }
+
+        return outputs != 0 ? outputs : default_value;
+    }
+
+    static unsigned parse_features(const std::string& list)
+    {
+        unsigned features = 0;
+        std::stringstream ss(list);
+        std::string name;
+
+        while (std::getline(ss, name, ',')) {
+            if (name == "sizes") {
+                features |= FEATURE_SIZES;
+            } else if (name == "timing") {
+                features |= FEATURE_TIMING;
+            } else if (name == "overhead") {
+                features |= FEATURE_OVERHEAD;
+            } else if (name == "events") {
+                features |= FEATURE_EVENTS;
+            } else if (name == "epochs") {
+                features |= FEATURE_EPOCHS;
+            } else if (name == "tags") {
+                features |= FEATURE_TAGS;
+            } else if (name == "queues") {
+                features |= FEATURE_QUEUES;
+            } else if (name == "unexpected") {
+                features |= FEATURE_UNEXPECTED;
+            } else if (name == "transfers") {
+                features |= FEATURE_TRANSFERS;
+            } else if (name == "collectives") {
+                features |= FEATURE_COLLECTIVES;
+            } else if (name == "all") {
+                features |= FEATURE_SIZES | FEATURE_TIMING | FEATURE_OVERHEAD |
+                    FEATURE_EPOCHS | FEATURE_TAGS | FEATURE_QUEUES |
+                    FEATURE_UNEXPECTED | FEATURE_TRANSFERS |
+                    FEATURE_COLLECTIVES;
+            } else if (name != "none" && !name.empty()) {
+                std::cout << "Unknown feature " << name << std::endl;
+            }
+        }
+
+        return features;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __CYCLES_HPP__
+#define __CYCLES_HPP__
+
+#include <cstdint>
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace pfprof {
+
+// Cheapest available monotonic tick counter. Ticks are converted to time
+// with a rate calibrated against CLOCK_MONOTONIC over the whole run.
+static inline uint64_t read_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef __DATATYPE_CACHE_HPP__
+#define __DATATYPE_CACHE_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include <mpi.h>
+};
+
+namespace pfprof {
+
+// Fixed-size, lock-free cache of datatype sizes. Entries are filled when a
+// type is committed (and for the predefined types at initialization), so
+// that event handlers resolve the size of a datatype with a single probe
+// instead of calling PMPI_Type_size for every message.
+class datatype_cache
+{
+public:
+    // Must be a power of two
+    static const size_t capacity = 4096;
+    static const int max_probes = 8;
+
+    datatype_cache()
+    {
+        for (auto& e : entries_) {
+            e.key.store(0, std::memory_order_relaxed);
+            e.size.store(-1, std::memory_order_relaxed);
+        }
+    }
+
+    void seed_predefined()
+    {
+        static const MPI_Datatype predefined[] = {
+            MPI_CHAR, MPI_SIGNED_CHAR, MPI_UNSIGNED_CHAR, MPI_BYTE,
+            MPI_WCHAR, MPI_SHORT, MPI_UNSIGNED_SHORT, MPI_INT, MPI_UNSIGNED,
+            MPI_LONG, MPI_UNSIGNED_LONG, MPI_LONG_LONG_INT,
+            MPI_UNSIGNED_LONG_LONG, MPI_FLOAT, MPI_DOUBLE, MPI_LONG_DOUBLE,
+            MPI_C_BOOL, MPI_INT8_T, MPI_INT16_T, MPI_INT32_T, MPI_INT64_T,
+            MPI_UINT8_T, MPI_UINT16_T, MPI_UINT32_T, MPI_UINT64_T,
+            MPI_C_FLOAT_COMPLEX, MPI_C_DOUBLE_COMPLEX, MPI_AINT, MPI_OFFSET,
+            MPI_PACKED, MPI_FLOAT_INT, MPI_DOUBLE_INT, MPI_LONG_INT,
+            MPI_SHORT_INT, MPI_2INT, MPI_LONG_DOUBLE_INT, MPI_INTEGER,
+            MPI_REAL, MPI_DOUBLE_PRECISION, MPI_COMPLEX, MPI_DOUBLE_COMPLEX,
+            MPI_LOGICAL, MPI_CHARACTER,
+        };
+
+        for (const auto& type : predefined) {
+            insert(type);
+        }
+    }
+
+    // Called after a type has been committed
+    void insert(MPI_Datatype type)
+    {
+        int sz;
+        PMPI_Type_size(type, &sz);
+
+        entry *e = claim(type);
+        if (e != nullptr) {
+            e->size.store(sz, std::memory_order_release);
+        }
+    }
+
+    // Called when a type is freed; the slot is kept for handle reuse
+    void erase(MPI_Datatype type)
+    {
+        entry *e = find(type);
+        if (e != nullptr) {
+            e->size.store(-1, std::memory_order_release);
+        }
+    }
+
+    int size_of(MPI_Datatype type)
+    {
+        entry *e = find(type);
+        if (e != nullptr) {
+            int sz = e->size.load(std::memory_order_acquire);
+            if (sz >= 0) {
+                return sz;
+            }
+        }
+
+        // Types that bypassed MPI_Type_commit (e.g. MPI_Type_dup of a
+        // committed type) are cached on first use, and freed handles that
+        // were reused on their next use
+        int sz;
+        PMPI_Type_size(type, &sz);
+        if (e == nullptr) {
+            e = claim(type);
+        }
+        if (e != nullptr) {
+            e->size.store(sz, std::memory_order_release);
+        }
+
+        return sz;
+    }
+
+private:
+    struct entry
+    {
+        std::atomic<uintptr_t> key;
+        std::atomic<int> size;
+    };
+
+    static uintptr_t key_of(MPI_Datatype type)
+    {
+        return (uintptr_t)type;
+    }
+
+    static size_t slot_of(uintptr_t key)
+    {
+        return ((key >> 4) * 0x9e3779b97f4a7c15ULL) & (capacity - 1);
+    }
+
+    entry *find(MPI_Datatype type)
+    {
+        uintptr_t key = key_of(type);
+        size_t slot = slot_of(key);
+
+        for (int i = 0; i < max_probes; i++) {
+            entry& e = entries_[(slot + i) & (capacity - 1)];
+            uintptr_t k = e.key.load(std::memory_order_acquire);
+            if (k == key) {
+                return &e;
+            }
+            if (k == 0) {
+                break;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Returns the slot owned by the given type, or nullptr if the probe
+    // sequence is exhausted, in which case the type is never cached
+    entry *claim(MPI_Datatype type)
+    {
+        uintptr_t key = key_of(type);
+        size_t slot = slot_of(key);
+
+        for (int i = 0; i < max_probes; i++) {
+            entry& e = entries_[(slot + i) & (capacity - 1)];
+            uintptr_t k = 0;
+            if (e.key.compare_exchange_strong(k, key,
+                                              std::memory_order_acq_rel) ||
+                k == key) {
+                return &e;
+            }
+        }
+
+        return nullptr;
+    }
+
+    entry entries_[capacity];
+};
+
+}
+
+#endif
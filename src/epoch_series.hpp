@@ -0,0 +1,393 @@
+#ifndef __EPOCH_SERIES_HPP__
+#define __EPOCH_SERIES_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace pfprof {
+
+struct epoch_counters
+{
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    uint64_t tx_messages;
+    uint64_t rx_messages;
+};
+
+// Counters of a peer during an epoch
+struct epoch_entry
+{
+    uint64_t epoch;
+    // Communicator id and peer (see epoch_series::key()) until translated,
+    // then MPI_COMM_WORLD rank
+    uint64_t key;
+    epoch_counters counters;
+};
+
+// Traffic binned into fixed-width time epochs (FEATURE_EPOCHS). While
+// profiling, the most recent epochs are kept in a ring, each a sparse table
+// of counters by communicator and peer; when the ring is full, its oldest
+// epoch is appended to an unnamed temporary file. At finalize, epochs are
+// read back and counters mapped to MPI_COMM_WORLD ranks like the totals.
+class epoch_series
+{
+public:
+    epoch_series()
+        : width_ns_(0), n_epochs_(0), head_(0), current_(nullptr),
+          spill_(nullptr), n_spilled_(0), n_dropped_(0), indexed_(false)
+    {
+    }
+
+    ~epoch_series()
+    {
+        if (spill_ != nullptr) {
+            std::fclose(spill_);
+        }
+    }
+
+    epoch_series(const epoch_series&) = delete;
+    epoch_series& operator=(const epoch_series&) = delete;
+
+    void init(uint64_t width_ns, size_t ring_size)
+    {
+        width_ns_ = width_ns;
+        ring_.resize(std::max<size_t>(ring_size, 1));
+    }
+
+    uint64_t width_ns() const
+    {
+        return width_ns_;
+    }
+
+    // Epochs written to the spill file so far
+    uint64_t n_spilled() const
+    {
+        return n_spilled_;
+    }
+
+    // Epochs lost because no spill file could be created
+    uint64_t n_dropped() const
+    {
+        return n_dropped_;
+    }
+
+    template <bool Send>
+    void record(uint64_t time, int comm_id, int peer, uint64_t len)
+    {
+        uint64_t index = time / width_ns_;
+
+        if (current_ == nullptr || current_->index != index) {
+            current_ = open_epoch(index);
+        }
+
+        epoch_counters& c = current_->at(key(comm_id, peer));
+        if (Send) {
+            c.tx_bytes += len;
+            c.tx_messages++;
+        } else {
+            c.rx_bytes += len;
+            c.rx_messages++;
+        }
+    }
+
+    // Moves the epochs of another series (e.g. a per-thread shard) here
+    void merge(const epoch_series& other)
+    {
+        collect();
+        other.for_each_spilled([this](uint64_t index, uint64_t k,
+                                      const epoch_counters& c) {
+            add(index, k, c);
+        });
+        other.for_each_in_ring([this](uint64_t index, uint64_t k,
+                                      const epoch_counters& c) {
+            add(index, k, c);
+        });
+        n_spilled_ += other.n_spilled_;
+        n_dropped_ += other.n_dropped_;
+    }
+
+    // Maps the counters of a communicator to MPI_COMM_WORLD ranks
+    // (MPI_UNDEFINED if none)
+    void translate(int comm_id, const std::vector<int>& world_ranks,
+                   int n_procs)
+    {
+        collect();
+
+        // Once, so that the entries of every communicator are found
+        // directly
+        if (!indexed_) {
+            index_by_comm();
+        }
+
+        if (comm_id + 1 >= static_cast<int>(comm_offsets_.size())) {
+            return;
+        }
+
+        for (size_t i = comm_offsets_[comm_id];
+             i < comm_offsets_[comm_id + 1]; i++) {
+            const epoch_entry& e = collected_[by_comm_[i]];
+            int peer = world_ranks[static_cast<uint32_t>(e.key)];
+            if (peer >= 0 && peer < n_procs) {
+                accumulate(world_[(e.epoch << 32) | peer], e.counters);
+            }
+        }
+    }
+
+    // Counters by epoch and MPI_COMM_WORLD rank, filled by translate(), in
+    // increasing (epoch, rank) order
+    std::vector<epoch_entry> world() const
+    {
+        std::vector<epoch_entry> entries;
+
+        entries.reserve(world_.size());
+        for (const auto& kv : world_) {
+            entries.push_back(epoch_entry{
+                kv.first >> 32, kv.first & 0xffffffff, kv.second});
+        }
+        std::sort(entries.begin(), entries.end(),
+                  [](const epoch_entry& a, const epoch_entry& b) {
+                      return a.epoch != b.epoch ? a.epoch < b.epoch :
+                          a.key < b.key;
+                  });
+
+        return entries;
+    }
+
+private:
+    // Sparse counters of a single epoch, by key(), in an open addressing
+    // table kept allocated when the epoch is reused
+    struct epoch
+    {
+        enum : uint64_t { empty_key = UINT64_MAX };
+
+        uint64_t index;
+        size_t used;
+        std::vector<uint64_t> keys;
+        std::vector<epoch_counters> counters;
+
+        epoch() : index(0), used(0)
+        {
+        }
+
+        void clear(uint64_t i)
+        {
+            index = i;
+            if (used > 0) {
+                std::fill(keys.begin(), keys.end(), empty_key);
+                used = 0;
+            }
+        }
+
+        epoch_counters& at(uint64_t k)
+        {
+            if (2 * (used + 1) > keys.size()) {
+                grow();
+            }
+
+            size_t mask = keys.size() - 1;
+            size_t h = hash(k) & mask;
+            while (keys[h] != k) {
+                if (keys[h] == empty_key) {
+                    keys[h] = k;
+                    counters[h] = epoch_counters();
+                    used++;
+                    break;
+                }
+                h = (h + 1) & mask;
+            }
+
+            return counters[h];
+        }
+
+        static size_t hash(uint64_t k)
+        {
+            return (k * 0x9e3779b97f4a7c15ULL) >> 32;
+        }
+
+        void grow()
+        {
+            size_t capacity = std::max<size_t>(2 * keys.size(), 16);
+            std::vector<uint64_t> old_keys(capacity, empty_key);
+            std::vector<epoch_counters> old_counters(capacity);
+            // Swapped, so that the old table is iterated below
+            old_keys.swap(keys);
+            old_counters.swap(counters);
+            used = 0;
+
+            for (size_t i = 0; i < old_keys.size(); i++) {
+                if (old_keys[i] != empty_key) {
+                    at(old_keys[i]) = old_counters[i];
+                }
+            }
+        }
+    };
+
+    static uint64_t key(int comm_id, int peer)
+    {
+        return (static_cast<uint64_t>(comm_id) << 32) |
+            static_cast<uint32_t>(peer);
+    }
+
+    static void accumulate(epoch_counters& into, const epoch_counters& c)
+    {
+        into.tx_bytes += c.tx_bytes;
+        into.rx_bytes += c.rx_bytes;
+        into.tx_messages += c.tx_messages;
+        into.rx_messages += c.rx_messages;
+    }
+
+    // Next epoch of the ring, spilling the oldest one if it is full.
+    // Per-thread time only goes forward, so epochs are opened in order.
+    epoch *open_epoch(uint64_t index)
+    {
+        if (n_epochs_ == ring_.size()) {
+            spill(ring_[head_]);
+            head_ = (head_ + 1) % ring_.size();
+            n_epochs_--;
+        }
+
+        epoch& e = ring_[(head_ + n_epochs_) % ring_.size()];
+        n_epochs_++;
+        e.clear(index);
+
+        return &e;
+    }
+
+    // The spill file is an array of epoch_entry
+    void spill(const epoch& e)
+    {
+        if (spill_ == nullptr) {
+            spill_ = std::tmpfile();
+        }
+        if (spill_ == nullptr) {
+            // Dropped rather than failing the application
+            n_dropped_++;
+            return;
+        }
+
+        scratch_.clear();
+        for (size_t i = 0; i < e.keys.size(); i++) {
+            if (e.keys[i] != epoch::empty_key) {
+                scratch_.push_back(epoch_entry{e.index, e.keys[i],
+                                               e.counters[i]});
+            }
+        }
+        std::fwrite(scratch_.data(), sizeof(epoch_entry), scratch_.size(),
+                    spill_);
+        n_spilled_++;
+    }
+
+    template <typename F>
+    void for_each_spilled(F f) const
+    {
+        if (spill_ == nullptr) {
+            return;
+        }
+
+        std::fflush(spill_);
+        std::rewind(spill_);
+
+        std::vector<epoch_entry> chunk(4096);
+        size_t n;
+        while ((n = std::fread(chunk.data(), sizeof(epoch_entry),
+                               chunk.size(), spill_)) > 0) {
+            for (size_t i = 0; i < n; i++) {
+                f(chunk[i].epoch, chunk[i].key, chunk[i].counters);
+            }
+        }
+    }
+
+    template <typename F>
+    void for_each_in_ring(F f) const
+    {
+        for (size_t i = 0; i < n_epochs_; i++) {
+            const epoch& e = ring_[(head_ + i) % ring_.size()];
+            for (size_t j = 0; j < e.keys.size(); j++) {
+                if (e.keys[j] != epoch::empty_key) {
+                    f(e.index, e.keys[j], e.counters[j]);
+                }
+            }
+        }
+    }
+
+    void add(uint64_t index, uint64_t k, const epoch_counters& c)
+    {
+        collected_.push_back(epoch_entry{index, k, c});
+        indexed_ = false;
+    }
+
+    // Counting sort of the collected entries by communicator id
+    void index_by_comm()
+    {
+        size_t n_comms = 0;
+        for (const auto& e : collected_) {
+            n_comms = std::max<size_t>(n_comms, (e.key >> 32) + 1);
+        }
+
+        comm_offsets_.assign(n_comms + 1, 0);
+        for (const auto& e : collected_) {
+            comm_offsets_[(e.key >> 32) + 1]++;
+        }
+        for (size_t i = 0; i < n_comms; i++) {
+            comm_offsets_[i + 1] += comm_offsets_[i];
+        }
+
+        std::vector<size_t> next(comm_offsets_.begin(),
+                                 comm_offsets_.end() - 1);
+        by_comm_.resize(collected_.size());
+        for (size_t i = 0; i < collected_.size(); i++) {
+            by_comm_[next[collected_[i].key >> 32]++] = i;
+        }
+
+        indexed_ = true;
+    }
+
+    // Moves the own ring and spill file to collected_
+    void collect()
+    {
+        for_each_spilled([this](uint64_t index, uint64_t k,
+                                const epoch_counters& c) {
+            add(index, k, c);
+        });
+        for_each_in_ring([this](uint64_t index, uint64_t k,
+                                const epoch_counters& c) {
+            add(index, k, c);
+        });
+
+        if (spill_ != nullptr) {
+            std::fclose(spill_);
+            spill_ = nullptr;
+        }
+        n_epochs_ = 0;
+        head_ = 0;
+        current_ = nullptr;
+    }
+
+    uint64_t width_ns_;
+    std::vector<epoch> ring_;
+    size_t n_epochs_;
+    // First epoch of the ring
+    size_t head_;
+    epoch *current_;
+    std::FILE *spill_;
+    // Entries of the epoch being spilled
+    std::vector<epoch_entry> scratch_;
+    uint64_t n_spilled_;
+    uint64_t n_dropped_;
+
+    // Epochs of all threads, and their indices ordered by communicator id
+    std::vector<epoch_entry> collected_;
+    std::vector<size_t> by_comm_;
+    std::vector<size_t> comm_offsets_;
+    bool indexed_;
+    // Counters by epoch (high 32 bits) and MPI_COMM_WORLD rank
+    std::unordered_map<uint64_t, epoch_counters> world_;
+};
+
+}
+
+#endif
@@ -0,0 +1,353 @@
+#ifndef __EVENT_LOG_HPP__
+#define __EVENT_LOG_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pfprof {
+
+// Full event trace (FEATURE_EVENTS). Every thread appends records to one of
+// its two buffers; a full buffer is handed to a background thread that
+// writes it to the file while the other one is filled. If the writer has
+// not returned the other buffer yet, records are dropped and counted rather
+// than waiting for I/O.
+//
+// File layout, in native byte order:
+//   header: char magic[8] = "PFPROFEV", uint32_t version, int32_t rank
+//   blocks: uint32_t channel, uint32_t n_records, uint64_t base_time,
+//           uint32_t n_bytes, then n_bytes of records
+// A record is an event type byte (see event_type) followed by varints:
+// zigzag time delta in ns from the previous record of the block (from
+// base_time for the first one), communicator id, zigzag peer, size in bytes
+// and zigzag tag.
+class event_log
+{
+public:
+    static const uint32_t version = 1;
+    // Largest encoded record
+    static const size_t max_record_size = 1 + 10 + 5 + 5 + 10 + 5;
+
+    struct buffer
+    {
+        // Cleared while the buffer waits for or is in the writer
+        std::atomic<bool> writable;
+        uint32_t channel;
+        uint32_t n_records;
+        uint64_t base_time;
+        uint64_t last_time;
+        size_t used;
+        buffer *next;
+        std::vector<uint8_t> data;
+
+        explicit buffer(size_t size)
+            : writable(true), channel(0), n_records(0), base_time(0),
+              last_time(0), used(0), next(nullptr), data(size)
+        {
+        }
+    };
+
+    // Double-buffered log of a single thread
+    class channel
+    {
+    public:
+        channel(event_log& log, uint32_t id, size_t buffer_size)
+            : log_(log), records_(0), dropped_(0),
+              buffers_{std::unique_ptr<buffer>(new buffer(buffer_size)),
+                       std::unique_ptr<buffer>(new buffer(buffer_size))},
+              current_(buffers_[0].get())
+        {
+            buffers_[0]->channel = id;
+            buffers_[1]->channel = id;
+        }
+
+        void append(int type, int comm_id, int peer, uint64_t len, int tag,
+                    uint64_t time)
+        {
+            if (current_->data.size() - current_->used < max_record_size &&
+                !swap()) {
+                dropped_++;
+                return;
+            }
+
+            buffer& b = *current_;
+            if (b.n_records == 0) {
+                b.base_time = time;
+                b.last_time = time;
+            }
+
+            int64_t delta = static_cast<int64_t>(time - b.last_time);
+            uint8_t *p = b.data.data() + b.used;
+
+            *p++ = static_cast<uint8_t>(type);
+            p = put_varint(p, zigzag(delta));
+            p = put_varint(p, comm_id);
+            p = put_varint(p, zigzag(peer));
+            p = put_varint(p, len);
+            p = put_varint(p, zigzag(tag));
+
+            b.used = p - b.data.data();
+            b.last_time = time;
+            b.n_records++;
+            records_++;
+        }
+
+        uint64_t records() const
+        {
+            return records_;
+        }
+
+        uint64_t dropped() const
+        {
+            return dropped_;
+        }
+
+    private:
+        friend class event_log;
+
+        static uint64_t zigzag(int64_t v)
+        {
+            return (static_cast<uint64_t>(v) << 1) ^ (v >> 63);
+        }
+
+        static uint8_t *put_varint(uint8_t *p, uint64_t v)
+        {
+            while (v >= 0x80) {
+                *p++ = static_cast<uint8_t>(v) | 0x80;
+                v >>= 7;
+            }
+            *p++ = static_cast<uint8_t>(v);
+
+            return p;
+        }
+
+        // Hands the current buffer to the writer and continues in the other
+        // one, unless the writer still holds it
+        bool swap()
+        {
+            buffer *other = current_ == buffers_[0].get() ?
+                buffers_[1].get() : buffers_[0].get();
+            if (!other->writable.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            log_.submit(current_);
+            current_ = other;
+
+            return true;
+        }
+
+        event_log& log_;
+        uint64_t records_;
+        uint64_t dropped_;
+        std::unique_ptr<buffer> buffers_[2];
+        buffer *current_;
+    };
+
+    event_log()
+        : buffer_size_(0), bytes_(0), pending_(nullptr),
+          stop_(false)
+    {
+    }
+
+    ~event_log()
+    {
+        close();
+    }
+
+    // Opens the file and starts the writer thread
+    bool open(const std::string& path, int rank, size_t buffer_size)
+    {
+        ofs_.open(path, std::ios::binary | std::ios::trunc);
+        if (!ofs_) {
+            return false;
+        }
+
+        path_ = path;
+        buffer_size_ = std::max<size_t>(buffer_size, 2 * max_record_size);
+
+        char magic[8] = {'P', 'F', 'P', 'R', 'O', 'F', 'E', 'V'};
+        uint32_t v = version;
+        int32_t r = rank;
+        ofs_.write(magic, sizeof(magic));
+        ofs_.write(reinterpret_cast<const char *>(&v), sizeof(v));
+        ofs_.write(reinterpret_cast<const char *>(&r), sizeof(r));
+        bytes_ = sizeof(magic) + sizeof(v) + sizeof(r);
+
+        writer_ = std::thread(&event_log::run, this);
+
+        return true;
+    }
+
+    bool is_open() const
+    {
+        return writer_.joinable();
+    }
+
+    // Called once per thread, on its first event
+    channel *new_channel()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        channels_.emplace_back(new channel(*this, channels_.size(),
+                                           buffer_size_));
+
+        return channels_.back().get();
+    }
+
+    // Stops the writer and writes what is left in every channel. No thread
+    // may append anymore.
+    void close()
+    {
+        if (!is_open()) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_one();
+        writer_.join();
+
+        for (auto& c : channels_) {
+            for (auto& b : c->buffers_) {
+                if (b->writable.load(std::memory_order_acquire) &&
+                    b->n_records > 0) {
+                    write_block(*b);
+                }
+            }
+        }
+
+        ofs_.close();
+    }
+
+    const std::string& path() const
+    {
+        return path_;
+    }
+
+    uint64_t bytes() const
+    {
+        return bytes_;
+    }
+
+    uint64_t records() const
+    {
+        uint64_t n = 0;
+        for (const auto& c : channels_) {
+            n += c->records();
+        }
+
+        return n;
+    }
+
+    uint64_t dropped() const
+    {
+        uint64_t n = 0;
+        for (const auto& c : channels_) {
+            n += c->dropped();
+        }
+
+        return n;
+    }
+
+private:
+    // How often the writer looks for full buffers; producers never wake it
+    // up, as notifying may enter the kernel
+    static const int poll_interval_ms = 5;
+
+    // Lock-free push of a full buffer
+    void submit(buffer *b)
+    {
+        b->writable.store(false, std::memory_order_relaxed);
+        b->next = pending_.load(std::memory_order_relaxed);
+        while (!pending_.compare_exchange_weak(b->next, b,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+        }
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        while (!stop_) {
+            cond_.wait_for(lock, std::chrono::milliseconds(poll_interval_ms));
+
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+
+        lock.unlock();
+        drain();
+    }
+
+    void drain()
+    {
+        buffer *b = pending_.exchange(nullptr, std::memory_order_acquire);
+
+        // Write in submission order
+        buffer *ordered = nullptr;
+        while (b != nullptr) {
+            buffer *next = b->next;
+            b->next = ordered;
+            ordered = b;
+            b = next;
+        }
+
+        while (ordered != nullptr) {
+            buffer *next = ordered->next;
+
+            write_block(*ordered);
+            ordered->writable.store(true, std::memory_order_release);
+            ordered = next;
+        }
+        ofs_.flush();
+    }
+
+    void write_block(buffer& b)
+    {
+        uint32_t n_bytes = b.used;
+
+        ofs_.write(reinterpret_cast<const char *>(&b.channel),
+                   sizeof(b.channel));
+        ofs_.write(reinterpret_cast<const char *>(&b.n_records),
+                   sizeof(b.n_records));
+        ofs_.write(reinterpret_cast<const char *>(&b.base_time),
+                   sizeof(b.base_time));
+        ofs_.write(reinterpret_cast<const char *>(&n_bytes), sizeof(n_bytes));
+        ofs_.write(reinterpret_cast<const char *>(b.data.data()), b.used);
+        bytes_ += sizeof(b.channel) + sizeof(b.n_records) +
+            sizeof(b.base_time) + sizeof(n_bytes) + b.used;
+
+        b.n_records = 0;
+        b.used = 0;
+    }
+
+    std::string path_;
+    size_t buffer_size_;
+    std::ofstream ofs_;
+    uint64_t bytes_;
+    std::atomic<buffer *> pending_;
+    std::vector<std::unique_ptr<channel>> channels_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stop_;
+    std::thread writer_;
+};
+
+}
+
+#endif
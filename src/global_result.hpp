@@ -0,0 +1,247 @@
+#ifndef __GLOBAL_RESULT_HPP__
+#define __GLOBAL_RESULT_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json_writer.hpp"
+#include "trace.hpp"
+
+namespace pfprof {
+
+// Job-wide result, built by merging the results of several ranks. Every
+// rank contributes a sparse row of the traffic matrix (only peers with
+// traffic) and its message size histograms, which are summed. Merged
+// results are exchanged as flat arrays of 64-bit words.
+class global_result
+{
+public:
+    // Adds the result of the calling rank; counters of sampled traces are
+    // extrapolated to totals
+    void add(const trace& t)
+    {
+        const peer_counters& c = t.world();
+        const uint64_t scale = c.sampled() ? t.sample_rate() : 1;
+        double duration = t.duration();
+        uint64_t duration_bits;
+        std::memcpy(&duration_bits, &duration, sizeof(duration));
+
+        rows_.push_back(t.rank());
+        rows_.push_back(t.n_events());
+        rows_.push_back(duration_bits);
+        pack_string(t.processor_name(), rows_);
+
+        size_t nnz_pos = rows_.size();
+        rows_.push_back(0);
+        for (const auto& i : c.used_slots()) {
+            if (c.tx_messages[i] == 0 && c.rx_messages[i] == 0) {
+                continue;
+            }
+
+            rows_.push_back(c.peer_of(i));
+            rows_.push_back(c.tx_bytes[i] * scale);
+            rows_.push_back(c.rx_bytes[i] * scale);
+            rows_.push_back(c.tx_messages[i] * scale);
+            rows_.push_back(c.rx_messages[i] * scale);
+            rows_[nnz_pos]++;
+        }
+
+        t.tx_message_sizes().for_each(
+            [this, scale](uint64_t min, uint64_t max, uint64_t frequency) {
+                tx_sizes_[std::make_pair(min, max)] += frequency * scale;
+            });
+        t.rx_message_sizes().for_each(
+            [this, scale](uint64_t min, uint64_t max, uint64_t frequency) {
+                rx_sizes_[std::make_pair(min, max)] += frequency * scale;
+            });
+    }
+
+    // Appends this result to buf
+    void pack(std::vector<uint64_t>& buf) const
+    {
+        buf.push_back(rows_.size());
+        buf.insert(buf.end(), rows_.begin(), rows_.end());
+        pack_histogram(tx_sizes_, buf);
+        pack_histogram(rx_sizes_, buf);
+    }
+
+    // Merges a result packed by another rank
+    void merge(const std::vector<uint64_t>& buf)
+    {
+        size_t pos = 0;
+
+        uint64_t n = buf[pos++];
+        rows_.insert(rows_.end(), buf.begin() + pos, buf.begin() + pos + n);
+        pos += n;
+
+        pos = unpack_histogram(buf, pos, tx_sizes_);
+        unpack_histogram(buf, pos, rx_sizes_);
+    }
+
+    // Streams the result as compact JSON; returns false if it could not be
+    // written
+    bool write(const std::string& path, const std::string& description,
+               int n_procs, int sample_rate) const
+    {
+        // Rows arrive in tree order
+        std::vector<std::pair<uint64_t, size_t>> order;
+        uint64_t n_events = 0;
+        double duration = 0.0;
+
+        for (size_t pos = 0; pos < rows_.size();) {
+            order.push_back(std::make_pair(rows_[pos], pos));
+
+            double d;
+            n_events += rows_[pos + 1];
+            std::memcpy(&d, &rows_[pos + 2], sizeof(d));
+            duration = std::max(duration, d);
+
+            pos = skip_row(pos);
+        }
+        std::sort(order.begin(), order.end());
+
+        json_writer w;
+        if (!w.open(path)) {
+            return false;
+        }
+
+        w.begin_object();
+        w.field("description", description);
+        w.field("n_procs", n_procs);
+        w.field("n_events", n_events);
+        w.field("duration", duration);
+        if (sample_rate > 1) {
+            w.field("sample_rate", sample_rate);
+        }
+
+        w.key("ranks");
+        w.begin_array();
+        for (const auto& r : order) {
+            write_row(w, r.second);
+        }
+        w.end_array();
+
+        w.key("tx_message_sizes");
+        write_histogram(w, tx_sizes_);
+        w.key("rx_message_sizes");
+        write_histogram(w, rx_sizes_);
+        w.end_object();
+
+        return w.close();
+    }
+
+private:
+    // Frequencies by (smallest, largest) size of a bucket
+    typedef std::map<std::pair<uint64_t, uint64_t>, uint64_t> bucket_map;
+
+    static void pack_string(const std::string& s, std::vector<uint64_t>& buf)
+    {
+        size_t n_words = (s.size() + 7) / 8;
+
+        buf.push_back(s.size());
+        buf.resize(buf.size() + n_words, 0);
+        std::memcpy(&buf[buf.size() - n_words], s.data(), s.size());
+    }
+
+    static size_t unpack_string(const std::vector<uint64_t>& buf, size_t pos,
+                                std::string& s)
+    {
+        size_t len = buf[pos++];
+
+        s.assign(reinterpret_cast<const char *>(&buf[pos]), len);
+
+        return pos + (len + 7) / 8;
+    }
+
+    static void pack_histogram(const bucket_map& h, std::vector<uint64_t>& buf)
+    {
+        buf.push_back(h.size());
+        for (const auto& kv : h) {
+            buf.push_back(kv.first.first);
+            buf.push_back(kv.first.second);
+            buf.push_back(kv.second);
+        }
+    }
+
+    static size_t unpack_histogram(const std::vector<uint64_t>& buf,
+                                   size_t pos, bucket_map& h)
+    {
+        uint64_t n = buf[pos++];
+
+        for (uint64_t i = 0; i < n; i++, pos += 3) {
+            h[std::make_pair(buf[pos], buf[pos + 1])] += buf[pos + 2];
+        }
+
+        return pos;
+    }
+
+    // Position of the row after the one at pos
+    size_t skip_row(size_t pos) const
+    {
+        pos += 3;
+        pos += 1 + (rows_[pos] + 7) / 8;
+
+        return pos + 1 + 5 * rows_[pos];
+    }
+
+    void write_row(json_writer& w, size_t pos) const
+    {
+        double d;
+        std::string processor_name;
+
+        w.begin_object();
+        w.field("rank", rows_[pos++]);
+        w.field("n_events", rows_[pos++]);
+        std::memcpy(&d, &rows_[pos++], sizeof(d));
+        w.field("duration", d);
+        pos = unpack_string(rows_, pos, processor_name);
+        w.field("processor_name", processor_name);
+
+        // Peers are packed with their counters, columns are written apart
+        uint64_t nnz = rows_[pos++];
+        const char *names[] = {
+            "peers", "tx_bytes", "rx_bytes", "tx_messages", "rx_messages"
+        };
+        for (size_t column = 0; column < 5; column++) {
+            w.key(names[column]);
+            w.begin_array();
+            for (uint64_t i = 0; i < nnz; i++) {
+                w.value(rows_[pos + 5 * i + column]);
+            }
+            w.end_array();
+        }
+        w.end_object();
+    }
+
+    // Same schema as the per-rank message size histograms
+    static void write_histogram(json_writer& w, const bucket_map& h)
+    {
+        w.begin_array();
+        for (const auto& kv : h) {
+            w.begin_object();
+            w.field("message_size", kv.first.first);
+            w.field("frequency", kv.second);
+            if (kv.first.second != kv.first.first) {
+                w.field("message_size_max", kv.first.second);
+            }
+            w.end_object();
+        }
+        w.end_array();
+    }
+
+    // Packed rank records: rank, n_events, duration bits, processor name
+    // (length and words), number of peers, then peer, tx_bytes, rx_bytes,
+    // tx_messages and rx_messages of every peer
+    std::vector<uint64_t> rows_;
+    bucket_map tx_sizes_;
+    bucket_map rx_sizes_;
+};
+
+}
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef __HANDLE_MAP_HPP__
+#define __HANDLE_MAP_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace pfprof {
+
+// Fixed-size map from MPI handles to records, read without locks by any
+// thread. Writers must be serialized by the caller. As in datatype_cache,
+// the slot of an erased handle is kept with a null record for handle reuse.
+// Handles that find no free slot are not stored, which overflowed() tells
+// readers so that they fall back to a locked lookup.
+template <typename T>
+class handle_map
+{
+public:
+    // Must be a power of two
+    static const size_t capacity = 4096;
+    static const int max_probes = 8;
+
+    handle_map() : overflowed_(false)
+    {
+        for (auto& e : entries_) {
+            e.key.store(0, std::memory_order_relaxed);
+            e.value.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    template <typename Handle>
+    void insert(Handle handle, T *value)
+    {
+        uintptr_t key = key_of(handle);
+        size_t slot = slot_of(key);
+
+        for (int i = 0; i < max_probes; i++) {
+            entry& e = entries_[(slot + i) & (capacity - 1)];
+            uintptr_t k = e.key.load(std::memory_order_relaxed);
+
+            if (k == key || k == 0) {
+                // The record is visible before the key of a new slot
+                e.value.store(value, std::memory_order_release);
+                e.key.store(key, std::memory_order_release);
+                return;
+            }
+        }
+
+        overflowed_.store(true, std::memory_order_relaxed);
+    }
+
+    template <typename Handle>
+    void erase(Handle handle)
+    {
+        entry *e = find_entry(key_of(handle));
+        if (e != nullptr) {
+            e->value.store(nullptr, std::memory_order_release);
+        }
+    }
+
+    // Record of a handle, or nullptr if it is unknown
+    template <typename Handle>
+    T *find(Handle handle) const
+    {
+        const entry *e = find_entry(key_of(handle));
+
+        return e != nullptr ? e->value.load(std::memory_order_acquire) :
+            nullptr;
+    }
+
+    // Whether some handle could not be stored
+    bool overflowed() const
+    {
+        return overflowed_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct entry
+    {
+        std::atomic<uintptr_t> key;
+        std::atomic<T *> value;
+    };
+
+    template <typename Handle>
+    static uintptr_t key_of(Handle handle)
+    {
+        return (uintptr_t)handle;
+    }
+
+    static size_t slot_of(uintptr_t key)
+    {
+        return ((key >> 4) * 0x9e3779b97f4a7c15ULL) & (capacity - 1);
+    }
+
+    const entry *find_entry(uintptr_t key) const
+    {
+        size_t slot = slot_of(key);
+
+        for (int i = 0; i < max_probes; i++) {
+            const entry& e = entries_[(slot + i) & (capacity - 1)];
+            uintptr_t k = e.key.load(std::memory_order_acquire);
+            if (k == key) {
+                return &e;
+            }
+            if (k == 0) {
+                break;
+            }
+        }
+
+        return nullptr;
+    }
+
+    entry *find_entry(uintptr_t key)
+    {
+        return const_cast<entry *>(
+            static_cast<const handle_map *>(this)->find_entry(key));
+    }
+
+    entry entries_[capacity];
+    std::atomic<bool> overflowed_;
+};
+
+}
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef __HISTOGRAM_HPP__
+#define __HISTOGRAM_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pfprof {
+
+// Log-linear (HDR style) histogram of unsigned 64-bit values in a fixed
+// array. Values below 2^precision get a bucket each; every larger power of
+// two is split into 2^precision buckets, so the width of a bucket is at most
+// 2^-precision of its lower bound. Nothing is allocated after init().
+class histogram
+{
+public:
+    static const int max_precision = 10;
+
+    histogram() : precision_(0)
+    {
+    }
+
+    void init(int precision)
+    {
+        precision_ = precision < 0 ? 0 :
+            (precision > max_precision ? max_precision : precision);
+        counts_.assign(static_cast<size_t>(65 - precision_) << precision_, 0);
+    }
+
+    bool empty() const
+    {
+        return counts_.empty();
+    }
+
+    int precision() const
+    {
+        return precision_;
+    }
+
+    size_t n_buckets() const
+    {
+        return counts_.size();
+    }
+
+    void record(uint64_t value, uint64_t count = 1)
+    {
+        counts_[index_of(value)] += count;
+    }
+
+    uint64_t count(size_t idx) const
+    {
+        return counts_[idx];
+    }
+
+    // Smallest value counted in a bucket
+    uint64_t lower_bound(size_t idx) const
+    {
+        if (idx < (1ULL << precision_)) {
+            return idx;
+        }
+
+        int shift = (idx >> precision_) - 1;
+        uint64_t mantissa = (idx & ((1ULL << precision_) - 1)) +
+            (1ULL << precision_);
+
+        return mantissa << shift;
+    }
+
+    // Largest value counted in a bucket
+    uint64_t upper_bound(size_t idx) const
+    {
+        if (idx + 1 == counts_.size()) {
+            return UINT64_MAX;
+        }
+
+        return lower_bound(idx + 1) - 1;
+    }
+
+    uint64_t total() const
+    {
+        uint64_t n = 0;
+        for (const auto& c : counts_) {
+            n += c;
+        }
+
+        return n;
+    }
+
+    // Upper bound of the bucket holding the q-quantile (0 <= q <= 1)
+    uint64_t percentile(double q) const
+    {
+        uint64_t n = total();
+        if (n == 0) {
+            return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(q * (n - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return upper_bound(i);
+            }
+        }
+
+        return upper_bound(counts_.size() - 1);
+    }
+
+    // Histograms must have the same precision
+    void merge(const histogram& other)
+    {
+        if (counts_.empty()) {
+            *this = other;
+            return;
+        }
+
+        for (size_t i = 0; i < other.counts_.size(); i++) {
+            counts_[i] += other.counts_[i];
+        }
+    }
+
+private:
+    size_t index_of(uint64_t value) const
+    {
+        if (value < (1ULL << precision_)) {
+            return value;
+        }
+
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - precision_;
+
+        return (static_cast<size_t>(shift + 1) << precision_) +
+            ((value >> shift) - (1ULL << precision_));
+    }
+
+    int precision_;
+    std::vector<uint64_t> counts_;
+};
+
+// Message size histogram. Up to a fixed number of distinct sizes are counted
+// exactly in an open addressing table; any further size is counted in a
+// log-linear histogram. Both are sized at init() and never grow.
+class size_histogram
+{
+public:
+    static const int max_probes = 8;
+
+    size_histogram() : mask_(0)
+    {
+    }
+
+    // exact_sizes is rounded up to a power of two; 0 disables exact mode
+    void init(int precision, size_t exact_sizes)
+    {
+        size_t capacity = 0;
+        if (exact_sizes > 0) {
+            capacity = 1;
+            while (capacity < exact_sizes) {
+                capacity <<= 1;
+            }
+        }
+
+        exact_.assign(capacity, entry{empty_key, 0});
+        mask_ = capacity - 1;
+        log_.init(precision);
+    }
+
+    bool empty() const
+    {
+        return log_.empty();
+    }
+
+    void record(uint64_t size, uint64_t count = 1)
+    {
+        if (!exact_.empty()) {
+            size_t slot = hash(size);
+
+            for (int i = 0; i < max_probes; i++) {
+                entry& e = exact_[(slot + i) & mask_];
+                if (e.size == size) {
+                    e.frequency += count;
+                    return;
+                }
+                if (e.size == empty_key) {
+                    e.size = size;
+                    e.frequency = count;
+                    return;
+                }
+            }
+        }
+
+        log_.record(size, count);
+    }
+
+    void merge(const size_histogram& other)
+    {
+        if (empty()) {
+            *this = other;
+            return;
+        }
+
+        for (const auto& e : other.exact_) {
+            if (e.size != empty_key) {
+                record(e.size, e.frequency);
+            }
+        }
+        log_.merge(other.log_);
+    }
+
+    // Calls f(min_size, max_size, frequency) for every non-empty bucket;
+    // min_size == max_size for exactly counted sizes
+    template <typename F>
+    void for_each(F f) const
+    {
+        for (const auto& e : exact_) {
+            if (e.size != empty_key) {
+                f(e.size, e.size, e.frequency);
+            }
+        }
+
+        for (size_t i = 0; i < log_.n_buckets(); i++) {
+            if (log_.count(i) > 0) {
+                f(log_.lower_bound(i), log_.upper_bound(i), log_.count(i));
+            }
+        }
+    }
+
+private:
+    static const uint64_t empty_key = UINT64_MAX;
+
+    struct entry
+    {
+        uint64_t size;
+        uint64_t frequency;
+    };
+
+    size_t hash(uint64_t size) const
+    {
+        return ((size * 0x9e3779b97f4a7c15ULL) >> 32) & mask_;
+    }
+
+    std::vector<entry> exact_;
+    size_t mask_;
+    histogram log_;
+};
+
+}
+
+#endif
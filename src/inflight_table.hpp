@@ -0,0 +1,159 @@
+#ifndef __INFLIGHT_TABLE_HPP__
+#define __INFLIGHT_TABLE_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace pfprof {
+
+// Fixed-capacity, lock-free table of in-flight requests keyed by the PERUSE
+// unique_id, holding the activation time until the request completes.
+// Requests may complete on another thread than the one that activated them,
+// so a single table is shared by all threads. Freed slots become tombstones
+// that later activations reuse.
+class inflight_table
+{
+public:
+    static const int max_probes = 16;
+
+    inflight_table() : mask_(0), dropped_(0)
+    {
+    }
+
+    // capacity is rounded up to a power of two
+    void init(size_t capacity)
+    {
+        size_t n = 1;
+        while (n < capacity) {
+            n <<= 1;
+        }
+
+        entries_.reset(new entry[n]);
+        for (size_t i = 0; i < n; i++) {
+            entries_[i].key.store(empty_key, std::memory_order_relaxed);
+            entries_[i].time.store(0, std::memory_order_relaxed);
+        }
+        mask_ = n - 1;
+    }
+
+    size_t capacity() const
+    {
+        return entries_ ? mask_ + 1 : 0;
+    }
+
+    // Activations that found no free slot and are not timed
+    uint64_t dropped() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    void insert(uintptr_t id, uint64_t time)
+    {
+        if (id == empty_key || id == tombstone_key || id == busy_key) {
+            return;
+        }
+
+        size_t slot = slot_of(id);
+
+        // Retried when another thread takes the free slot first
+        for (int attempt = 0; attempt < max_probes; attempt++) {
+            entry *free = nullptr;
+            uintptr_t free_key = empty_key;
+
+            // The whole chain is searched before a tombstone is reused, so
+            // that an id is never in the table twice
+            for (int i = 0; i < max_probes; i++) {
+                entry& e = entries_[(slot + i) & mask_];
+                uintptr_t k = e.key.load(std::memory_order_acquire);
+
+                // Persistent requests are activated again with the same id
+                if (k == id) {
+                    e.time.store(time, std::memory_order_release);
+                    return;
+                }
+                if (free == nullptr &&
+                    (k == empty_key || k == tombstone_key)) {
+                    free = &e;
+                    free_key = k;
+                }
+                if (k == empty_key) {
+                    break;
+                }
+            }
+
+            if (free == nullptr) {
+                break;
+            }
+
+            // The slot is held busy until the time is stored, so that the
+            // id is never published without its time
+            if (free->key.compare_exchange_strong(free_key, busy_key,
+                                                  std::memory_order_acquire)) {
+                free->time.store(time, std::memory_order_relaxed);
+                free->key.store(id, std::memory_order_release);
+                return;
+            }
+        }
+
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Removes a request and returns its activation time, or false if it was
+    // never inserted (dropped, or skipped by sampling)
+    bool remove(uintptr_t id, uint64_t *time)
+    {
+        if (id == empty_key || id == tombstone_key || id == busy_key) {
+            return false;
+        }
+
+        size_t slot = slot_of(id);
+
+        for (int i = 0; i < max_probes; i++) {
+            entry& e = entries_[(slot + i) & mask_];
+            uintptr_t k = e.key.load(std::memory_order_acquire);
+
+            if (k == id) {
+                uint64_t t = e.time.load(std::memory_order_relaxed);
+                // Fails if another thread removed it first
+                if (!e.key.compare_exchange_strong(
+                        k, tombstone_key, std::memory_order_acq_rel)) {
+                    return false;
+                }
+                *time = t;
+                return true;
+            }
+            if (k == empty_key) {
+                break;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    static const uintptr_t empty_key = 0;
+    static const uintptr_t tombstone_key = 1;
+    // Claimed by an insertion that has not stored its time yet
+    static const uintptr_t busy_key = 2;
+
+    struct entry
+    {
+        std::atomic<uintptr_t> key;
+        std::atomic<uint64_t> time;
+    };
+
+    size_t slot_of(uintptr_t id) const
+    {
+        return ((id >> 3) * 0x9e3779b97f4a7c15ULL >> 16) & mask_;
+    }
+
+    std::unique_ptr<entry[]> entries_;
+    size_t mask_;
+    std::atomic<uint64_t> dropped_;
+};
+
+}
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef __JSON_WRITER_HPP__
+#define __JSON_WRITER_HPP__
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "json.hpp"
+
+namespace pfprof {
+
+// Streaming writer of compact JSON. Values are appended to a buffer as they
+// are written, without building a document; the buffer is flushed to the
+// file whenever it grows past flush_size, or kept whole if no file is open.
+// Commas are inserted automatically, keys and values must alternate inside
+// objects.
+class json_writer
+{
+public:
+    static const size_t flush_size = 1 << 20;
+
+    json_writer() : fd_(-1), after_key_(false), failed_(false)
+    {
+    }
+
+    ~json_writer()
+    {
+        close();
+    }
+
+    bool open(const std::string& path)
+    {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        buf_.reserve(2 * flush_size);
+
+        return fd_ >= 0;
+    }
+
+    // Flushes and closes the file; returns false if any write failed
+    bool close()
+    {
+        if (fd_ < 0) {
+            return !failed_;
+        }
+
+        flush();
+        if (::close(fd_) != 0) {
+            failed_ = true;
+        }
+        fd_ = -1;
+
+        return !failed_;
+    }
+
+    // Everything written so far, if no file is open
+    const std::string& str() const
+    {
+        return buf_;
+    }
+
+    void begin_object()
+    {
+        separator();
+        buf_ += '{';
+        first_.push_back(true);
+    }
+
+    void end_object()
+    {
+        first_.pop_back();
+        buf_ += '}';
+    }
+
+    void begin_array()
+    {
+        separator();
+        buf_ += '[';
+        first_.push_back(true);
+    }
+
+    void end_array()
+    {
+        first_.pop_back();
+        buf_ += ']';
+    }
+
+    void key(const char *name)
+    {
+        separator();
+        string(name);
+        buf_ += ':';
+        after_key_ = true;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value &&
+                            !std::is_same<T, bool>::value>::type
+    value(T v)
+    {
+        separator();
+
+        char digits[24];
+        char *end = digits + sizeof(digits);
+        char *p = end;
+        bool negative = std::is_signed<T>::value && v < 0;
+        // Negate in unsigned arithmetic, so that the minimum value works
+        uint64_t u = negative ? 0 - static_cast<uint64_t>(v) :
+            static_cast<uint64_t>(v);
+
+        do {
+            *--p = '0' + u % 10;
+            u /= 10;
+        } while (u != 0);
+        if (negative) {
+            *--p = '-';
+        }
+
+        buf_.append(p, end - p);
+    }
+
+    void value(bool v)
+    {
+        separator();
+        buf_ += v ? "true" : "false";
+    }
+
+    // Shortest of %.15g and %.17g that reads back exactly; non-finite
+    // numbers are written as null like nlohmann::json does
+    void value(double v)
+    {
+        separator();
+
+        if (!std::isfinite(v)) {
+            buf_ += "null";
+            return;
+        }
+
+        char s[32];
+        int n = snprintf(s, sizeof(s), "%.15g", v);
+        if (std::strtod(s, nullptr) != v) {
+            n = snprintf(s, sizeof(s), "%.17g", v);
+        }
+
+        buf_.append(s, n);
+        // Keep doubles recognizable as such
+        if (buf_.find_first_of(".eE", buf_.size() - n) == std::string::npos) {
+            buf_ += ".0";
+        }
+    }
+
+    void value(const char *v)
+    {
+        separator();
+        string(v);
+    }
+
+    void value(const std::string& v)
+    {
+        value(v.c_str());
+    }
+
+    template <typename T>
+    void value(const std::vector<T>& v)
+    {
+        begin_array();
+        for (const auto& x : v) {
+            value(x);
+        }
+        end_array();
+    }
+
+    // Small nested documents that are easier to build as a DOM
+    void value(const nlohmann::json& j)
+    {
+        separator();
+        buf_ += j.dump();
+    }
+
+    template <typename T>
+    void field(const char *name, const T& v)
+    {
+        key(name);
+        value(v);
+    }
+
+private:
+    // Called before anything is appended
+    void separator()
+    {
+        if (fd_ >= 0 && buf_.size() >= flush_size) {
+            flush();
+        }
+
+        if (after_key_) {
+            after_key_ = false;
+            return;
+        }
+
+        if (!first_.empty()) {
+            if (!first_.back()) {
+                buf_ += ',';
+            }
+            first_.back() = false;
+        }
+    }
+
+    void string(const char *s)
+    {
+        static const char hex[] = "0123456789abcdef";
+
+        buf_ += '"';
+        for (; *s != '\0'; s++) {
+            unsigned char c = *s;
+
+            switch (c) {
+            case '"':
+                buf_ += "\\\"";
+                break;
+            case '\\':
+                buf_ += "\\\\";
+                break;
+            case '\n':
+                buf_ += "\\n";
+                break;
+            case '\t':
+                buf_ += "\\t";
+                break;
+            default:
+                if (c < 0x20) {
+                    buf_ += "\\u00";
+                    buf_ += hex[c >> 4];
+                    buf_ += hex[c & 0xf];
+                } else {
+                    buf_ += c;
+                }
+            }
+        }
+        buf_ += '"';
+    }
+
+    void flush()
+    {
+        const char *p = buf_.data();
+        size_t left = buf_.size();
+
+        while (left > 0) {
+            ssize_t n = ::write(fd_, p, left);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                failed_ = true;
+                break;
+            }
+            p += n;
+            left -= n;
+        }
+
+        buf_.clear();
+    }
+
+    std::string buf_;
+    int fd_;
+    // Whether the innermost open object or array is still empty
+    std::vector<bool> first_;
+    bool after_key_;
+    bool failed_;
+};
+
+}
+
+#endif
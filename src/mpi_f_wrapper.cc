@@ -1,3 +1,6 @@
+#include <string>
+#include <vector>
+
 #include <mpi.h>
 
 #include "pfprof.hpp"
@@ -59,6 +62,21 @@ extern "C" void mpi_comm_split_(MPI_Fint *comm, MPI_Fint *color, MPI_Fint *key,
     }
 }
 
+// name is blank padded to name_len characters, passed by the compiler
+extern "C" void mpi_comm_set_name_(MPI_Fint *comm, char *name,
+                                   MPI_Fint *ierr, int name_len)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+
+    while (name_len > 0 && name[name_len - 1] == ' ') {
+        name_len--;
+    }
+    std::string c_name(name, name_len);
+
+    int c_ierr = MPI_Comm_set_name(c_comm, c_name.c_str());
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
 extern "C" void mpi_comm_free_(MPI_Fint *comm, MPI_Fint *ierr)
 {
     MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
@@ -70,3 +88,651 @@ extern "C" void mpi_comm_free_(MPI_Fint *comm, MPI_Fint *ierr)
         *comm = PMPI_Comm_c2f(c_comm);
     }
 }
+
+extern "C" void mpi_type_commit_(MPI_Fint *type, MPI_Fint *ierr)
+{
+    MPI_Datatype c_type = PMPI_Type_f2c(*type);
+
+    int c_ierr = MPI_Type_commit(&c_type);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_type_free_(MPI_Fint *type, MPI_Fint *ierr)
+{
+    MPI_Datatype c_type = PMPI_Type_f2c(*type);
+
+    int c_ierr = MPI_Type_free(&c_type);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *type = PMPI_Type_c2f(c_type);
+    }
+}
+
+// Fortran MPI_IN_PLACE and MPI_BOTTOM are the addresses of common blocks of
+// Open MPI rather than the C constants
+extern "C" int mpi_fortran_in_place_;
+extern "C" int mpi_fortran_bottom_;
+
+static void *f2c_buffer(void *buf)
+{
+    if (buf == &mpi_fortran_in_place_) {
+        return MPI_IN_PLACE;
+    }
+    if (buf == &mpi_fortran_bottom_) {
+        return MPI_BOTTOM;
+    }
+
+    return buf;
+}
+
+// Count and displacement arrays are passed through as they are
+static_assert(sizeof(MPI_Fint) == sizeof(int),
+              "Fortran INTEGER arrays are passed as int arrays");
+
+// Datatypes of MPI_Alltoallw, one per peer. As in the Fortran bindings of
+// Open MPI, they are freed once the call returns, nonblocking or not.
+static std::vector<MPI_Datatype> f2c_types(const MPI_Fint *types,
+                                           MPI_Comm comm)
+{
+    int size, is_inter;
+
+    PMPI_Comm_test_inter(comm, &is_inter);
+    if (is_inter) {
+        PMPI_Comm_remote_size(comm, &size);
+    } else {
+        PMPI_Comm_size(comm, &size);
+    }
+
+    std::vector<MPI_Datatype> c_types(size);
+    for (int i = 0; i < size; i++) {
+        c_types[i] = PMPI_Type_f2c(types[i]);
+    }
+
+    return c_types;
+}
+
+// Collectives go through the C wrappers, which attribute their traffic
+
+extern "C" void mpi_barrier_(MPI_Fint *comm, MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+
+    int c_ierr = MPI_Barrier(c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_bcast_(void *buffer, MPI_Fint *count, MPI_Fint *datatype,
+                           MPI_Fint *root, MPI_Fint *comm, MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+
+    int c_ierr = MPI_Bcast(f2c_buffer(buffer), *count, c_datatype, *root,
+                           c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_gather_(void *sendbuf, MPI_Fint *sendcount,
+                            MPI_Fint *sendtype, void *recvbuf,
+                            MPI_Fint *recvcount, MPI_Fint *recvtype,
+                            MPI_Fint *root, MPI_Fint *comm, MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Gather(f2c_buffer(sendbuf), *sendcount, c_sendtype,
+                            f2c_buffer(recvbuf), *recvcount, c_recvtype,
+                            *root, c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_gatherv_(void *sendbuf, MPI_Fint *sendcount,
+                             MPI_Fint *sendtype, void *recvbuf,
+                             MPI_Fint *recvcounts, MPI_Fint *displs,
+                             MPI_Fint *recvtype, MPI_Fint *root,
+                             MPI_Fint *comm, MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Gatherv(f2c_buffer(sendbuf), *sendcount, c_sendtype,
+                             f2c_buffer(recvbuf), recvcounts, displs,
+                             c_recvtype, *root, c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_scatter_(void *sendbuf, MPI_Fint *sendcount,
+                             MPI_Fint *sendtype, void *recvbuf,
+                             MPI_Fint *recvcount, MPI_Fint *recvtype,
+                             MPI_Fint *root, MPI_Fint *comm, MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Scatter(f2c_buffer(sendbuf), *sendcount, c_sendtype,
+                             f2c_buffer(recvbuf), *recvcount, c_recvtype,
+                             *root, c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_scatterv_(void *sendbuf, MPI_Fint *sendcounts,
+                              MPI_Fint *displs, MPI_Fint *sendtype,
+                              void *recvbuf, MPI_Fint *recvcount,
+                              MPI_Fint *recvtype, MPI_Fint *root,
+                              MPI_Fint *comm, MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Scatterv(f2c_buffer(sendbuf), sendcounts, displs,
+                              c_sendtype, f2c_buffer(recvbuf), *recvcount,
+                              c_recvtype, *root, c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_allgather_(void *sendbuf, MPI_Fint *sendcount,
+                               MPI_Fint *sendtype, void *recvbuf,
+                               MPI_Fint *recvcount, MPI_Fint *recvtype,
+                               MPI_Fint *comm, MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Allgather(f2c_buffer(sendbuf), *sendcount, c_sendtype,
+                               f2c_buffer(recvbuf), *recvcount, c_recvtype,
+                               c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_allgatherv_(void *sendbuf, MPI_Fint *sendcount,
+                                MPI_Fint *sendtype, void *recvbuf,
+                                MPI_Fint *recvcounts, MPI_Fint *displs,
+                                MPI_Fint *recvtype, MPI_Fint *comm,
+                                MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Allgatherv(f2c_buffer(sendbuf), *sendcount, c_sendtype,
+                                f2c_buffer(recvbuf), recvcounts, displs,
+                                c_recvtype, c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_alltoall_(void *sendbuf, MPI_Fint *sendcount,
+                              MPI_Fint *sendtype, void *recvbuf,
+                              MPI_Fint *recvcount, MPI_Fint *recvtype,
+                              MPI_Fint *comm, MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Alltoall(f2c_buffer(sendbuf), *sendcount, c_sendtype,
+                              f2c_buffer(recvbuf), *recvcount, c_recvtype,
+                              c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_alltoallv_(void *sendbuf, MPI_Fint *sendcounts,
+                               MPI_Fint *sdispls, MPI_Fint *sendtype,
+                               void *recvbuf, MPI_Fint *recvcounts,
+                               MPI_Fint *rdispls, MPI_Fint *recvtype,
+                               MPI_Fint *comm, MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Alltoallv(f2c_buffer(sendbuf), sendcounts, sdispls,
+                               c_sendtype, f2c_buffer(recvbuf), recvcounts,
+                               rdispls, c_recvtype, c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_alltoallw_(void *sendbuf, MPI_Fint *sendcounts,
+                               MPI_Fint *sdispls, MPI_Fint *sendtypes,
+                               void *recvbuf, MPI_Fint *recvcounts,
+                               MPI_Fint *rdispls, MPI_Fint *recvtypes,
+                               MPI_Fint *comm, MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    std::vector<MPI_Datatype> c_sendtypes = f2c_types(sendtypes, c_comm);
+    std::vector<MPI_Datatype> c_recvtypes = f2c_types(recvtypes, c_comm);
+
+    int c_ierr = MPI_Alltoallw(f2c_buffer(sendbuf), sendcounts, sdispls,
+                               c_sendtypes.data(), f2c_buffer(recvbuf),
+                               recvcounts, rdispls, c_recvtypes.data(),
+                               c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_reduce_(void *sendbuf, void *recvbuf, MPI_Fint *count,
+                            MPI_Fint *datatype, MPI_Fint *op, MPI_Fint *root,
+                            MPI_Fint *comm, MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+    MPI_Op c_op = PMPI_Op_f2c(*op);
+
+    int c_ierr = MPI_Reduce(f2c_buffer(sendbuf), f2c_buffer(recvbuf), *count,
+                            c_datatype, c_op, *root, c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_allreduce_(void *sendbuf, void *recvbuf, MPI_Fint *count,
+                               MPI_Fint *datatype, MPI_Fint *op,
+                               MPI_Fint *comm, MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+    MPI_Op c_op = PMPI_Op_f2c(*op);
+
+    int c_ierr = MPI_Allreduce(f2c_buffer(sendbuf), f2c_buffer(recvbuf),
+                               *count, c_datatype, c_op, c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_reduce_scatter_(void *sendbuf, void *recvbuf,
+                                    MPI_Fint *recvcounts, MPI_Fint *datatype,
+                                    MPI_Fint *op, MPI_Fint *comm,
+                                    MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+    MPI_Op c_op = PMPI_Op_f2c(*op);
+
+    int c_ierr = MPI_Reduce_scatter(f2c_buffer(sendbuf), f2c_buffer(recvbuf),
+                                    recvcounts, c_datatype, c_op, c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_reduce_scatter_block_(void *sendbuf, void *recvbuf,
+                                          MPI_Fint *recvcount,
+                                          MPI_Fint *datatype, MPI_Fint *op,
+                                          MPI_Fint *comm, MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+    MPI_Op c_op = PMPI_Op_f2c(*op);
+
+    int c_ierr = MPI_Reduce_scatter_block(f2c_buffer(sendbuf),
+                                          f2c_buffer(recvbuf), *recvcount,
+                                          c_datatype, c_op, c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_scan_(void *sendbuf, void *recvbuf, MPI_Fint *count,
+                          MPI_Fint *datatype, MPI_Fint *op, MPI_Fint *comm,
+                          MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+    MPI_Op c_op = PMPI_Op_f2c(*op);
+
+    int c_ierr = MPI_Scan(f2c_buffer(sendbuf), f2c_buffer(recvbuf), *count,
+                          c_datatype, c_op, c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_exscan_(void *sendbuf, void *recvbuf, MPI_Fint *count,
+                            MPI_Fint *datatype, MPI_Fint *op, MPI_Fint *comm,
+                            MPI_Fint *ierr)
+{
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+    MPI_Op c_op = PMPI_Op_f2c(*op);
+
+    int c_ierr = MPI_Exscan(f2c_buffer(sendbuf), f2c_buffer(recvbuf), *count,
+                            c_datatype, c_op, c_comm);
+    if (NULL != ierr) *ierr = c_ierr;
+}
+
+extern "C" void mpi_ibarrier_(MPI_Fint *comm, MPI_Fint *request,
+                              MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+
+    int c_ierr = MPI_Ibarrier(c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_ibcast_(void *buffer, MPI_Fint *count, MPI_Fint *datatype,
+                            MPI_Fint *root, MPI_Fint *comm, MPI_Fint *request,
+                            MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+
+    int c_ierr = MPI_Ibcast(f2c_buffer(buffer), *count, c_datatype, *root,
+                            c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_igather_(void *sendbuf, MPI_Fint *sendcount,
+                             MPI_Fint *sendtype, void *recvbuf,
+                             MPI_Fint *recvcount, MPI_Fint *recvtype,
+                             MPI_Fint *root, MPI_Fint *comm,
+                             MPI_Fint *request, MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Igather(f2c_buffer(sendbuf), *sendcount, c_sendtype,
+                             f2c_buffer(recvbuf), *recvcount, c_recvtype,
+                             *root, c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_igatherv_(void *sendbuf, MPI_Fint *sendcount,
+                              MPI_Fint *sendtype, void *recvbuf,
+                              MPI_Fint *recvcounts, MPI_Fint *displs,
+                              MPI_Fint *recvtype, MPI_Fint *root,
+                              MPI_Fint *comm, MPI_Fint *request,
+                              MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Igatherv(f2c_buffer(sendbuf), *sendcount, c_sendtype,
+                              f2c_buffer(recvbuf), recvcounts, displs,
+                              c_recvtype, *root, c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_iscatter_(void *sendbuf, MPI_Fint *sendcount,
+                              MPI_Fint *sendtype, void *recvbuf,
+                              MPI_Fint *recvcount, MPI_Fint *recvtype,
+                              MPI_Fint *root, MPI_Fint *comm,
+                              MPI_Fint *request, MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Iscatter(f2c_buffer(sendbuf), *sendcount, c_sendtype,
+                              f2c_buffer(recvbuf), *recvcount, c_recvtype,
+                              *root, c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_iscatterv_(void *sendbuf, MPI_Fint *sendcounts,
+                               MPI_Fint *displs, MPI_Fint *sendtype,
+                               void *recvbuf, MPI_Fint *recvcount,
+                               MPI_Fint *recvtype, MPI_Fint *root,
+                               MPI_Fint *comm, MPI_Fint *request,
+                               MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Iscatterv(f2c_buffer(sendbuf), sendcounts, displs,
+                               c_sendtype, f2c_buffer(recvbuf), *recvcount,
+                               c_recvtype, *root, c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_iallgather_(void *sendbuf, MPI_Fint *sendcount,
+                                MPI_Fint *sendtype, void *recvbuf,
+                                MPI_Fint *recvcount, MPI_Fint *recvtype,
+                                MPI_Fint *comm, MPI_Fint *request,
+                                MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Iallgather(f2c_buffer(sendbuf), *sendcount, c_sendtype,
+                                f2c_buffer(recvbuf), *recvcount, c_recvtype,
+                                c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_iallgatherv_(void *sendbuf, MPI_Fint *sendcount,
+                                 MPI_Fint *sendtype, void *recvbuf,
+                                 MPI_Fint *recvcounts, MPI_Fint *displs,
+                                 MPI_Fint *recvtype, MPI_Fint *comm,
+                                 MPI_Fint *request, MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Iallgatherv(f2c_buffer(sendbuf), *sendcount, c_sendtype,
+                                 f2c_buffer(recvbuf), recvcounts, displs,
+                                 c_recvtype, c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_ialltoall_(void *sendbuf, MPI_Fint *sendcount,
+                               MPI_Fint *sendtype, void *recvbuf,
+                               MPI_Fint *recvcount, MPI_Fint *recvtype,
+                               MPI_Fint *comm, MPI_Fint *request,
+                               MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Ialltoall(f2c_buffer(sendbuf), *sendcount, c_sendtype,
+                               f2c_buffer(recvbuf), *recvcount, c_recvtype,
+                               c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_ialltoallv_(void *sendbuf, MPI_Fint *sendcounts,
+                                MPI_Fint *sdispls, MPI_Fint *sendtype,
+                                void *recvbuf, MPI_Fint *recvcounts,
+                                MPI_Fint *rdispls, MPI_Fint *recvtype,
+                                MPI_Fint *comm, MPI_Fint *request,
+                                MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_sendtype = PMPI_Type_f2c(*sendtype);
+    MPI_Datatype c_recvtype = PMPI_Type_f2c(*recvtype);
+
+    int c_ierr = MPI_Ialltoallv(f2c_buffer(sendbuf), sendcounts, sdispls,
+                                c_sendtype, f2c_buffer(recvbuf), recvcounts,
+                                rdispls, c_recvtype, c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_ialltoallw_(void *sendbuf, MPI_Fint *sendcounts,
+                                MPI_Fint *sdispls, MPI_Fint *sendtypes,
+                                void *recvbuf, MPI_Fint *recvcounts,
+                                MPI_Fint *rdispls, MPI_Fint *recvtypes,
+                                MPI_Fint *comm, MPI_Fint *request,
+                                MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    std::vector<MPI_Datatype> c_sendtypes = f2c_types(sendtypes, c_comm);
+    std::vector<MPI_Datatype> c_recvtypes = f2c_types(recvtypes, c_comm);
+
+    int c_ierr = MPI_Ialltoallw(f2c_buffer(sendbuf), sendcounts, sdispls,
+                                c_sendtypes.data(), f2c_buffer(recvbuf),
+                                recvcounts, rdispls, c_recvtypes.data(),
+                                c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_ireduce_(void *sendbuf, void *recvbuf, MPI_Fint *count,
+                             MPI_Fint *datatype, MPI_Fint *op, MPI_Fint *root,
+                             MPI_Fint *comm, MPI_Fint *request,
+                             MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+    MPI_Op c_op = PMPI_Op_f2c(*op);
+
+    int c_ierr = MPI_Ireduce(f2c_buffer(sendbuf), f2c_buffer(recvbuf),
+                             *count, c_datatype, c_op, *root, c_comm,
+                             &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_iallreduce_(void *sendbuf, void *recvbuf,
+                                MPI_Fint *count, MPI_Fint *datatype,
+                                MPI_Fint *op, MPI_Fint *comm,
+                                MPI_Fint *request, MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+    MPI_Op c_op = PMPI_Op_f2c(*op);
+
+    int c_ierr = MPI_Iallreduce(f2c_buffer(sendbuf), f2c_buffer(recvbuf),
+                                *count, c_datatype, c_op, c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_ireduce_scatter_(void *sendbuf, void *recvbuf,
+                                     MPI_Fint *recvcounts, MPI_Fint *datatype,
+                                     MPI_Fint *op, MPI_Fint *comm,
+                                     MPI_Fint *request, MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+    MPI_Op c_op = PMPI_Op_f2c(*op);
+
+    int c_ierr = MPI_Ireduce_scatter(f2c_buffer(sendbuf), f2c_buffer(recvbuf),
+                                     recvcounts, c_datatype, c_op, c_comm,
+                                     &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_ireduce_scatter_block_(void *sendbuf, void *recvbuf,
+                                           MPI_Fint *recvcount,
+                                           MPI_Fint *datatype, MPI_Fint *op,
+                                           MPI_Fint *comm, MPI_Fint *request,
+                                           MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+    MPI_Op c_op = PMPI_Op_f2c(*op);
+
+    int c_ierr = MPI_Ireduce_scatter_block(f2c_buffer(sendbuf),
+                                           f2c_buffer(recvbuf), *recvcount,
+                                           c_datatype, c_op, c_comm,
+                                           &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_iscan_(void *sendbuf, void *recvbuf, MPI_Fint *count,
+                           MPI_Fint *datatype, MPI_Fint *op, MPI_Fint *comm,
+                           MPI_Fint *request, MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+    MPI_Op c_op = PMPI_Op_f2c(*op);
+
+    int c_ierr = MPI_Iscan(f2c_buffer(sendbuf), f2c_buffer(recvbuf), *count,
+                           c_datatype, c_op, c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
+
+extern "C" void mpi_iexscan_(void *sendbuf, void *recvbuf, MPI_Fint *count,
+                             MPI_Fint *datatype, MPI_Fint *op, MPI_Fint *comm,
+                             MPI_Fint *request, MPI_Fint *ierr)
+{
+    MPI_Request c_request;
+    MPI_Comm c_comm = PMPI_Comm_f2c(*comm);
+    MPI_Datatype c_datatype = PMPI_Type_f2c(*datatype);
+    MPI_Op c_op = PMPI_Op_f2c(*op);
+
+    int c_ierr = MPI_Iexscan(f2c_buffer(sendbuf), f2c_buffer(recvbuf), *count,
+                             c_datatype, c_op, c_comm, &c_request);
+    if (NULL != ierr) *ierr = c_ierr;
+
+    if (MPI_SUCCESS == c_ierr) {
+        *request = PMPI_Request_c2f(c_request);
+    }
+}
@@ -31,10 +31,9 @@ extern "C" int MPI_Comm_create(MPI_Comm comm, MPI_Group group,
         return ret;
     }
 
-    pfprof::register_comm(*newcomm);
+    pfprof::register_comm(*newcomm, comm, pfprof::COMM_CREATE);
 
-    return pfprof::register_event_handlers(*newcomm,
-                                          pfprof::peruse_event_handler);
+    return pfprof::register_event_handlers(*newcomm);
 }
 
 extern "C" int MPI_Comm_dup(MPI_Comm comm, MPI_Comm *newcomm)
@@ -44,10 +43,9 @@ extern "C" int MPI_Comm_dup(MPI_Comm comm, MPI_Comm *newcomm)
         return ret;
     }
 
-    pfprof::register_comm(*newcomm);
+    pfprof::register_comm(*newcomm, comm, pfprof::COMM_DUP);
 
-    return pfprof::register_event_handlers(*newcomm,
-                                          pfprof::peruse_event_handler);
+    return pfprof::register_event_handlers(*newcomm);
 }
 
 extern "C" int MPI_Comm_split(MPI_Comm comm, int color, int key,
@@ -58,24 +56,425 @@ extern "C" int MPI_Comm_split(MPI_Comm comm, int color, int key,
         return ret;
     }
 
-    pfprof::register_comm(*newcomm);
+    pfprof::register_comm(*newcomm, comm, pfprof::COMM_SPLIT);
 
-    return pfprof::register_event_handlers(*newcomm,
-                                          pfprof::peruse_event_handler);
+    return pfprof::register_event_handlers(*newcomm);
+}
+
+extern "C" int MPI_Comm_set_name(MPI_Comm comm, const char *comm_name)
+{
+    int ret = PMPI_Comm_set_name(comm, comm_name);
+    if (ret != MPI_SUCCESS) {
+        return ret;
+    }
+
+    return pfprof::set_comm_name(comm, comm_name);
 }
 
 extern "C" int MPI_Comm_free(MPI_Comm *comm)
 {
     MPI_Comm cm = *comm;
 
+    // PMPI_Comm_free resets the handle, so stop tracing the communicator
+    // before it goes away
+    pfprof::remove_event_handlers(cm);
+
     int ret = PMPI_Comm_free(comm);
     if (ret != MPI_SUCCESS) {
         return ret;
     }
 
-    pfprof::unregister_comm(*comm);
+    return pfprof::unregister_comm(cm);
+}
+
+extern "C" int MPI_Type_commit(MPI_Datatype *type)
+{
+    int ret = PMPI_Type_commit(type);
+    if (ret != MPI_SUCCESS) {
+        return ret;
+    }
+
+    return pfprof::register_datatype(*type);
+}
+
+extern "C" int MPI_Type_free(MPI_Datatype *type)
+{
+    MPI_Datatype t = *type;
+
+    int ret = PMPI_Type_free(type);
+    if (ret != MPI_SUCCESS) {
+        return ret;
+    }
+
+    return pfprof::unregister_datatype(t);
+}
+
+// Collectives mark the calling thread, so that the point-to-point traffic
+// they cause is attributed to them. Nonblocking ones keep progressing after
+// they return, see pfprof::enter_collective().
+class collective_guard
+{
+public:
+    collective_guard(MPI_Comm comm, pfprof::collective kind)
+        : saved_(pfprof::enter_collective(comm, kind))
+    {
+    }
+
+    ~collective_guard()
+    {
+        pfprof::leave_collective(saved_);
+    }
+
+private:
+    pfprof::collective_context saved_;
+};
+
+extern "C" int MPI_Barrier(MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_BARRIER);
+
+    return PMPI_Barrier(comm);
+}
+
+extern "C" int MPI_Bcast(void *buffer, int count, MPI_Datatype datatype,
+                         int root, MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_BCAST);
+
+    return PMPI_Bcast(buffer, count, datatype, root, comm);
+}
+
+extern "C" int MPI_Gather(const void *sendbuf, int sendcount,
+                          MPI_Datatype sendtype, void *recvbuf, int recvcount,
+                          MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_GATHER);
+
+    return PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                       recvtype, root, comm);
+}
+
+extern "C" int MPI_Gatherv(const void *sendbuf, int sendcount,
+                           MPI_Datatype sendtype, void *recvbuf,
+                           const int recvcounts[], const int displs[],
+                           MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_GATHERV);
+
+    return PMPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts,
+                        displs, recvtype, root, comm);
+}
+
+extern "C" int MPI_Scatter(const void *sendbuf, int sendcount,
+                           MPI_Datatype sendtype, void *recvbuf, int recvcount,
+                           MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_SCATTER);
+
+    return PMPI_Scatter(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                        recvtype, root, comm);
+}
+
+extern "C" int MPI_Scatterv(const void *sendbuf, const int sendcounts[],
+                            const int displs[], MPI_Datatype sendtype,
+                            void *recvbuf, int recvcount,
+                            MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_SCATTERV);
+
+    return PMPI_Scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf,
+                         recvcount, recvtype, root, comm);
+}
+
+extern "C" int MPI_Allgather(const void *sendbuf, int sendcount,
+                             MPI_Datatype sendtype, void *recvbuf,
+                             int recvcount, MPI_Datatype recvtype,
+                             MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_ALLGATHER);
+
+    return PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                          recvtype, comm);
+}
+
+extern "C" int MPI_Allgatherv(const void *sendbuf, int sendcount,
+                              MPI_Datatype sendtype, void *recvbuf,
+                              const int recvcounts[], const int displs[],
+                              MPI_Datatype recvtype, MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_ALLGATHERV);
+
+    return PMPI_Allgatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts,
+                           displs, recvtype, comm);
+}
+
+extern "C" int MPI_Alltoall(const void *sendbuf, int sendcount,
+                            MPI_Datatype sendtype, void *recvbuf,
+                            int recvcount, MPI_Datatype recvtype,
+                            MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_ALLTOALL);
+
+    return PMPI_Alltoall(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                         recvtype, comm);
+}
+
+extern "C" int MPI_Alltoallv(const void *sendbuf, const int sendcounts[],
+                             const int sdispls[], MPI_Datatype sendtype,
+                             void *recvbuf, const int recvcounts[],
+                             const int rdispls[], MPI_Datatype recvtype,
+                             MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_ALLTOALLV);
+
+    return PMPI_Alltoallv(sendbuf, sendcounts, sdispls, sendtype, recvbuf,
+                          recvcounts, rdispls, recvtype, comm);
+}
+
+extern "C" int MPI_Alltoallw(const void *sendbuf, const int sendcounts[],
+                             const int sdispls[],
+                             const MPI_Datatype sendtypes[], void *recvbuf,
+                             const int recvcounts[], const int rdispls[],
+                             const MPI_Datatype recvtypes[], MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_ALLTOALLW);
+
+    return PMPI_Alltoallw(sendbuf, sendcounts, sdispls, sendtypes, recvbuf,
+                          recvcounts, rdispls, recvtypes, comm);
+}
+
+extern "C" int MPI_Reduce(const void *sendbuf, void *recvbuf, int count,
+                          MPI_Datatype datatype, MPI_Op op, int root,
+                          MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_REDUCE);
+
+    return PMPI_Reduce(sendbuf, recvbuf, count, datatype, op, root, comm);
+}
+
+extern "C" int MPI_Allreduce(const void *sendbuf, void *recvbuf, int count,
+                             MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_ALLREDUCE);
+
+    return PMPI_Allreduce(sendbuf, recvbuf, count, datatype, op, comm);
+}
+
+extern "C" int MPI_Reduce_scatter(const void *sendbuf, void *recvbuf,
+                                  const int recvcounts[],
+                                  MPI_Datatype datatype, MPI_Op op,
+                                  MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_REDUCE_SCATTER);
+
+    return PMPI_Reduce_scatter(sendbuf, recvbuf, recvcounts, datatype, op,
+                               comm);
+}
+
+extern "C" int MPI_Reduce_scatter_block(const void *sendbuf, void *recvbuf,
+                                        int recvcount, MPI_Datatype datatype,
+                                        MPI_Op op, MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_REDUCE_SCATTER_BLOCK);
+
+    return PMPI_Reduce_scatter_block(sendbuf, recvbuf, recvcount, datatype, op,
+                                     comm);
+}
+
+extern "C" int MPI_Scan(const void *sendbuf, void *recvbuf, int count,
+                        MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_SCAN);
+
+    return PMPI_Scan(sendbuf, recvbuf, count, datatype, op, comm);
+}
+
+extern "C" int MPI_Exscan(const void *sendbuf, void *recvbuf, int count,
+                          MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+    collective_guard guard(comm, pfprof::COLL_EXSCAN);
+
+    return PMPI_Exscan(sendbuf, recvbuf, count, datatype, op, comm);
+}
+
+extern "C" int MPI_Ibarrier(MPI_Comm comm, MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IBARRIER);
+
+    return PMPI_Ibarrier(comm, request);
+}
+
+extern "C" int MPI_Ibcast(void *buffer, int count, MPI_Datatype datatype,
+                          int root, MPI_Comm comm, MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IBCAST);
+
+    return PMPI_Ibcast(buffer, count, datatype, root, comm, request);
+}
+
+extern "C" int MPI_Igather(const void *sendbuf, int sendcount,
+                           MPI_Datatype sendtype, void *recvbuf, int recvcount,
+                           MPI_Datatype recvtype, int root, MPI_Comm comm,
+                           MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IGATHER);
+
+    return PMPI_Igather(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                        recvtype, root, comm, request);
+}
+
+extern "C" int MPI_Igatherv(const void *sendbuf, int sendcount,
+                            MPI_Datatype sendtype, void *recvbuf,
+                            const int recvcounts[], const int displs[],
+                            MPI_Datatype recvtype, int root, MPI_Comm comm,
+                            MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IGATHERV);
+
+    return PMPI_Igatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts,
+                         displs, recvtype, root, comm, request);
+}
+
+extern "C" int MPI_Iscatter(const void *sendbuf, int sendcount,
+                            MPI_Datatype sendtype, void *recvbuf,
+                            int recvcount, MPI_Datatype recvtype, int root,
+                            MPI_Comm comm, MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_ISCATTER);
+
+    return PMPI_Iscatter(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                         recvtype, root, comm, request);
+}
+
+extern "C" int MPI_Iscatterv(const void *sendbuf, const int sendcounts[],
+                             const int displs[], MPI_Datatype sendtype,
+                             void *recvbuf, int recvcount,
+                             MPI_Datatype recvtype, int root, MPI_Comm comm,
+                             MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_ISCATTERV);
+
+    return PMPI_Iscatterv(sendbuf, sendcounts, displs, sendtype, recvbuf,
+                          recvcount, recvtype, root, comm, request);
+}
+
+extern "C" int MPI_Iallgather(const void *sendbuf, int sendcount,
+                              MPI_Datatype sendtype, void *recvbuf,
+                              int recvcount, MPI_Datatype recvtype,
+                              MPI_Comm comm, MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IALLGATHER);
+
+    return PMPI_Iallgather(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                           recvtype, comm, request);
+}
+
+extern "C" int MPI_Iallgatherv(const void *sendbuf, int sendcount,
+                               MPI_Datatype sendtype, void *recvbuf,
+                               const int recvcounts[], const int displs[],
+                               MPI_Datatype recvtype, MPI_Comm comm,
+                               MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IALLGATHERV);
+
+    return PMPI_Iallgatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts,
+                            displs, recvtype, comm, request);
+}
+
+extern "C" int MPI_Ialltoall(const void *sendbuf, int sendcount,
+                             MPI_Datatype sendtype, void *recvbuf,
+                             int recvcount, MPI_Datatype recvtype,
+                             MPI_Comm comm, MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IALLTOALL);
+
+    return PMPI_Ialltoall(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                          recvtype, comm, request);
+}
+
+extern "C" int MPI_Ialltoallv(const void *sendbuf, const int sendcounts[],
+                              const int sdispls[], MPI_Datatype sendtype,
+                              void *recvbuf, const int recvcounts[],
+                              const int rdispls[], MPI_Datatype recvtype,
+                              MPI_Comm comm, MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IALLTOALLV);
+
+    return PMPI_Ialltoallv(sendbuf, sendcounts, sdispls, sendtype, recvbuf,
+                           recvcounts, rdispls, recvtype, comm, request);
+}
+
+extern "C" int MPI_Ialltoallw(const void *sendbuf, const int sendcounts[],
+                              const int sdispls[],
+                              const MPI_Datatype sendtypes[], void *recvbuf,
+                              const int recvcounts[], const int rdispls[],
+                              const MPI_Datatype recvtypes[], MPI_Comm comm,
+                              MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IALLTOALLW);
+
+    return PMPI_Ialltoallw(sendbuf, sendcounts, sdispls, sendtypes, recvbuf,
+                           recvcounts, rdispls, recvtypes, comm, request);
+}
+
+extern "C" int MPI_Ireduce(const void *sendbuf, void *recvbuf, int count,
+                           MPI_Datatype datatype, MPI_Op op, int root,
+                           MPI_Comm comm, MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IREDUCE);
+
+    return PMPI_Ireduce(sendbuf, recvbuf, count, datatype, op, root, comm,
+                        request);
+}
+
+extern "C" int MPI_Iallreduce(const void *sendbuf, void *recvbuf, int count,
+                              MPI_Datatype datatype, MPI_Op op, MPI_Comm comm,
+                              MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IALLREDUCE);
+
+    return PMPI_Iallreduce(sendbuf, recvbuf, count, datatype, op, comm,
+                           request);
+}
+
+extern "C" int MPI_Ireduce_scatter(const void *sendbuf, void *recvbuf,
+                                   const int recvcounts[],
+                                   MPI_Datatype datatype, MPI_Op op,
+                                   MPI_Comm comm, MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IREDUCE_SCATTER);
+
+    return PMPI_Ireduce_scatter(sendbuf, recvbuf, recvcounts, datatype, op,
+                                comm, request);
+}
+
+extern "C" int MPI_Ireduce_scatter_block(const void *sendbuf, void *recvbuf,
+                                         int recvcount, MPI_Datatype datatype,
+                                         MPI_Op op, MPI_Comm comm,
+                                         MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IREDUCE_SCATTER_BLOCK);
+
+    return PMPI_Ireduce_scatter_block(sendbuf, recvbuf, recvcount, datatype,
+                                      op, comm, request);
+}
+
+extern "C" int MPI_Iscan(const void *sendbuf, void *recvbuf, int count,
+                         MPI_Datatype datatype, MPI_Op op, MPI_Comm comm,
+                         MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_ISCAN);
+
+    return PMPI_Iscan(sendbuf, recvbuf, count, datatype, op, comm, request);
+}
+
+extern "C" int MPI_Iexscan(const void *sendbuf, void *recvbuf, int count,
+                           MPI_Datatype datatype, MPI_Op op, MPI_Comm comm,
+                           MPI_Request *request)
+{
+    collective_guard guard(comm, pfprof::COLL_IEXSCAN);
 
-    return pfprof::remove_event_handlers(*comm);
+    return PMPI_Iexscan(sendbuf, recvbuf, count, datatype, op, comm, request);
 }
 
 extern "C" int MPI_Finalize()
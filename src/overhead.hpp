@@ -0,0 +1,137 @@
+#ifndef __OVERHEAD_HPP__
+#define __OVERHEAD_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include "histogram.hpp"
+#include "json.hpp"
+
+namespace pfprof {
+
+// Time the profiler spends in one of its own routines, in cycles
+struct overhead_counter
+{
+    uint64_t calls;
+    uint64_t cycles;
+    // Longest call
+    uint64_t max;
+
+    overhead_counter() : calls(0), cycles(0), max(0)
+    {
+    }
+
+    void add(uint64_t c)
+    {
+        calls++;
+        cycles += c;
+        max = std::max(max, c);
+    }
+
+    void merge(const overhead_counter& other)
+    {
+        calls += other.calls;
+        cycles += other.cycles;
+        max = std::max(max, other.max);
+    }
+};
+
+// Self-overhead of the profiler (FEATURE_OVERHEAD)
+class overhead
+{
+public:
+    static const int handler_precision = 3;
+
+    overhead_counter handler;
+    overhead_counter register_comm;
+    overhead_counter register_event_handlers;
+    overhead_counter write_result;
+
+    overhead() : threads_(0)
+    {
+    }
+
+    void init()
+    {
+        handler_cycles_.init(handler_precision);
+    }
+
+    void record_handler(uint64_t cycles)
+    {
+        handler.add(cycles);
+        handler_cycles_.record(cycles);
+    }
+
+    void merge(const overhead& other)
+    {
+        handler.merge(other.handler);
+        register_comm.merge(other.register_comm);
+        register_event_handlers.merge(other.register_event_handlers);
+        write_result.merge(other.write_result);
+        handler_cycles_.merge(other.handler_cycles_);
+        threads_ += other.threads();
+    }
+
+    // Threads that ran event handlers, whose shards were merged into this
+    int threads() const
+    {
+        return threads_ > 0 ? threads_ : (handler.calls > 0 ? 1 : 0);
+    }
+
+    uint64_t total_cycles() const
+    {
+        return handler.cycles + register_comm.cycles +
+            register_event_handlers.cycles + write_result.cycles;
+    }
+
+    // Times in seconds, per-event percentiles in nanoseconds
+    nlohmann::json to_json(double cycles_per_ns, double duration) const
+    {
+        auto seconds = [cycles_per_ns](uint64_t cycles) {
+            return cycles / cycles_per_ns / 1000000000.0;
+        };
+        auto counter = [&seconds](const overhead_counter& c) {
+            return nlohmann::json{
+                {"calls", c.calls},
+                {"time", seconds(c.cycles)},
+            };
+        };
+        auto ns = [cycles_per_ns](uint64_t cycles) {
+            return cycles / cycles_per_ns;
+        };
+
+        nlohmann::json j;
+
+        j["handler"] = counter(handler);
+        j["handler"]["p50"] = ns(handler_cycles_.percentile(0.5));
+        j["handler"]["p90"] = ns(handler_cycles_.percentile(0.9));
+        j["handler"]["p99"] = ns(handler_cycles_.percentile(0.99));
+        j["handler"]["p999"] = ns(handler_cycles_.percentile(0.999));
+        // Percentiles are bucket bounds, the largest time is exact
+        j["handler"]["max"] = ns(handler.max);
+        j["register_comm"] = counter(register_comm);
+        j["register_event_handlers"] = counter(register_event_handlers);
+        // Excludes writing the serialized result to the file
+        j["write_result"] = counter(write_result);
+
+        // Handler time adds up over threads, each busy for at most
+        // duration
+        double total = seconds(total_cycles());
+        int n_threads = std::max(threads(), 1);
+        j["time"] = total;
+        j["threads"] = n_threads;
+        j["fraction"] = duration > 0.0 ?
+            total / (duration * n_threads) : 0.0;
+
+        return j;
+    }
+
+private:
+    histogram handler_cycles_;
+    int threads_;
+};
+
+}
+
+#endif
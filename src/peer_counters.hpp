@@ -0,0 +1,341 @@
+#ifndef __PEER_COUNTERS_HPP__
+#define __PEER_COUNTERS_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "histogram.hpp"
+#include "transfer_stats.hpp"
+
+namespace pfprof {
+
+// Per-peer counters of a communicator. Counters are stored by slot; slot_of()
+// maps the rank of a peer within the communicator to its slot. Large
+// communicators start sparse, with a slot per peer actually seen, found
+// through an open addressing table, and switch to dense storage (slot ==
+// peer) once a quarter of their peers have been seen. Small communicators
+// are always dense.
+class peer_counters
+{
+public:
+    // Communicators up to this size are dense from the start
+    static const int dense_min_size = 64;
+    // Switch to dense once size / dense_ratio peers have been seen
+    static const int dense_ratio = 4;
+
+    std::vector<uint64_t> tx_bytes;
+    std::vector<uint64_t> rx_bytes;
+    std::vector<uint64_t> tx_messages;
+    std::vector<uint64_t> rx_messages;
+    // Statistical sampling only: events to skip before the next sample (0
+    // until the first event of the peer), and sums of squared sampled sizes
+    // for confidence intervals
+    std::vector<uint32_t> tx_countdown;
+    std::vector<uint32_t> rx_countdown;
+    std::vector<double> tx_bytes_sq;
+    std::vector<double> rx_bytes_sq;
+    // Timing only: request latencies in ns, allocated on first completion
+    std::vector<histogram> tx_latency;
+    std::vector<histogram> rx_latency;
+    // Unexpected message tracking only: messages from the peer that found
+    // no posted receive, and their size
+    std::vector<uint64_t> unexpected_messages;
+    std::vector<uint64_t> unexpected_bytes;
+    // Transfer tracking only: timed payload transfers to and from the peer
+    std::vector<transfer_stats> tx_transfers;
+    std::vector<transfer_stats> rx_transfers;
+
+    peer_counters()
+        : size_(0), sampling_(false), timing_(false), unexpected_(false),
+          transfers_(false), dense_(true), mask_(0)
+    {
+    }
+
+    // Drops all counters
+    void init(int size, bool sampling, bool timing, bool unexpected,
+              bool transfers)
+    {
+        size_ = size;
+        sampling_ = sampling;
+        timing_ = timing;
+        unexpected_ = unexpected;
+        transfers_ = transfers;
+        dense_ = size <= dense_min_size;
+        peers_.clear();
+
+        if (dense_) {
+            table_.clear();
+            mask_ = 0;
+            resize(size);
+        } else {
+            table_.assign(16, -1);
+            mask_ = table_.size() - 1;
+            resize(0);
+        }
+    }
+
+    // Number of ranks in the communicator
+    int size() const
+    {
+        return size_;
+    }
+
+    int n_slots() const
+    {
+        return tx_bytes.size();
+    }
+
+    bool dense() const
+    {
+        return dense_;
+    }
+
+    bool sampled() const
+    {
+        return sampling_;
+    }
+
+    bool timed() const
+    {
+        return timing_;
+    }
+
+    bool tracks_unexpected() const
+    {
+        return unexpected_;
+    }
+
+    bool tracks_transfers() const
+    {
+        return transfers_;
+    }
+
+    int peer_of(int slot) const
+    {
+        return dense_ ? slot : peers_[slot];
+    }
+
+    // Slot of a peer (0 <= peer < size()), created if needed
+    int slot_of(int peer)
+    {
+        if (dense_) {
+            return peer;
+        }
+
+        size_t h = hash(peer);
+        for (;;) {
+            int slot = table_[h];
+            if (slot < 0) {
+                break;
+            }
+            if (peers_[slot] == peer) {
+                return slot;
+            }
+            h = (h + 1) & mask_;
+        }
+
+        if ((n_slots() + 1) * dense_ratio > size_) {
+            densify();
+            return peer;
+        }
+
+        int slot = n_slots();
+        peers_.push_back(peer);
+        resize(slot + 1);
+        table_[h] = slot;
+
+        // Keep the load factor at most 1/2
+        if (2 * n_slots() > static_cast<int>(table_.size())) {
+            rehash(2 * table_.size());
+        }
+
+        return slot;
+    }
+
+    // Whether a slot has counted anything; slots of sparse counters always
+    // belong to a peer that has been seen
+    bool used(int slot) const
+    {
+        return tx_messages[slot] != 0 || rx_messages[slot] != 0 ||
+            (timing_ && (!tx_latency[slot].empty() ||
+                         !rx_latency[slot].empty())) ||
+            (unexpected_ && unexpected_messages[slot] != 0) ||
+            (transfers_ && (!tx_transfers[slot].empty() ||
+                            !rx_transfers[slot].empty()));
+    }
+
+    // Used slots, in increasing peer order
+    std::vector<int> used_slots() const
+    {
+        std::vector<int> slots;
+
+        for (int i = 0; i < n_slots(); i++) {
+            if (used(i)) {
+                slots.push_back(i);
+            }
+        }
+
+        if (!dense_) {
+            std::sort(slots.begin(), slots.end(), [this](int a, int b) {
+                return peers_[a] < peers_[b];
+            });
+        }
+
+        return slots;
+    }
+
+    // Adds the counters of slot `from` of other to peer `peer`
+    void add(int peer, const peer_counters& other, int from)
+    {
+        int i = slot_of(peer);
+
+        tx_bytes[i] += other.tx_bytes[from];
+        rx_bytes[i] += other.rx_bytes[from];
+        tx_messages[i] += other.tx_messages[from];
+        rx_messages[i] += other.rx_messages[from];
+
+        if (sampling_ && other.sampling_) {
+            tx_bytes_sq[i] += other.tx_bytes_sq[from];
+            rx_bytes_sq[i] += other.rx_bytes_sq[from];
+        }
+
+        if (timing_ && other.timing_) {
+            tx_latency[i].merge(other.tx_latency[from]);
+            rx_latency[i].merge(other.rx_latency[from]);
+        }
+
+        if (unexpected_ && other.unexpected_) {
+            unexpected_messages[i] += other.unexpected_messages[from];
+            unexpected_bytes[i] += other.unexpected_bytes[from];
+        }
+
+        if (transfers_ && other.transfers_) {
+            tx_transfers[i].merge(other.tx_transfers[from]);
+            rx_transfers[i].merge(other.rx_transfers[from]);
+        }
+    }
+
+    // Counters must be of the same communicator, unless empty
+    void merge(const peer_counters& other)
+    {
+        if (size_ == 0) {
+            init(other.size_, other.sampling_, other.timing_,
+                 other.unexpected_, other.transfers_);
+        }
+
+        for (int i = 0; i < other.n_slots(); i++) {
+            if (other.used(i)) {
+                add(other.peer_of(i), other, i);
+            }
+        }
+    }
+
+private:
+    size_t hash(int peer) const
+    {
+        return (static_cast<uint32_t>(peer) * 0x9e3779b1u) & mask_;
+    }
+
+    void resize(int n)
+    {
+        tx_bytes.resize(n);
+        rx_bytes.resize(n);
+        tx_messages.resize(n);
+        rx_messages.resize(n);
+
+        if (sampling_) {
+            tx_countdown.resize(n);
+            rx_countdown.resize(n);
+            tx_bytes_sq.resize(n);
+            rx_bytes_sq.resize(n);
+        }
+
+        if (timing_) {
+            tx_latency.resize(n);
+            rx_latency.resize(n);
+        }
+
+        if (unexpected_) {
+            unexpected_messages.resize(n);
+            unexpected_bytes.resize(n);
+        }
+
+        if (transfers_) {
+            tx_transfers.resize(n);
+            rx_transfers.resize(n);
+        }
+    }
+
+    void rehash(size_t capacity)
+    {
+        table_.assign(capacity, -1);
+        mask_ = capacity - 1;
+
+        for (int slot = 0; slot < n_slots(); slot++) {
+            size_t h = hash(peers_[slot]);
+            while (table_[h] >= 0) {
+                h = (h + 1) & mask_;
+            }
+            table_[h] = slot;
+        }
+    }
+
+    // Moves every slot to the index of its peer
+    template <typename T>
+    void scatter(std::vector<T>& v)
+    {
+        if (v.empty()) {
+            return;
+        }
+
+        std::vector<T> dense(size_);
+        for (size_t slot = 0; slot < peers_.size(); slot++) {
+            dense[peers_[slot]] = std::move(v[slot]);
+        }
+        v.swap(dense);
+    }
+
+    void densify()
+    {
+        scatter(tx_bytes);
+        scatter(rx_bytes);
+        scatter(tx_messages);
+        scatter(rx_messages);
+        scatter(tx_countdown);
+        scatter(rx_countdown);
+        scatter(tx_bytes_sq);
+        scatter(rx_bytes_sq);
+        scatter(tx_latency);
+        scatter(rx_latency);
+        scatter(unexpected_messages);
+        scatter(unexpected_bytes);
+        scatter(tx_transfers);
+        scatter(rx_transfers);
+        // Vectors of disabled features are empty and stay so
+        resize(size_);
+
+        dense_ = true;
+        peers_.clear();
+        peers_.shrink_to_fit();
+        table_.clear();
+        table_.shrink_to_fit();
+        mask_ = 0;
+    }
+
+    int size_;
+    bool sampling_;
+    bool timing_;
+    bool unexpected_;
+    bool transfers_;
+    bool dense_;
+    // Sparse only: peer of every slot, and slots by hash of their peer (-1
+    // if empty)
+    std::vector<int> peers_;
+    std::vector<int> table_;
+    size_t mask_;
+};
+
+}
+
+#endif
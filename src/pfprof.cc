@@ -1,9 +1,17 @@
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include <stdlib.h>
 #include <time.h>
 
 extern "C" {
@@ -11,8 +19,18 @@ extern "C" {
 #include <peruse.h>
 };
 
+#include "clock_sync.hpp"
+#include "config.hpp"
+#include "cycles.hpp"
+#include "datatype_cache.hpp"
+#include "event_log.hpp"
+#include "global_result.hpp"
+#include "handle_map.hpp"
+#include "inflight_table.hpp"
 #include "pfprof.hpp"
+#include "shared_result.hpp"
 #include "trace.hpp"
+#include "transfer_stats.hpp"
 
 namespace pfprof {
 
@@ -20,127 +38,746 @@ namespace pfprof {
 typedef int event_desc_t;
 // Mapping from communicators to PERUSE event handlers
 typedef std::unordered_map<MPI_Comm, peruse_event_h> eh_table_t;
+// Callback selected for a PERUSE event and its per-communicator handlers
+struct ev_entry
+{
+    peruse_comm_callback_f *callback;
+    eh_table_t handlers;
+};
 // Mapping from PERUSE event descriptors to event handler tables
-typedef std::unordered_map<event_desc_t, eh_table_t> ev_table_t;
+typedef std::unordered_map<event_desc_t, ev_entry> ev_table_t;
+
+// PERUSE event of interest
+struct req_event
+{
+    const char *name;
+    int event;
+    // Features requiring the event, or 0 if it is always needed
+    unsigned features;
+    // Whether these features are disabled, rather than initialization
+    // failing, when the MPI library does not support the event
+    bool optional;
+};
 
-static const char *req_events[NUM_REQ_EVENT_NAMES] = {
-    "PERUSE_COMM_REQ_ACTIVATE", "PERUSE_COMM_REQ_COMPLETE",
+static const req_event req_events[NUM_REQ_EVENT_NAMES] = {
+    {"PERUSE_COMM_REQ_ACTIVATE", PERUSE_COMM_REQ_ACTIVATE, 0, false},
+    {"PERUSE_COMM_REQ_COMPLETE", PERUSE_COMM_REQ_COMPLETE,
+     FEATURE_TIMING | FEATURE_TRANSFERS, false},
+    {"PERUSE_COMM_REQ_INSERT_IN_POSTED_Q", PERUSE_COMM_REQ_INSERT_IN_POSTED_Q,
+     FEATURE_QUEUES, true},
+    {"PERUSE_COMM_REQ_REMOVE_FROM_POSTED_Q",
+     PERUSE_COMM_REQ_REMOVE_FROM_POSTED_Q, FEATURE_QUEUES, true},
+    {"PERUSE_COMM_SEARCH_POSTED_Q_BEGIN", PERUSE_COMM_SEARCH_POSTED_Q_BEGIN,
+     FEATURE_QUEUES, true},
+    {"PERUSE_COMM_SEARCH_POSTED_Q_END", PERUSE_COMM_SEARCH_POSTED_Q_END,
+     FEATURE_QUEUES, true},
+    {"PERUSE_COMM_SEARCH_UNEX_Q_BEGIN", PERUSE_COMM_SEARCH_UNEX_Q_BEGIN,
+     FEATURE_QUEUES, true},
+    {"PERUSE_COMM_SEARCH_UNEX_Q_END", PERUSE_COMM_SEARCH_UNEX_Q_END,
+     FEATURE_QUEUES, true},
+    {"PERUSE_COMM_MSG_ARRIVED", PERUSE_COMM_MSG_ARRIVED, FEATURE_UNEXPECTED,
+     true},
+    {"PERUSE_COMM_MSG_INSERT_IN_UNEX_Q", PERUSE_COMM_MSG_INSERT_IN_UNEX_Q,
+     FEATURE_UNEXPECTED, true},
+    {"PERUSE_COMM_MSG_REMOVE_FROM_UNEX_Q", PERUSE_COMM_MSG_REMOVE_FROM_UNEX_Q,
+     FEATURE_UNEXPECTED, true},
+    {"PERUSE_COMM_REQ_XFER_BEGIN", PERUSE_COMM_REQ_XFER_BEGIN,
+     FEATURE_TRANSFERS, true},
+    {"PERUSE_COMM_REQ_XFER_CONTINUE", PERUSE_COMM_REQ_XFER_CONTINUE,
+     FEATURE_TRANSFERS, true},
+    {"PERUSE_COMM_REQ_XFER_END", PERUSE_COMM_REQ_XFER_END, FEATURE_TRANSFERS,
+     true},
 };
 
+// Communicator known to the profiler. A pointer to it is registered as the
+// PERUSE callback parameter, so handlers identify the communicator of an
+// event without any lookup.
+struct comm_info
+{
+    // Dense id, never reused during a run
+    int id;
+    // Size of the group peer ranks refer to
+    int size;
+    // Group peer ranks refer to, translated to MPI_COMM_WORLD at finalize()
+    MPI_Group group;
+    // Receives in the posted queue, updated by all threads (FEATURE_QUEUES)
+    std::atomic<int64_t> posted_depth;
+    // Depth of the unexpected queue (FEATURE_UNEXPECTED)
+    unexpected_queue unexpected;
+    // Latest collective called on the communicator (FEATURE_COLLECTIVES)
+    std::atomic<int> last_collective;
+    // Set by MPI_Comm_set_name
+    std::string name;
+    // Id of the communicator it was created from, or -1
+    int parent;
+    comm_creation creation;
+};
+
+// Protects the tables below, which are only touched on communicator
+// creation and destruction
+static std::mutex comm_mutex;
 // List of communicators
 static std::unordered_set<MPI_Comm> comms;
-// Mapping from communicator to local-global rank table
-static std::unordered_map<MPI_Comm, std::vector<int>> lg_rank_table;
+// Every communicator registered so far, indexed by id
+static std::vector<std::unique_ptr<comm_info>> comm_infos;
+// Mapping from live communicators to their records
+static std::unordered_map<MPI_Comm, comm_info *> comm_table;
+// Same mapping, also read without the mutex by the collective wrappers
+static handle_map<comm_info> comm_index;
 static ev_table_t ev_table;
+static config config;
 static trace trace;
+static datatype_cache datatypes;
+static inflight_table inflight;
+static transfer_table transfers;
+static unexpected_table unexpected;
+static event_log events;
+
+static const size_t cache_line_size = 64;
+
+// Per-thread counter shard. Every thread that receives PERUSE callbacks
+// counts into its own shard so that MPI_THREAD_MULTIPLE applications neither
+// race on nor serialize over a single trace. Shards are cache line aligned
+// and are merged into the global trace at finalize().
+struct alignas(cache_line_size) shard
+{
+    class trace trace;
+    // Event trace buffers of the thread (FEATURE_EVENTS)
+    event_log::channel *events;
+    // Start of the current matching queue search (FEATURE_QUEUES); a
+    // thread finishes a search before starting another one
+    uint64_t search_start;
+    shard *next;
+};
+
+// Lock-free list of all shards created so far
+static std::atomic<shard *> shards(nullptr);
+static thread_local shard *local_shard
+    __attribute__((tls_model("initial-exec"))) = nullptr;
+// Collective the thread is in, set by the MPI wrappers
+// (FEATURE_COLLECTIVES)
+static thread_local collective_context current_collective
+    __attribute__((tls_model("initial-exec"))) = {MPI_COMM_NULL, COLL_NONE};
 
 static struct timespec start_time, end_time;
+static uint64_t start_ns;
+static uint64_t start_cycles;
+static clock_sync clocks;
+// start_ns of rank 0, origin of the aligned timestamps
+static uint64_t origin_ns;
+
+static inline uint64_t elapsed_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec - start_ns;
+}
+
+static shard *new_shard()
+{
+    void *mem;
+    if (posix_memalign(&mem, cache_line_size, sizeof(shard)) != 0) {
+        throw std::bad_alloc();
+    }
+
+    shard *sh = new (mem) shard();
+    sh->trace.configure(config);
+    sh->events = events.is_open() ? events.new_channel() : nullptr;
+
+    // Publish the shard; only contended when threads see their first event
+    sh->next = shards.load(std::memory_order_relaxed);
+    while (!shards.compare_exchange_weak(sh->next, sh,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed)) {
+    }
+
+    return sh;
+}
+
+static inline shard& this_shard()
+{
+    if (local_shard == nullptr) {
+        local_shard = new_shard();
+    }
+
+    return *local_shard;
+}
+
+static void merge_shards()
+{
+    shard *sh = shards.exchange(nullptr, std::memory_order_acquire);
+
+    while (sh != nullptr) {
+        shard *next = sh->next;
+
+        trace.merge(sh->trace);
+
+        sh->~shard();
+        free(sh);
+        sh = next;
+    }
+}
+
+// Times a request from activation to completion (FEATURE_TIMING). The peer
+// is taken from the completion, which knows the source of MPI_ANY_SOURCE
+// receives. Completions are looked up in handle_event, which passes whether
+// the request was found and its activation time.
+template <event_type Type, unsigned Features>
+static inline void track_request(class trace& local, MPI_Aint unique_id,
+                                 const comm_info *info, int peer,
+                                 uint64_t len, uint64_t time, bool matched,
+                                 uint64_t start)
+{
+    if (Type == EV_BEGIN_SEND || Type == EV_BEGIN_RECV) {
+        inflight.insert(unique_id, time);
+        return;
+    }
+
+    if (!matched) {
+        local.count_unmatched();
+        return;
+    }
+
+    local.record_latency<Type, Features>(info->id, info->size, peer, len,
+                                         time > start ? time - start : 0);
+}
+
+// Collective the traffic of a request belongs to, or COLL_NONE.
+// Applications only use non-negative tags and MPI_ANY_TAG, so other
+// negative tags are those of collectives implemented with point-to-point.
+// Their traffic is attributed to the collective the thread is in on the
+// communicator or, when progressed from elsewhere (e.g. nonblocking
+// collectives), to the latest collective called on it.
+static inline int collective_of(const comm_info *info, MPI_Comm comm,
+                                int tag)
+{
+    if (tag >= 0 || tag == MPI_ANY_TAG) {
+        return COLL_NONE;
+    }
+
+    if (current_collective.comm == comm) {
+        return current_collective.kind;
+    }
+
+    return info->last_collective.load(std::memory_order_relaxed);
+}
+
+template <int Event, unsigned Features>
+static inline int handle_event(shard& sh, MPI_Aint unique_id,
+                               peruse_comm_spec_t *spec,
+                               const comm_info *info)
+{
+    class trace& local = sh.trace;
+    static_assert(Event == PERUSE_COMM_REQ_ACTIVATE ||
+                  Event == PERUSE_COMM_REQ_COMPLETE,
+                  "Unexpected event in callback");
+    constexpr bool begin = Event == PERUSE_COMM_REQ_ACTIVATE;
+
+    // Sends are timed from their activation to their transfer, so that
+    // the handshake of rendezvous includes the wait for the receiver.
+    // Transfers are not sampled, so neither are their activations. Those
+    // of sends that complete without a transfer are forgotten.
+    if ((Features & FEATURE_TRANSFERS) && spec->operation == PERUSE_SEND) {
+        if (begin) {
+            transfers.activate(unique_id, elapsed_ns());
+        } else {
+            transfers.complete(unique_id);
+        }
+    }
+
+    // Without FEATURE_TIMING, completions are only subscribed to for the
+    // transfers above
+    if (!(Features & FEATURE_TIMING) && !begin) {
+        return MPI_SUCCESS;
+    }
+
+    // Skipped activations cost a single countdown decrement from here
+    if ((Features & FEATURE_SAMPLING) && begin) {
+        bool sampled = spec->operation == PERUSE_SEND ?
+            local.sample<EV_BEGIN_SEND>(info->id, info->size, spec->peer) :
+            local.sample<EV_BEGIN_RECV>(info->id, info->size, spec->peer);
+        if (!sampled) {
+            return MPI_SUCCESS;
+        }
+    }
+
+    // Under sampling, completions of skipped activations are not in the
+    // in-flight table and are skipped as well.
+    uint64_t start = 0;
+    bool matched = false;
+    if ((Features & FEATURE_TIMING) && !begin) {
+        matched = inflight.remove(unique_id, &start);
+        if ((Features & FEATURE_SAMPLING) && !matched) {
+            return MPI_SUCCESS;
+        }
+    }
+
+    int sz = datatypes.size_of(spec->datatype);
+    // May exceed 2 GiB
+    uint64_t len = static_cast<uint64_t>(spec->count) * sz;
+    uint64_t time =
+        (Features & (FEATURE_TIMING | FEATURE_EVENTS | FEATURE_EPOCHS)) ?
+        elapsed_ns() : 0;
 
+    if (spec->operation == PERUSE_SEND) {
+        constexpr event_type type = begin ? EV_BEGIN_SEND : EV_END_SEND;
+        local.feed_event<type, Features>(info->id, info->size, spec->peer,
+                                         len, spec->tag, time);
+        if ((Features & FEATURE_COLLECTIVES) && begin) {
+            local.record_collective<true>(
+                collective_of(info, spec->comm, spec->tag), len);
+        }
+        if (Features & FEATURE_TIMING) {
+            track_request<type, Features>(local, unique_id, info, spec->peer,
+                                          len, time, matched, start);
+        }
+        if (Features & FEATURE_EVENTS) {
+            sh.events->append(type, info->id, spec->peer, len, spec->tag,
+                              time);
+        }
+    } else if (spec->operation == PERUSE_RECV) {
+        constexpr event_type type = begin ? EV_BEGIN_RECV : EV_END_RECV;
+        local.feed_event<type, Features>(info->id, info->size, spec->peer,
+                                         len, spec->tag, time);
+        if ((Features & FEATURE_COLLECTIVES) && begin) {
+            local.record_collective<false>(
+                collective_of(info, spec->comm, spec->tag), len);
+        }
+        if (Features & FEATURE_TIMING) {
+            track_request<type, Features>(local, unique_id, info, spec->peer,
+                                          len, time, matched, start);
+        }
+        if (Features & FEATURE_EVENTS) {
+            sh.events->append(type, info->id, spec->peer, len, spec->tag,
+                              time);
+        }
+    } else {
+        std::cout << "Unexpected operation type\n" << std::endl;
+        return MPI_ERR_INTERN;
+    }
+
+    return MPI_SUCCESS;
+}
+
+template <int Event, unsigned Features>
 int peruse_event_handler(peruse_event_h event_handle, MPI_Aint unique_id,
                          peruse_comm_spec_t *spec, void *param)
 {
-    int ev_type, sz;
-    PMPI_Type_size(spec->datatype, &sz);
-    int  len = spec->count * sz;
+    uint64_t start = (Features & FEATURE_OVERHEAD) ? read_cycles() : 0;
+
+    shard& sh = this_shard();
+    int ret = handle_event<Event, Features>(
+        sh, unique_id, spec, static_cast<const comm_info *>(param));
 
-    int peer = lg_rank_table[spec->comm][spec->peer];
+    if (Features & FEATURE_OVERHEAD) {
+        sh.trace.overhead().record_handler(read_cycles() - start);
+    }
 
-    PERUSE_Event_get(event_handle, &ev_type);
+    return ret;
+}
 
-    switch (ev_type) {
-    case PERUSE_COMM_REQ_ACTIVATE:
-        if (spec->operation == PERUSE_SEND) {
-            trace.feed_event(EV_BEGIN_SEND, peer, len, spec->tag);
-        } else if (spec->operation == PERUSE_RECV) {
-            trace.feed_event(EV_BEGIN_RECV, peer, len, spec->tag);
+// Matching queue events (FEATURE_QUEUES), only specialized on
+// FEATURE_OVERHEAD
+template <int Event, unsigned Features>
+int peruse_queue_handler(peruse_event_h event_handle, MPI_Aint unique_id,
+                         peruse_comm_spec_t *spec, void *param)
+{
+    uint64_t start = (Features & FEATURE_OVERHEAD) ? read_cycles() : 0;
+    shard& sh = this_shard();
+    comm_info *info = static_cast<comm_info *>(param);
+    uint64_t time = elapsed_ns();
+
+    if (Event == PERUSE_COMM_REQ_INSERT_IN_POSTED_Q) {
+        int64_t depth = info->posted_depth.fetch_add(
+            1, std::memory_order_relaxed) + 1;
+        sh.trace.record_posted<true>(info->id, std::max<int64_t>(depth, 0),
+                                     time);
+    } else if (Event == PERUSE_COMM_REQ_REMOVE_FROM_POSTED_Q) {
+        // Receives posted before the handlers were registered may be
+        // removed, so the depth is never reported below 0
+        int64_t depth = info->posted_depth.fetch_sub(
+            1, std::memory_order_relaxed);
+        sh.trace.record_posted<false>(info->id, std::max<int64_t>(depth, 0),
+                                      time);
+    } else if (Event == PERUSE_COMM_SEARCH_POSTED_Q_BEGIN ||
+               Event == PERUSE_COMM_SEARCH_UNEX_Q_BEGIN) {
+        sh.search_start = time;
+    } else if (Event == PERUSE_COMM_SEARCH_POSTED_Q_END) {
+        sh.trace.record_search<true>(info->id, time - sh.search_start);
+    } else if (Event == PERUSE_COMM_SEARCH_UNEX_Q_END) {
+        sh.trace.record_search<false>(info->id, time - sh.search_start);
+    }
+
+    if (Features & FEATURE_OVERHEAD) {
+        sh.trace.overhead().record_handler(read_cycles() - start);
+    }
+
+    return MPI_SUCCESS;
+}
+
+// Unexpected message events (FEATURE_UNEXPECTED), only specialized on
+// FEATURE_OVERHEAD
+template <int Event, unsigned Features>
+int peruse_unexpected_handler(peruse_event_h event_handle,
+                              MPI_Aint unique_id, peruse_comm_spec_t *spec,
+                              void *param)
+{
+    uint64_t start = (Features & FEATURE_OVERHEAD) ? read_cycles() : 0;
+    shard& sh = this_shard();
+    comm_info *info = static_cast<comm_info *>(param);
+    uint64_t time = elapsed_ns();
+
+    if (Event == PERUSE_COMM_MSG_ARRIVED) {
+        sh.trace.record_arrival(info->id);
+    } else if (Event == PERUSE_COMM_MSG_INSERT_IN_UNEX_Q) {
+        // Message events may come without a count or datatype, before the
+        // message is unpacked
+        uint64_t len = spec->count > 0 ?
+            static_cast<uint64_t>(spec->count) *
+            datatypes.size_of(spec->datatype) : 0;
+        unexpected_queue::state state = unexpected.insert(
+            info->unexpected, info->id, spec->peer, spec->tag, len, time);
+        sh.trace.record_unexpected_insert(info->id, info->size, spec->peer,
+                                          len, state, time);
+    } else if (Event == PERUSE_COMM_MSG_REMOVE_FROM_UNEX_Q) {
+        unexpected_queue::state state;
+        uint64_t wait = 0;
+        bool found = unexpected.remove(info->unexpected, info->id,
+                                       spec->peer, spec->tag, time, &state,
+                                       &wait);
+        sh.trace.record_unexpected_remove(info->id, found ? &state : nullptr,
+                                          wait, time);
+    }
+
+    if (Features & FEATURE_OVERHEAD) {
+        sh.trace.overhead().record_handler(read_cycles() - start);
+    }
+
+    return MPI_SUCCESS;
+}
+
+// Payload transfer events (FEATURE_TRANSFERS), only specialized on
+// FEATURE_OVERHEAD
+template <int Event, unsigned Features>
+int peruse_transfer_handler(peruse_event_h event_handle, MPI_Aint unique_id,
+                            peruse_comm_spec_t *spec, void *param)
+{
+    uint64_t start = (Features & FEATURE_OVERHEAD) ? read_cycles() : 0;
+    shard& sh = this_shard();
+    comm_info *info = static_cast<comm_info *>(param);
+    uint64_t time = elapsed_ns();
+    // Open MPI reports fragments as a count of MPI_PACKED bytes
+    uint64_t len = spec->count > 0 ?
+        static_cast<uint64_t>(spec->count) *
+        datatypes.size_of(spec->datatype) : 0;
+
+    if (Event == PERUSE_COMM_REQ_XFER_BEGIN) {
+        transfers.begin(unique_id, time);
+    } else if (Event == PERUSE_COMM_REQ_XFER_CONTINUE) {
+        transfers.add(unique_id, len, time);
+    } else if (Event == PERUSE_COMM_REQ_XFER_END) {
+        transfer_table::state state;
+        if (!transfers.end(unique_id, &state)) {
+            sh.trace.count_unmatched_transfer();
         } else {
-            std::cout << "Unexpected operation type\n" << std::endl;
-            return MPI_ERR_INTERN;
+            // Eager messages move at once, without fragment events
+            len = std::max(len, state.bytes);
+
+            if (spec->operation == PERUSE_SEND) {
+                sh.trace.record_transfer<true>(info->id, info->size,
+                                               spec->peer, len, state, time);
+            } else {
+                sh.trace.record_transfer<false>(info->id, info->size,
+                                                spec->peer, len, state, time);
+            }
         }
-        break;
+    }
 
-    case PERUSE_COMM_REQ_COMPLETE:
-        if (spec->operation == PERUSE_SEND) {
-            trace.feed_event(EV_END_SEND, peer, len, spec->tag);
-        } else if (spec->operation == PERUSE_RECV) {
-            trace.feed_event(EV_END_RECV, peer, len, spec->tag);
-        } else {
-            std::cout << "Unexpected operation type\n" << std::endl;
-            return MPI_ERR_INTERN;
+    if (Features & FEATURE_OVERHEAD) {
+        sh.trace.overhead().record_handler(read_cycles() - start);
+    }
+
+    return MPI_SUCCESS;
+}
+
+// Specialized features that make a difference to completions
+static const unsigned completion_features =
+    FEATURE_TIMING | FEATURE_SAMPLING | FEATURE_OVERHEAD | FEATURE_EVENTS |
+    FEATURE_TRANSFERS;
+
+// Maps a run-time feature set to the handler specialized for it, among the
+// subsets of Mask
+template <int Event, unsigned Mask, unsigned Features = Mask>
+struct handler_table
+{
+    static peruse_comm_callback_f *select(unsigned features)
+    {
+        if (features == Features) {
+            return peruse_event_handler<Event, Features>;
         }
-        break;
 
+        return handler_table<Event, Mask,
+                             (Features - 1) & Mask>::select(features);
+    }
+};
+
+template <int Event, unsigned Mask>
+struct handler_table<Event, Mask, 0>
+{
+    static peruse_comm_callback_f *select(unsigned)
+    {
+        return peruse_event_handler<Event, 0>;
+    }
+};
+
+// Handlers of the other events are only specialized on FEATURE_OVERHEAD
+template <unsigned Features>
+static peruse_comm_callback_f *select_other_handler(int event)
+{
+    switch (event) {
+    case PERUSE_COMM_REQ_INSERT_IN_POSTED_Q:
+        return peruse_queue_handler<
+            PERUSE_COMM_REQ_INSERT_IN_POSTED_Q, Features>;
+    case PERUSE_COMM_REQ_REMOVE_FROM_POSTED_Q:
+        return peruse_queue_handler<
+            PERUSE_COMM_REQ_REMOVE_FROM_POSTED_Q, Features>;
+    case PERUSE_COMM_SEARCH_POSTED_Q_BEGIN:
+        return peruse_queue_handler<
+            PERUSE_COMM_SEARCH_POSTED_Q_BEGIN, Features>;
+    case PERUSE_COMM_SEARCH_POSTED_Q_END:
+        return peruse_queue_handler<
+            PERUSE_COMM_SEARCH_POSTED_Q_END, Features>;
+    case PERUSE_COMM_SEARCH_UNEX_Q_BEGIN:
+        return peruse_queue_handler<
+            PERUSE_COMM_SEARCH_UNEX_Q_BEGIN, Features>;
+    case PERUSE_COMM_SEARCH_UNEX_Q_END:
+        return peruse_queue_handler<
+            PERUSE_COMM_SEARCH_UNEX_Q_END, Features>;
+    case PERUSE_COMM_MSG_ARRIVED:
+        return peruse_unexpected_handler<
+            PERUSE_COMM_MSG_ARRIVED, Features>;
+    case PERUSE_COMM_MSG_INSERT_IN_UNEX_Q:
+        return peruse_unexpected_handler<
+            PERUSE_COMM_MSG_INSERT_IN_UNEX_Q, Features>;
+    case PERUSE_COMM_MSG_REMOVE_FROM_UNEX_Q:
+        return peruse_unexpected_handler<
+            PERUSE_COMM_MSG_REMOVE_FROM_UNEX_Q, Features>;
+    case PERUSE_COMM_REQ_XFER_BEGIN:
+        return peruse_transfer_handler<
+            PERUSE_COMM_REQ_XFER_BEGIN, Features>;
+    case PERUSE_COMM_REQ_XFER_CONTINUE:
+        return peruse_transfer_handler<
+            PERUSE_COMM_REQ_XFER_CONTINUE, Features>;
+    case PERUSE_COMM_REQ_XFER_END:
+        return peruse_transfer_handler<
+            PERUSE_COMM_REQ_XFER_END, Features>;
     default:
-        std::cout << "Unexpected event in callback\n" << std::endl;
-        return MPI_ERR_INTERN;
+        return nullptr;
     }
+}
 
-    return MPI_SUCCESS;
+static peruse_comm_callback_f *select_handler(int event, unsigned features)
+{
+    switch (event) {
+    case PERUSE_COMM_REQ_ACTIVATE:
+        return handler_table<PERUSE_COMM_REQ_ACTIVATE,
+                             FEATURE_SPECIALIZED>::select(
+            features & FEATURE_SPECIALIZED);
+    case PERUSE_COMM_REQ_COMPLETE:
+        return handler_table<PERUSE_COMM_REQ_COMPLETE,
+                             completion_features>::select(
+            features & completion_features);
+    default:
+        if (features & FEATURE_OVERHEAD) {
+            return select_other_handler<FEATURE_OVERHEAD>(event);
+        }
+        return select_other_handler<0>(event);
+    }
 }
 
-int register_event_handlers(MPI_Comm comm, peruse_comm_callback_f *callback)
+int register_event_handlers(MPI_Comm comm)
 {
+    uint64_t start = read_cycles();
+    std::lock_guard<std::mutex> lock(comm_mutex);
+
+    auto it = comm_table.find(comm);
+    if (it == comm_table.end()) {
+        return MPI_ERR_COMM;
+    }
+
     comms.insert(comm);
 
     for (auto& kv : ev_table) {
         peruse_event_h eh;
 
-        PERUSE_Event_comm_register(kv.first, comm, callback, NULL, &eh);
-        kv.second[comm] = eh;
+        PERUSE_Event_comm_register(kv.first, comm, kv.second.callback,
+                                   it->second, &eh);
+        kv.second.handlers[comm] = eh;
         PERUSE_Event_activate(eh);
     }
 
+    trace.overhead().register_event_handlers.add(read_cycles() - start);
+
     return MPI_SUCCESS;
 }
 
 int remove_event_handlers(MPI_Comm comm)
 {
+    std::lock_guard<std::mutex> lock(comm_mutex);
+
     for (auto& kv : ev_table) {
-        PERUSE_Event_deactivate(kv.second[comm]);
-        PERUSE_Event_release(&kv.second[comm]);
+        auto it = kv.second.handlers.find(comm);
+        if (it == kv.second.handlers.end()) {
+            continue;
+        }
+
+        PERUSE_Event_deactivate(it->second);
+        PERUSE_Event_release(&it->second);
     }
 
     return MPI_SUCCESS;
 }
 
-int register_comm(MPI_Comm comm)
+int register_comm(MPI_Comm comm, MPI_Comm parent, comm_creation creation)
 {
-    int sz;
-    MPI_Group group, world_group;
+    uint64_t start = read_cycles();
+    int sz, is_inter;
+    MPI_Group group;
 
-    PMPI_Comm_group(comm, &group);
-    PMPI_Comm_group(MPI_COMM_WORLD, &world_group);
-    PMPI_Comm_size(comm, &sz);
+    // Peers of an intercommunicator are ranks in the remote group
+    PMPI_Comm_test_inter(comm, &is_inter);
+    if (is_inter) {
+        PMPI_Comm_remote_group(comm, &group);
+        PMPI_Comm_remote_size(comm, &sz);
+    } else {
+        PMPI_Comm_group(comm, &group);
+        PMPI_Comm_size(comm, &sz);
+    }
+
+    std::lock_guard<std::mutex> lock(comm_mutex);
 
-    std::vector<int> ranks(sz), world_ranks(sz);
+    std::unique_ptr<comm_info> info(new comm_info);
+    info->id = comm_infos.size();
+    info->size = sz;
+    info->group = group;
+    info->posted_depth.store(0, std::memory_order_relaxed);
+    info->last_collective.store(COLL_UNKNOWN, std::memory_order_relaxed);
+    info->creation = creation;
+
+    auto it = comm_table.find(parent);
+    info->parent = it != comm_table.end() ? it->second->id : -1;
+
+    comm_table[comm] = info.get();
+    comm_index.insert(comm, info.get());
+    comm_infos.push_back(std::move(info));
+
+    trace.overhead().register_comm.add(read_cycles() - start);
+
+    return EXIT_SUCCESS;
+}
+
+collective_context enter_collective(MPI_Comm comm, collective kind)
+{
+    collective_context saved = current_collective;
 
-    for (int i = 0; i < sz; i++) {
-        ranks[i] = i;
+    if (!config.enabled(FEATURE_COLLECTIVES)) {
+        return saved;
     }
 
-    PMPI_Group_translate_ranks(group, sz, ranks.data(), world_group,
-                               world_ranks.data());
+    current_collective = collective_context{comm, kind};
+    this_shard().trace.record_collective_call(kind);
 
-    for (int i = 0; i < sz; i++) {
-        lg_rank_table[comm].push_back(world_ranks[i]);
+    // Without comm_mutex, so that threads calling collectives concurrently
+    // do not serialize; the mutex is only taken once comm_index is full
+    comm_info *info = comm_index.find(comm);
+    if (info == nullptr && comm_index.overflowed()) {
+        std::lock_guard<std::mutex> lock(comm_mutex);
+        auto it = comm_table.find(comm);
+        info = it != comm_table.end() ? it->second : nullptr;
+    }
+    if (info != nullptr) {
+        info->last_collective.store(kind, std::memory_order_relaxed);
     }
 
-    return EXIT_SUCCESS;
+    return saved;
+}
+
+void leave_collective(const collective_context& saved)
+{
+    current_collective = saved;
+}
+
+int set_comm_name(MPI_Comm comm, const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(comm_mutex);
+
+    // Private communicators of the profiler are not registered
+    auto it = comm_table.find(comm);
+    if (it != comm_table.end()) {
+        it->second->name = name;
+    }
+
+    return MPI_SUCCESS;
 }
 
 int unregister_comm(MPI_Comm comm)
 {
+    std::lock_guard<std::mutex> lock(comm_mutex);
+
     comms.erase(comm);
 
-    lg_rank_table.erase(comm);
+    // The record itself is kept until finalize() to translate its ranks
+    comm_table.erase(comm);
+    comm_index.erase(comm);
 
     for (auto& kv : ev_table) {
-        kv.second.erase(comm);
+        kv.second.handlers.erase(comm);
     }
 
     return EXIT_SUCCESS;
 }
 
+// Map the counters of every communicator seen during the run to
+// MPI_COMM_WORLD ranks, once per communicator
+static void translate_comms()
+{
+    MPI_Group world_group;
+    PMPI_Comm_group(MPI_COMM_WORLD, &world_group);
+
+    for (const auto& info : comm_infos) {
+        std::vector<int> ranks(info->size), world_ranks(info->size);
+
+        for (int i = 0; i < info->size; i++) {
+            ranks[i] = i;
+        }
+
+        PMPI_Group_translate_ranks(info->group, info->size, ranks.data(),
+                                   world_group, world_ranks.data());
+        trace.translate(info->id, world_ranks);
+        trace.describe_comm(info->id, info->name, info->parent,
+                            info->creation, info->size);
+
+        PMPI_Group_free(&info->group);
+    }
+
+    PMPI_Group_free(&world_group);
+}
+
+int register_datatype(MPI_Datatype type)
+{
+    datatypes.insert(type);
+
+    return MPI_SUCCESS;
+}
+
+int unregister_datatype(MPI_Datatype type)
+{
+    datatypes.erase(type);
+
+    return MPI_SUCCESS;
+}
+
 int initialize()
 {
     char processor_name[MPI_MAX_PROCESSOR_NAME];
@@ -156,6 +793,19 @@ int initialize()
     trace.set_description("Generated by PFProf v0.2.0");
     trace.set_n_procs(n_procs);
 
+    config = config::from_env();
+
+    if (config.enabled(FEATURE_EVENTS)) {
+        std::stringstream path;
+        path << "oxton-events" << rank << ".bin";
+
+        if (!events.open(path.str(), rank, config.event_buffer_size)) {
+            std::cout << "Unable to open " << path.str()
+                      << ", event trace disabled" << std::endl;
+            config.features &= ~FEATURE_EVENTS;
+        }
+    }
+
     // Initialize PERUSE
     int ret = PERUSE_Init();
     if (ret != PERUSE_SUCCESS) {
@@ -163,27 +813,233 @@ int initialize()
         return MPI_ERR_INTERN;
     }
 
-    // Query PERUSE to see if the events of interest are supported
-    for (const auto& req_event : req_events) {
-        event_desc_t desc;
+    // Query PERUSE to see if the events of interest are supported, before
+    // subscribing to any, since an unsupported optional event disables the
+    // features that need it
+    event_desc_t descs[NUM_REQ_EVENT_NAMES];
+    for (int i = 0; i < NUM_REQ_EVENT_NAMES; i++) {
+        const req_event& req_event = req_events[i];
+
+        descs[i] = PERUSE_EVENT_INVALID;
+        if (req_event.features != 0 &&
+            (config.features & req_event.features) == 0) {
+            continue;
+        }
 
-        ret = PERUSE_Query_event(req_event, &desc);
+        ret = PERUSE_Query_event(req_event.name, &descs[i]);
         if (ret != PERUSE_SUCCESS) {
-            std::cout << "Event " << req_event << " not supported"
+            descs[i] = PERUSE_EVENT_INVALID;
+            std::cout << "Event " << req_event.name << " not supported"
                       << std::endl;
-            return MPI_ERR_INTERN;
+            if (!req_event.optional) {
+                return MPI_ERR_INTERN;
+            }
+            config.features &= ~req_event.features;
         }
+    }
+
+    for (int i = 0; i < NUM_REQ_EVENT_NAMES; i++) {
+        if (descs[i] != PERUSE_EVENT_INVALID &&
+            (req_events[i].features == 0 ||
+             (config.features & req_events[i].features) != 0)) {
+            ev_table[descs[i]].callback = select_handler(
+                req_events[i].event, config.features);
+        }
+    }
 
-        ev_table[desc] = std::unordered_map<MPI_Comm, peruse_event_h>();
+    trace.configure(config);
+
+    datatypes.seed_predefined();
+    if (config.enabled(FEATURE_TIMING)) {
+        inflight.init(config.inflight_capacity);
+    }
+    if (config.enabled(FEATURE_TRANSFERS)) {
+        transfers.init(config.inflight_capacity);
+    }
+    if (config.enabled(FEATURE_UNEXPECTED)) {
+        unexpected.init(config.inflight_capacity);
     }
 
     register_comm(MPI_COMM_WORLD);
     register_comm(MPI_COMM_SELF);
+    set_comm_name(MPI_COMM_WORLD, "MPI_COMM_WORLD");
+    set_comm_name(MPI_COMM_SELF, "MPI_COMM_SELF");
+
+    bool sync_clocks = config.timestamped() && config.clock_sync_rounds > 0;
+    if (sync_clocks) {
+        clocks.begin(config.clock_sync_rounds);
+    }
 
     clock_gettime(CLOCK_MONOTONIC, &start_time);
+    start_ns = start_time.tv_sec * 1000000000ULL + start_time.tv_nsec;
+    start_cycles = read_cycles();
+
+    if (sync_clocks) {
+        origin_ns = start_ns;
+        PMPI_Bcast(&origin_ns, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    }
+
+    return register_event_handlers(MPI_COMM_WORLD);
+}
+
+// Merged results grow towards the root of the gather and may exceed INT_MAX
+// words: the length is sent first, then the words in chunks an int counts
+static void send_words(const std::vector<uint64_t>& buf, int dest,
+                       MPI_Comm comm)
+{
+    uint64_t length = buf.size();
+
+    PMPI_Send(&length, 1, MPI_UINT64_T, dest, 0, comm);
+    for (uint64_t i = 0; i < length; i += INT_MAX) {
+        int count = std::min<uint64_t>(length - i, INT_MAX);
+        PMPI_Send(buf.data() + i, count, MPI_UINT64_T, dest, 0, comm);
+    }
+}
+
+static void recv_words(std::vector<uint64_t>& buf, int source, MPI_Comm comm)
+{
+    uint64_t length;
+
+    PMPI_Recv(&length, 1, MPI_UINT64_T, source, 0, comm, MPI_STATUS_IGNORE);
+    buf.resize(length);
+    for (uint64_t i = 0; i < length; i += INT_MAX) {
+        int count = std::min<uint64_t>(length - i, INT_MAX);
+        PMPI_Recv(buf.data() + i, count, MPI_UINT64_T, source, 0, comm,
+                  MPI_STATUS_IGNORE);
+    }
+}
+
+// Gathers the results of all ranks to rank 0 along a binomial tree: in
+// round k, ranks with bit k set send everything they have gathered so far to
+// the rank without that bit and drop out. Traffic matrix rows are sparse and
+// histograms are summed on the way, so no rank ever holds per-rank data of
+// peers it does not talk to.
+static void write_global_result()
+{
+    int rank, n_procs;
+    MPI_Comm comm;
+
+    // Private communicator, so that no application message can match
+    PMPI_Comm_dup(MPI_COMM_WORLD, &comm);
+    PMPI_Comm_rank(comm, &rank);
+    PMPI_Comm_size(comm, &n_procs);
+
+    global_result result;
+    result.add(pfprof::trace);
+
+    for (int mask = 1; mask < n_procs; mask <<= 1) {
+        if (rank & mask) {
+            std::vector<uint64_t> buf;
+            result.pack(buf);
+            send_words(buf, rank ^ mask, comm);
+            break;
+        }
+
+        if ((rank | mask) < n_procs) {
+            std::vector<uint64_t> buf;
+            recv_words(buf, rank | mask, comm);
+            result.merge(buf);
+        }
+    }
+
+    if (rank == 0) {
+        if (!result.write("oxton-result.json", pfprof::trace.description(),
+                          n_procs, config.enabled(FEATURE_SAMPLING) ?
+                          config.sample_rate : 1)) {
+            std::cout << "Unable to write oxton-result.json" << std::endl;
+        }
+    }
+
+    PMPI_Comm_free(&comm);
+}
+
+// Writes the results of all ranks into one file with collective MPI-IO.
+// Every rank serializes its result, places it after the results of lower
+// ranks (exclusive scan of the sizes) and writes it and its index entry
+// with MPI_File_write_at_all, so that no rank gathers data of others.
+// Writes buf of every rank at its offset in chunks an int counts, so that
+// results over 2 GiB are written whole. The writes are collective: ranks
+// with fewer chunks join the later ones with empty writes.
+static void write_at_all(MPI_File fh, MPI_Offset offset,
+                         const std::string& buf, MPI_Comm comm)
+{
+    uint64_t length = buf.size(), max_length = 0;
+
+    PMPI_Allreduce(&length, &max_length, 1, MPI_UINT64_T, MPI_MAX, comm);
+    for (uint64_t i = 0; i < max_length; i += INT_MAX) {
+        uint64_t begin = std::min(i, length);
+        int count = std::min<uint64_t>(length - begin, INT_MAX);
+        PMPI_File_write_at_all(fh, offset + begin, buf.data() + begin, count,
+                               MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+}
+
+static void write_shared_result()
+{
+    const char *path = "oxton-results.bin";
+    int rank, n_procs;
+    MPI_Comm comm;
+
+    PMPI_Comm_dup(MPI_COMM_WORLD, &comm);
+    PMPI_Comm_rank(comm, &rank);
+    PMPI_Comm_size(comm, &n_procs);
+
+    json_writer w;
+    pfprof::trace.write_json(w);
+    const std::string& record = w.str();
+    uint64_t length = record.size();
+    uint64_t preceding = 0, total = 0;
 
-    return register_event_handlers(MPI_COMM_WORLD,
-                                   peruse_event_handler);
+    PMPI_Exscan(&length, &preceding, 1, MPI_UINT64_T, MPI_SUM, comm);
+    PMPI_Allreduce(&length, &total, 1, MPI_UINT64_T, MPI_SUM, comm);
+    if (rank == 0) {
+        // The receive buffer of MPI_Exscan is undefined on rank 0
+        preceding = 0;
+    }
+
+    shared_result_header header;
+    std::memcpy(header.magic, shared_result_magic, sizeof(header.magic));
+    header.version = shared_result_version;
+    header.n_procs = n_procs;
+    header.index_offset = sizeof(header) + total;
+
+    MPI_File fh;
+    int ret = PMPI_File_open(comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                             MPI_INFO_NULL, &fh);
+    if (ret != MPI_SUCCESS) {
+        if (rank == 0) {
+            std::cout << "Unable to open " << path << std::endl;
+        }
+        PMPI_Comm_free(&comm);
+        return;
+    }
+    PMPI_File_set_size(fh, 0);
+
+    // Rank 0 writes the header in front of its result
+    std::string buf;
+    MPI_Offset offset = sizeof(header) + preceding;
+    if (rank == 0) {
+        buf.assign(reinterpret_cast<const char *>(&header), sizeof(header));
+        offset = 0;
+    }
+    buf += record;
+    write_at_all(fh, offset, buf, comm);
+
+    // The last rank writes the trailer after its index entry
+    shared_result_entry entry = {sizeof(header) + preceding, length};
+    buf.assign(reinterpret_cast<const char *>(&entry), sizeof(entry));
+    if (rank == n_procs - 1) {
+        shared_result_trailer trailer;
+        trailer.index_offset = header.index_offset;
+        std::memcpy(trailer.magic, shared_result_magic,
+                    sizeof(trailer.magic));
+        buf.append(reinterpret_cast<const char *>(&trailer),
+                   sizeof(trailer));
+    }
+    write_at_all(fh, header.index_offset + rank * sizeof(entry), buf, comm);
+
+    PMPI_File_close(&fh);
+    PMPI_Comm_free(&comm);
 }
 
 int finalize()
@@ -193,18 +1049,65 @@ int finalize()
     }
 
     clock_gettime(CLOCK_MONOTONIC, &end_time);
+    uint64_t end_cycles = read_cycles();
+
+    if (config.timestamped() && config.clock_sync_rounds > 0) {
+        clocks.end(config.clock_sync_rounds);
+        pfprof::trace.set_clock(
+            (clocks.to_global(start_ns) - static_cast<int64_t>(origin_ns)) /
+            1000000000.0, clocks.drift(), clocks.error() / 1000000000.0);
+    }
+
+    if (events.is_open()) {
+        events.close();
+        pfprof::trace.set_event_log(events.path(), events.records(),
+                                    events.dropped(), events.bytes());
+    }
+
+    // Handlers are deactivated, so no thread touches its shard anymore
+    merge_shards();
+    translate_comms();
+    pfprof::trace.set_inflight(inflight.capacity(), inflight.dropped());
+    pfprof::trace.set_transfers_dropped(transfers.dropped());
+    pfprof::trace.set_unexpected_dropped(unexpected.dropped());
 
     double duration = (end_time.tv_sec - start_time.tv_sec) +
         (end_time.tv_nsec - start_time.tv_nsec) / 1000000000.0;
     pfprof::trace.set_duration(duration);
+    if (duration > 0.0) {
+        pfprof::trace.set_cycles_per_ns((end_cycles - start_cycles) /
+                                        (duration * 1000000000.0));
+    }
 
-    int rank;
-    PMPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (config.outputs & OUTPUT_RANK) {
+        int rank;
+        PMPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+        std::stringstream path;
+        path << "oxton-result" << rank << ".json";
+
+        pfprof::trace.write_result(path.str());
+    }
+
+    if (config.outputs & OUTPUT_BINARY) {
+        int rank;
+        PMPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+        std::stringstream path;
+        path << "oxton-result" << rank << ".bin";
+
+        if (!pfprof::trace.write_binary(path.str())) {
+            std::cout << "Unable to write " << path.str() << std::endl;
+        }
+    }
 
-    std::stringstream path;
-    path << "oxton-result" << rank << ".json";
+    if (config.outputs & OUTPUT_GLOBAL) {
+        write_global_result();
+    }
 
-    pfprof::trace.write_result(path.str());
+    if (config.outputs & OUTPUT_SHARED) {
+        write_shared_result();
+    }
 
     return EXIT_SUCCESS;
 }
@@ -1,6 +1,7 @@
 #ifndef __OXTON_HPP__
 #define __OXTON_HPP__
 
+#include <string>
 #include <unordered_set>
 
 extern "C" {
@@ -11,17 +12,35 @@ extern "C" {
 
 #include "trace.hpp"
 
-#define NUM_REQ_EVENT_NAMES (2)
+#define NUM_REQ_EVENT_NAMES (14)
 
 
 namespace pfprof {
 
+// Collective a thread is in, and its communicator
+struct collective_context
+{
+    MPI_Comm comm;
+    collective kind;
+};
+
+// PERUSE callback for one event, specialized on the enabled features
+template <int Event, unsigned Features>
 int peruse_event_handler(peruse_event_h event_handle, MPI_Aint unique_id,
                          peruse_comm_spec_t *spec, void *param);
-int register_event_handlers(MPI_Comm comm, peruse_comm_callback_f *callback);
+int register_event_handlers(MPI_Comm comm);
 int remove_event_handlers(MPI_Comm comm);
-int register_comm(MPI_Comm comm);
+// parent is the communicator comm was created from, if any
+int register_comm(MPI_Comm comm, MPI_Comm parent = MPI_COMM_NULL,
+                  comm_creation creation = COMM_PREDEFINED);
+int set_comm_name(MPI_Comm comm, const std::string& name);
 int unregister_comm(MPI_Comm comm);
+// Called around collectives; enter_collective() returns the context to
+// restore with leave_collective()
+collective_context enter_collective(MPI_Comm comm, collective kind);
+void leave_collective(const collective_context& saved);
+int register_datatype(MPI_Datatype type);
+int unregister_datatype(MPI_Datatype type);
 int initialize();
 int finalize();
 
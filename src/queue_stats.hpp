@@ -0,0 +1,488 @@
+#ifndef __QUEUE_STATS_HPP__
+#define __QUEUE_STATS_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "histogram.hpp"
+
+namespace pfprof {
+
+// Durations in ns, of matching queue searches or of the wait of unexpected
+// messages
+struct time_stats
+{
+    static const int precision = 2;
+
+    uint64_t total;
+    uint64_t max;
+    // Allocated on the first record()
+    histogram times;
+
+    time_stats() : total(0), max(0)
+    {
+    }
+
+    uint64_t count() const
+    {
+        return times.empty() ? 0 : times.total();
+    }
+
+    void record(uint64_t ns)
+    {
+        if (times.empty()) {
+            times.init(precision);
+        }
+        times.record(ns);
+        total += ns;
+        max = std::max(max, ns);
+    }
+
+    void merge(const time_stats& other)
+    {
+        if (!other.times.empty()) {
+            times.merge(other.times);
+        }
+        total += other.total;
+        max = std::max(max, other.max);
+    }
+};
+
+// Matching queues of a communicator: the posted receive queue and its
+// searches (FEATURE_QUEUES), and the unexpected message queue
+// (FEATURE_UNEXPECTED). Queue states are tracked by the caller across
+// threads; every thread records the states it sees, so that maxima merge
+// exactly.
+struct queue_stats
+{
+    uint64_t posted_inserts;
+    uint64_t posted_removes;
+    uint64_t max_posted_depth;
+    // Largest posted queue depth seen by an insertion or removal in each
+    // epoch, 0 if the queue did not change
+    std::vector<uint32_t> posted_depth;
+    // Arriving messages searching the posted receive queue, and receives
+    // searching the unexpected message queue when posted
+    time_stats posted_search;
+    time_stats unexpected_search;
+
+    // Messages arrived, and those that found no posted receive
+    uint64_t arrivals;
+    uint64_t unexpected_inserts;
+    uint64_t unexpected_removes;
+    uint64_t max_unexpected_depth;
+    // Largest size of the messages in the unexpected queue at once
+    uint64_t max_unexpected_bytes;
+    // As posted_depth, for the unexpected queue
+    std::vector<uint32_t> unexpected_depth;
+    // Time from insertion in the unexpected queue to matching
+    time_stats unexpected_wait;
+
+    queue_stats()
+        : posted_inserts(0), posted_removes(0), max_posted_depth(0),
+          arrivals(0), unexpected_inserts(0), unexpected_removes(0),
+          max_unexpected_depth(0), max_unexpected_bytes(0)
+    {
+    }
+
+    bool posted_empty() const
+    {
+        return posted_inserts == 0 && posted_removes == 0 &&
+            posted_search.count() == 0 && unexpected_search.count() == 0;
+    }
+
+    bool unexpected_empty() const
+    {
+        return arrivals == 0 && unexpected_inserts == 0 &&
+            unexpected_removes == 0;
+    }
+
+    // depth is the queue depth at the time of the event, including the
+    // receive being inserted or removed
+    void record_posted_depth(uint64_t depth, uint64_t epoch)
+    {
+        max_posted_depth = std::max(max_posted_depth, depth);
+        record_series(posted_depth, depth, epoch);
+    }
+
+    // Likewise, with the size of the queued messages
+    void record_unexpected_depth(uint64_t depth, uint64_t bytes,
+                                 uint64_t epoch)
+    {
+        max_unexpected_depth = std::max(max_unexpected_depth, depth);
+        max_unexpected_bytes = std::max(max_unexpected_bytes, bytes);
+        record_series(unexpected_depth, depth, epoch);
+    }
+
+    void merge(const queue_stats& other)
+    {
+        posted_inserts += other.posted_inserts;
+        posted_removes += other.posted_removes;
+        max_posted_depth = std::max(max_posted_depth,
+                                    other.max_posted_depth);
+
+        merge_series(posted_depth, other.posted_depth);
+        posted_search.merge(other.posted_search);
+        unexpected_search.merge(other.unexpected_search);
+
+        arrivals += other.arrivals;
+        unexpected_inserts += other.unexpected_inserts;
+        unexpected_removes += other.unexpected_removes;
+        max_unexpected_depth = std::max(max_unexpected_depth,
+                                        other.max_unexpected_depth);
+        max_unexpected_bytes = std::max(max_unexpected_bytes,
+                                        other.max_unexpected_bytes);
+        merge_series(unexpected_depth, other.unexpected_depth);
+        unexpected_wait.merge(other.unexpected_wait);
+    }
+
+private:
+    static void record_series(std::vector<uint32_t>& series, uint64_t depth,
+                              uint64_t epoch)
+    {
+        if (epoch >= series.size()) {
+            series.resize(epoch + 1, 0);
+        }
+        series[epoch] = std::max<uint32_t>(
+            series[epoch], std::min<uint64_t>(depth, UINT32_MAX));
+    }
+
+    static void merge_series(std::vector<uint32_t>& into,
+                             const std::vector<uint32_t>& from)
+    {
+        if (into.size() < from.size()) {
+            into.resize(from.size(), 0);
+        }
+        for (size_t i = 0; i < from.size(); i++) {
+            into[i] = std::max(into[i], from[i]);
+        }
+    }
+};
+
+// Depth and size of the unexpected message queue of a communicator
+// (FEATURE_UNEXPECTED), updated by all threads
+struct unexpected_queue
+{
+    // State of the queue after an insertion or before a removal
+    struct state
+    {
+        uint64_t depth;
+        uint64_t bytes;
+    };
+
+    std::atomic<uint64_t> depth;
+    std::atomic<uint64_t> bytes;
+
+    unexpected_queue() : depth(0), bytes(0)
+    {
+    }
+};
+
+// Messages in the unexpected queues of all communicators as the MPI library
+// keeps them (FEATURE_UNEXPECTED), shared by all threads. PERUSE gives
+// queued messages no identity, but messages of a sender with the same tag
+// are matched in order: every stream of messages of a communicator, sender
+// and tag numbers those it queues, and a removal is the oldest one not
+// removed yet. Streams and messages are held in fixed-capacity, lock-free
+// tables, as inflight_table; a stream is freed with its last message, and
+// messages that find no free slot are dropped.
+class unexpected_table
+{
+public:
+    static const int max_probes = 16;
+
+    unexpected_table() : mask_(0), dropped_(0)
+    {
+    }
+
+    // capacity is rounded up to a power of two, for streams and messages
+    // alike
+    void init(size_t capacity)
+    {
+        size_t n = 1;
+        while (n < capacity) {
+            n <<= 1;
+        }
+
+        streams_.reset(new std::atomic<uint64_t>[n]);
+        messages_.reset(new message[n]);
+        for (size_t i = 0; i < n; i++) {
+            streams_[i].store(empty_key, std::memory_order_relaxed);
+            messages_[i].key.store(empty_key, std::memory_order_relaxed);
+        }
+        mask_ = n - 1;
+    }
+
+    // Messages that found no free slot and are not tracked
+    uint64_t dropped() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    // Message of a sender inserted in the queue q of communicator comm_id
+    unexpected_queue::state insert(unexpected_queue& q, int comm_id,
+                                   int peer, int tag, uint64_t bytes,
+                                   uint64_t time)
+    {
+        uint64_t hash = hash_of(comm_id, peer, tag);
+        uint64_t seq;
+        message *m = nullptr;
+
+        if (next(hash, &seq)) {
+            m = claim(message_key(hash, seq));
+        }
+        if (m == nullptr) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return unexpected_queue::state{
+                q.depth.load(std::memory_order_relaxed),
+                q.bytes.load(std::memory_order_relaxed)};
+        }
+
+        unexpected_queue::state state{
+            q.depth.fetch_add(1, std::memory_order_relaxed) + 1,
+            q.bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes};
+        m->bytes.store(bytes, std::memory_order_relaxed);
+        m->time.store(time, std::memory_order_relaxed);
+        m->key.store(message_key(hash, seq), std::memory_order_seq_cst);
+
+        // Without the matching lock, the removal of the message may have
+        // looked for it before it was stored: it is withdrawn, or the table
+        // would keep it forever
+        if (!is_pending(hash, seq) && withdraw(m, message_key(hash, seq))) {
+            q.depth.fetch_sub(1, std::memory_order_relaxed);
+            q.bytes.fetch_sub(bytes, std::memory_order_relaxed);
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        return state;
+    }
+
+    // Returns false for messages queued before the profiler subscribed, or
+    // dropped
+    bool remove(unexpected_queue& q, int comm_id, int peer, int tag,
+                uint64_t time, unexpected_queue::state *state,
+                uint64_t *wait)
+    {
+        uint64_t hash = hash_of(comm_id, peer, tag);
+        uint64_t seq, bytes, queued;
+
+        if (!oldest(hash, &seq) ||
+            !remove(message_key(hash, seq), &bytes, &queued)) {
+            return false;
+        }
+
+        state->depth = q.depth.fetch_sub(1, std::memory_order_relaxed);
+        state->bytes = q.bytes.fetch_sub(bytes, std::memory_order_relaxed);
+        *wait = time > queued ? time - queued : 0;
+
+        return true;
+    }
+
+private:
+    static const uint64_t empty_key = 0;
+    static const uint64_t tombstone_key = 1;
+    static const uint64_t busy_key = 2;
+
+    // A stream is a single word: the high half of its hash, never 0, and
+    // the sequence numbers of the next message inserted and removed, 16
+    // bits each. It holds fewer than 0xffff messages at a time.
+    static const uint64_t seq_mask = 0xffff;
+
+    // Queued message, keyed by its stream and sequence number
+    struct message
+    {
+        std::atomic<uint64_t> key;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> time;
+    };
+
+    static uint64_t hash_of(int comm_id, int peer, int tag)
+    {
+        uint64_t h = static_cast<uint32_t>(comm_id);
+        h = (h << 32 | static_cast<uint32_t>(peer)) * 0x9e3779b97f4a7c15ULL;
+        h ^= static_cast<uint32_t>(tag) * 0xc2b2ae3d27d4eb4fULL;
+        h ^= h >> 29;
+
+        // Streams are told apart by the high half, never 0
+        return h >> 32 != 0 ? h : h | 1ULL << 32;
+    }
+
+    static uint64_t stream_id(uint64_t stream)
+    {
+        return stream >> 32;
+    }
+
+    static uint64_t pending(uint64_t stream)
+    {
+        return ((stream >> 16) - stream) & seq_mask;
+    }
+
+    static uint64_t message_key(uint64_t hash, uint64_t seq)
+    {
+        return (hash >> 32) << 32 | seq;
+    }
+
+    // Slot of the stream of hash, or of a free slot if create, or nullptr
+    std::atomic<uint64_t> *stream_of(uint64_t hash, bool create)
+    {
+        std::atomic<uint64_t> *free = nullptr;
+
+        for (int i = 0; i < max_probes; i++) {
+            std::atomic<uint64_t>& s = streams_[(hash + i) & mask_];
+            uint64_t k = s.load(std::memory_order_acquire);
+
+            if (k != empty_key && k != tombstone_key &&
+                stream_id(k) == stream_id(hash)) {
+                return &s;
+            }
+            if (free == nullptr && (k == empty_key || k == tombstone_key)) {
+                free = &s;
+            }
+            if (k == empty_key) {
+                break;
+            }
+        }
+
+        return create ? free : nullptr;
+    }
+
+    // Numbers the next message of the stream of hash, creating the stream
+    bool next(uint64_t hash, uint64_t *seq)
+    {
+        // Retried when another thread changes the stream first
+        for (int attempt = 0; attempt < max_probes; attempt++) {
+            std::atomic<uint64_t> *s = stream_of(hash, true);
+            if (s == nullptr) {
+                return false;
+            }
+
+            uint64_t k = s->load(std::memory_order_acquire);
+            uint64_t next;
+            if (k == empty_key || k == tombstone_key) {
+                *seq = 0;
+                next = stream_id(hash) << 32 | 1ULL << 16;
+            } else if (stream_id(k) != stream_id(hash)) {
+                // The free slot was taken by another stream
+                continue;
+            } else if (pending(k) == seq_mask - 1) {
+                return false;
+            } else {
+                *seq = k >> 16 & seq_mask;
+                next = (k & ~(seq_mask << 16)) |
+                    ((*seq + 1) & seq_mask) << 16;
+            }
+
+            if (s->compare_exchange_strong(k, next,
+                                           std::memory_order_acq_rel)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Numbers the oldest message of the stream of hash, and frees the
+    // stream with its last message
+    bool oldest(uint64_t hash, uint64_t *seq)
+    {
+        std::atomic<uint64_t> *s = stream_of(hash, false);
+        if (s == nullptr) {
+            return false;
+        }
+
+        uint64_t k = s->load(std::memory_order_acquire);
+        uint64_t next;
+        do {
+            if (k == empty_key || k == tombstone_key ||
+                stream_id(k) != stream_id(hash)) {
+                return false;
+            }
+            *seq = k & seq_mask;
+            next = pending(k) == 1 ? tombstone_key :
+                (k & ~seq_mask) | ((*seq + 1) & seq_mask);
+        } while (!s->compare_exchange_weak(k, next,
+                                           std::memory_order_seq_cst));
+
+        return true;
+    }
+
+    // Whether message seq of the stream of hash is not removed yet
+    bool is_pending(uint64_t hash, uint64_t seq)
+    {
+        std::atomic<uint64_t> *s = stream_of(hash, false);
+        if (s == nullptr) {
+            return false;
+        }
+
+        uint64_t k = s->load(std::memory_order_seq_cst);
+        return k != empty_key && k != tombstone_key &&
+            stream_id(k) == stream_id(hash) &&
+            ((seq - k) & seq_mask) < pending(k);
+    }
+
+    size_t slot_of(uint64_t key) const
+    {
+        return (key * 0x9e3779b97f4a7c15ULL >> 16) & mask_;
+    }
+
+    // Free slot for a message of key, held busy until the message is
+    // stored, or nullptr. Keys are unique, so the first free slot is taken.
+    message *claim(uint64_t key)
+    {
+        size_t slot = slot_of(key);
+
+        for (int i = 0; i < max_probes; i++) {
+            message& m = messages_[(slot + i) & mask_];
+            uint64_t k = m.key.load(std::memory_order_relaxed);
+
+            if ((k == empty_key || k == tombstone_key) &&
+                m.key.compare_exchange_strong(k, busy_key,
+                                              std::memory_order_acquire)) {
+                return &m;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Fails if the message was removed first
+    static bool withdraw(message *m, uint64_t key)
+    {
+        return m->key.compare_exchange_strong(key, tombstone_key,
+                                              std::memory_order_acq_rel);
+    }
+
+    bool remove(uint64_t key, uint64_t *bytes, uint64_t *time)
+    {
+        size_t slot = slot_of(key);
+
+        for (int i = 0; i < max_probes; i++) {
+            message& m = messages_[(slot + i) & mask_];
+            uint64_t k = m.key.load(std::memory_order_seq_cst);
+
+            if (k == key) {
+                *bytes = m.bytes.load(std::memory_order_relaxed);
+                *time = m.time.load(std::memory_order_relaxed);
+                return withdraw(&m, key);
+            }
+            if (k == empty_key) {
+                break;
+            }
+        }
+
+        return false;
+    }
+
+    std::unique_ptr<std::atomic<uint64_t>[]> streams_;
+    std::unique_ptr<message[]> messages_;
+    size_t mask_;
+    std::atomic<uint64_t> dropped_;
+};
+
+}
+
+#endif
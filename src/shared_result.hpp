@@ -0,0 +1,46 @@
+#ifndef __SHARED_RESULT_HPP__
+#define __SHARED_RESULT_HPP__
+
+#include <cstdint>
+
+namespace pfprof {
+
+// Layout of the shared result file written collectively by all ranks, in
+// native byte order:
+//   shared_result_header
+//   the result of every rank as compact JSON, in rank order
+//   shared_result_entry of every rank (the index), in rank order
+//   shared_result_trailer
+// Readers find the index from either the header or the trailer, and seek
+// to the result of any rank directly.
+
+struct shared_result_header
+{
+    // "PFPROFSR"
+    char magic[8];
+    uint32_t version;
+    int32_t n_procs;
+    uint64_t index_offset;
+};
+
+struct shared_result_entry
+{
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct shared_result_trailer
+{
+    uint64_t index_offset;
+    // "PFPROFSR"
+    char magic[8];
+};
+
+static const char shared_result_magic[8] = {
+    'P', 'F', 'P', 'R', 'O', 'F', 'S', 'R',
+};
+static const uint32_t shared_result_version = 1;
+
+}
+
+#endif
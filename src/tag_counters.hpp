@@ -0,0 +1,144 @@
+#ifndef __TAG_COUNTERS_HPP__
+#define __TAG_COUNTERS_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace pfprof {
+
+// Traffic of a tag
+struct tag_entry
+{
+    int64_t tag;
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    uint64_t tx_messages;
+    uint64_t rx_messages;
+};
+
+// Bytes and messages by tag (FEATURE_TAGS), over all communicators and
+// peers. At most limit distinct tags are counted, in an open addressing
+// table allocated once; traffic of further tags goes to a single overflow
+// entry, so that applications with large tag spaces use bounded memory.
+// Negative tags are those of MPI_ANY_TAG receives and of collectives
+// implemented over point-to-point messages.
+class tag_counters
+{
+public:
+    tag_counters() : limit_(0), used_(0), overflow_{0, 0, 0, 0, 0}
+    {
+    }
+
+    void init(int limit)
+    {
+        limit_ = std::max(limit, 0);
+        used_ = 0;
+
+        size_t capacity = 16;
+        while (capacity < 2 * static_cast<size_t>(limit_)) {
+            capacity <<= 1;
+        }
+        used_slots_.assign(capacity, false);
+        entries_.assign(capacity, tag_entry{0, 0, 0, 0, 0});
+    }
+
+    int limit() const
+    {
+        return limit_;
+    }
+
+    template <bool Send>
+    void record(int tag, uint64_t len)
+    {
+        add<Send>(at(tag), len, 1);
+    }
+
+    // Accumulate the counters of another table (e.g. a per-thread shard)
+    void merge(const tag_counters& other)
+    {
+        for (size_t i = 0; i < other.entries_.size(); i++) {
+            if (other.used_slots_[i]) {
+                const tag_entry& e = other.entries_[i];
+                tag_entry& into = at(e.tag);
+                add<true>(into, e.tx_bytes, e.tx_messages);
+                add<false>(into, e.rx_bytes, e.rx_messages);
+            }
+        }
+
+        add<true>(overflow_, other.overflow_.tx_bytes,
+                  other.overflow_.tx_messages);
+        add<false>(overflow_, other.overflow_.rx_bytes,
+                   other.overflow_.rx_messages);
+    }
+
+    // Counted tags, in increasing tag order
+    std::vector<tag_entry> entries() const
+    {
+        std::vector<tag_entry> entries;
+
+        for (size_t i = 0; i < entries_.size(); i++) {
+            if (used_slots_[i]) {
+                entries.push_back(entries_[i]);
+            }
+        }
+        std::sort(entries.begin(), entries.end(),
+                  [](const tag_entry& a, const tag_entry& b) {
+                      return a.tag < b.tag;
+                  });
+
+        return entries;
+    }
+
+    // Traffic of the tags beyond the limit
+    const tag_entry& overflow() const
+    {
+        return overflow_;
+    }
+
+private:
+    template <bool Send>
+    static void add(tag_entry& e, uint64_t bytes, uint64_t messages)
+    {
+        if (Send) {
+            e.tx_bytes += bytes;
+            e.tx_messages += messages;
+        } else {
+            e.rx_bytes += bytes;
+            e.rx_messages += messages;
+        }
+    }
+
+    tag_entry& at(int64_t tag)
+    {
+        size_t mask = entries_.size() - 1;
+        size_t h = (static_cast<uint64_t>(tag) * 0x9e3779b97f4a7c15ULL) >> 32;
+
+        for (h &= mask; used_slots_[h]; h = (h + 1) & mask) {
+            if (entries_[h].tag == tag) {
+                return entries_[h];
+            }
+        }
+
+        if (used_ >= limit_) {
+            return overflow_;
+        }
+
+        used_slots_[h] = true;
+        entries_[h].tag = tag;
+        used_++;
+
+        return entries_[h];
+    }
+
+    int limit_;
+    int used_;
+    // Table of at least twice limit_ entries, so that probes stay short
+    std::vector<bool> used_slots_;
+    std::vector<tag_entry> entries_;
+    tag_entry overflow_;
+};
+
+}
+
+#endif
@@ -1,13 +1,27 @@
 #ifndef __TRACE_HPP__
 #define __TRACE_HPP__
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <fstream>
-#include <unordered_map>
 #include <vector>
 
+#include "binary_result.hpp"
+#include "collectives.hpp"
+#include "config.hpp"
+#include "cycles.hpp"
+#include "epoch_series.hpp"
+#include "histogram.hpp"
 #include "json.hpp"
+#include "json_writer.hpp"
+#include "overhead.hpp"
+#include "peer_counters.hpp"
+#include "queue_stats.hpp"
+#include "tag_counters.hpp"
+#include "transfer_stats.hpp"
 
 namespace pfprof {
 
@@ -19,33 +33,374 @@ enum event_type
     EV_END_RECV
 };
 
+// How a communicator was created
+enum comm_creation
+{
+    COMM_PREDEFINED = 0,
+    COMM_DUP,
+    COMM_SPLIT,
+    COMM_CREATE
+};
+
+// Traffic of a communicator by MPI_COMM_WORLD rank, and its lineage
+struct comm_summary
+{
+    std::string name;
+    // Id of the communicator it was created from, or -1
+    int parent;
+    comm_creation creation;
+    int size;
+    // Peers with traffic, in increasing communicator rank order, and
+    // aligned counters
+    std::vector<int> peers;
+    std::vector<uint64_t> tx_bytes;
+    std::vector<uint64_t> rx_bytes;
+    std::vector<uint64_t> tx_messages;
+    std::vector<uint64_t> rx_messages;
+
+    comm_summary() : parent(-1), creation(COMM_PREDEFINED), size(0)
+    {
+    }
+};
+
 class trace
 {
 public:
-    trace() : duration_(0.0), n_events_(0)
+    // Sub-buckets per power of two (as a power of two) of latency
+    // histograms, per peer and per message size bucket respectively
+    static const int peer_latency_precision = 0;
+    static const int size_latency_precision = 3;
+    // Message sizes are bucketed by power of two for latencies, with 0 in a
+    // bucket of its own
+    static const int n_size_buckets = 65;
+
+    trace()
+        : features_(0), sample_rate_(1), rng_state_(0x9e3779b97f4a7c15ULL),
+          tx_countdown_(1), rx_countdown_(1), rank_(0), n_procs_(0),
+          duration_(0.0), cycles_per_ns_(1.0), clock_synced_(false),
+          clock_start_(0.0), clock_drift_(0.0), clock_error_(0.0),
+          n_events_(0),
+          first_event_time_(UINT64_MAX), last_event_time_(0),
+          unmatched_completions_(0), inflight_capacity_(0),
+          inflight_dropped_(0), event_log_records_(0), event_log_dropped_(0),
+          event_log_bytes_(0), queue_epoch_ns_(1), unexpected_dropped_(0),
+          transfers_dropped_(0), unmatched_transfers_(0)
+    {
+    }
+
+    // Statistical sampling (FEATURE_SAMPLING): returns whether an
+    // activation should be processed. Every peer skips a random number of
+    // events, uniform in [1, 2 * sample_rate - 1], between two samples, so
+    // each event is sampled with probability 1 / sample_rate and periodic
+    // communication patterns do not bias the estimates.
+    template <event_type Type>
+    bool sample(int comm_id, int comm_size, int peer)
     {
+        uint32_t *countdown;
+
+        if (peer >= 0 && peer < comm_size) {
+            peer_counters& c = comm_counters(comm_id, comm_size);
+            int slot = c.slot_of(peer);
+            countdown = Type == EV_BEGIN_SEND ? &c.tx_countdown[slot] :
+                &c.rx_countdown[slot];
+
+            // Random first sample, so that peers with fewer messages than
+            // the sampling rate are not always sampled
+            if (*countdown == 0) {
+                *countdown = 1 + next_random() % sample_rate_;
+            }
+        } else {
+            countdown = Type == EV_BEGIN_SEND ? &tx_countdown_ :
+                &rx_countdown_;
+        }
+
+        if (--*countdown != 0) {
+            return false;
+        }
+
+        *countdown = 1 + next_random() % (2 * sample_rate_ - 1);
+
+        return true;
     }
 
-    void feed_event(event_type type, int peer, int len, int tag)
+    // Events are counted by communicator id and communicator-local peer
+    // rank; translate() maps them to MPI_COMM_WORLD ranks afterwards. The
+    // event type and enabled features are template arguments so that each
+    // PERUSE handler gets its own branch-free specialization. time is the
+    // time since initialization in nanoseconds (FEATURE_TIMING and
+    // FEATURE_EPOCHS only).
+    template <event_type Type, unsigned Features>
+    void feed_event(int comm_id, int comm_size, int peer, uint64_t len,
+                    int tag, uint64_t time)
     {
         n_events_++;
 
-        switch (type) {
-        case EV_BEGIN_SEND:
-            tx_bytes_[peer] += len;
-            tx_messages_[peer]++;
-            tx_message_sizes_[len]++;
-            break;
-        case EV_BEGIN_RECV:
-            rx_bytes_[peer] += len;
-            rx_messages_[peer]++;
-            rx_message_sizes_[len]++;
-            break;
-        default:
-            break;
+        if (Features & FEATURE_TIMING) {
+            first_event_time_ = std::min(first_event_time_, time);
+            last_event_time_ = std::max(last_event_time_, time);
+        }
+
+        if (Type != EV_BEGIN_SEND && Type != EV_BEGIN_RECV) {
+            return;
+        }
+
+        peer_counters& c = comm_counters(comm_id, comm_size);
+        // MPI_ANY_SOURCE receives are activated without a known peer
+        bool known_peer = peer >= 0 && peer < comm_size;
+        int slot = known_peer ? c.slot_of(peer) : -1;
+
+        if (Type == EV_BEGIN_SEND) {
+            if (known_peer) {
+                c.tx_bytes[slot] += len;
+                c.tx_messages[slot]++;
+                if (Features & FEATURE_SAMPLING) {
+                    c.tx_bytes_sq[slot] += static_cast<double>(len) * len;
+                }
+                if (Features & FEATURE_EPOCHS) {
+                    epochs_.record<true>(time, comm_id, peer, len);
+                }
+            }
+            if (Features & FEATURE_SIZES) {
+                tx_message_sizes_.record(len);
+            }
+            if (Features & FEATURE_TAGS) {
+                tags_.record<true>(tag, len);
+            }
+        } else {
+            if (known_peer) {
+                c.rx_bytes[slot] += len;
+                c.rx_messages[slot]++;
+                if (Features & FEATURE_SAMPLING) {
+                    c.rx_bytes_sq[slot] += static_cast<double>(len) * len;
+                }
+                if (Features & FEATURE_EPOCHS) {
+                    epochs_.record<false>(time, comm_id, peer, len);
+                }
+            }
+            if (Features & FEATURE_SIZES) {
+                rx_message_sizes_.record(len);
+            }
+            if (Features & FEATURE_TAGS) {
+                tags_.record<false>(tag, len);
+            }
         }
     }
 
+    // Latency in ns of a request matched from activation to completion
+    // (FEATURE_TIMING). Type is EV_END_SEND or EV_END_RECV.
+    template <event_type Type, unsigned Features>
+    void record_latency(int comm_id, int comm_size, int peer, uint64_t len,
+                        uint64_t latency)
+    {
+        peer_counters& c = comm_counters(comm_id, comm_size);
+
+        if (peer >= 0 && peer < comm_size) {
+            int slot = c.slot_of(peer);
+            histogram& h = Type == EV_END_SEND ? c.tx_latency[slot] :
+                c.rx_latency[slot];
+            if (h.empty()) {
+                h.init(peer_latency_precision);
+            }
+            h.record(latency);
+        }
+
+        histogram& h = Type == EV_END_SEND ?
+            tx_latency_by_size_[size_bucket(len)] :
+            rx_latency_by_size_[size_bucket(len)];
+        if (h.empty()) {
+            h.init(size_latency_precision);
+        }
+        h.record(latency);
+    }
+
+    // Posted receive queue depth of a communicator after an insertion or
+    // before a removal (FEATURE_QUEUES)
+    template <bool Insert>
+    void record_posted(int comm_id, uint64_t depth, uint64_t time)
+    {
+        queue_stats& q = queue_stats_of(comm_id);
+
+        if (Insert) {
+            q.posted_inserts++;
+        } else {
+            q.posted_removes++;
+        }
+        q.record_posted_depth(depth, time / queue_epoch_ns_);
+    }
+
+    // Time in ns of a search of the posted receive queue (Posted) or of the
+    // unexpected message queue (FEATURE_QUEUES)
+    template <bool Posted>
+    void record_search(int comm_id, uint64_t ns)
+    {
+        queue_stats& q = queue_stats_of(comm_id);
+
+        if (Posted) {
+            q.posted_search.record(ns);
+        } else {
+            q.unexpected_search.record(ns);
+        }
+    }
+
+    // Message arrival on a communicator (FEATURE_UNEXPECTED)
+    void record_arrival(int comm_id)
+    {
+        queue_stats_of(comm_id).arrivals++;
+    }
+
+    // Message of len bytes from a peer inserted in the unexpected queue,
+    // with the state of the queue after the insertion (FEATURE_UNEXPECTED)
+    void record_unexpected_insert(int comm_id, int comm_size, int peer,
+                                  uint64_t len,
+                                  const unexpected_queue::state& state,
+                                  uint64_t time)
+    {
+        queue_stats& q = queue_stats_of(comm_id);
+        q.unexpected_inserts++;
+        q.record_unexpected_depth(state.depth, state.bytes,
+                                  time / queue_epoch_ns_);
+
+        if (peer >= 0 && peer < comm_size) {
+            peer_counters& c = comm_counters(comm_id, comm_size);
+            int slot = c.slot_of(peer);
+            c.unexpected_messages[slot]++;
+            c.unexpected_bytes[slot] += len;
+        }
+    }
+
+    // Message matched out of the unexpected queue after waiting there for
+    // wait ns, with the state of the queue before the removal, or without
+    // either if it was queued before the profiler subscribed
+    void record_unexpected_remove(int comm_id,
+                                  const unexpected_queue::state *state,
+                                  uint64_t wait, uint64_t time)
+    {
+        queue_stats& q = queue_stats_of(comm_id);
+        q.unexpected_removes++;
+
+        if (state != nullptr) {
+            q.record_unexpected_depth(state->depth, state->bytes,
+                                      time / queue_epoch_ns_);
+            q.unexpected_wait.record(wait);
+        }
+    }
+
+    // Payload transfer of a message of len bytes to (Send) or from a peer,
+    // ended at time end (FEATURE_TRANSFERS). Transfers with fragments after
+    // the first one are rendezvous. Their handshake starts at the activation
+    // of sends, and at the first fragment of receives, whose activation
+    // precedes the arrival of the message.
+    template <bool Send>
+    void record_transfer(int comm_id, int comm_size, int peer, uint64_t len,
+                         const transfer_table::state& state, uint64_t end)
+    {
+        uint64_t duration = end > state.begin ? end - state.begin : 0;
+        uint64_t origin = Send && state.activated > 0 ? state.activated :
+            state.begin;
+        uint64_t handshake = state.first > origin ? state.first - origin : 0;
+        uint64_t n_fragments = 1 + state.fragments;
+
+        auto record = [&](transfer_stats& t) {
+            t.record(len, duration, n_fragments);
+            if (state.fragments > 0) {
+                t.record_rendezvous(len, handshake);
+            }
+        };
+
+        if (peer >= 0 && peer < comm_size) {
+            peer_counters& c = comm_counters(comm_id, comm_size);
+            int slot = c.slot_of(peer);
+            record(Send ? c.tx_transfers[slot] : c.rx_transfers[slot]);
+        }
+
+        if (Send) {
+            record(tx_transfers_by_size_[size_bucket(len)]);
+            tx_bandwidth_.record(state.begin, end, len);
+        } else {
+            record(rx_transfers_by_size_[size_bucket(len)]);
+            rx_bandwidth_.record(state.begin, end, len);
+        }
+    }
+
+    // Activation of a request of len bytes caused by a collective, or by
+    // application point-to-point (COLL_NONE) (FEATURE_COLLECTIVES)
+    template <bool Send>
+    void record_collective(int c, uint64_t len)
+    {
+        collective_stats& s = collectives_[c];
+
+        if (Send) {
+            s.tx_bytes += len;
+            s.tx_messages++;
+        } else {
+            s.rx_bytes += len;
+            s.rx_messages++;
+        }
+    }
+
+    // Call of a collective through the MPI wrappers
+    void record_collective_call(int c)
+    {
+        collectives_[c].calls++;
+    }
+
+    // End of a transfer whose beginning was not recorded
+    void count_unmatched_transfer()
+    {
+        unmatched_transfers_++;
+    }
+
+    // Completion of a request whose activation was not recorded
+    void count_unmatched()
+    {
+        unmatched_completions_++;
+    }
+
+    // Fold the counters of a communicator into the MPI_COMM_WORLD counters.
+    // world_ranks maps local ranks to world ranks (MPI_UNDEFINED if none).
+    void translate(int comm_id, const std::vector<int>& world_ranks)
+    {
+        if (features_ & FEATURE_EPOCHS) {
+            epochs_.translate(comm_id, world_ranks, n_procs_);
+        }
+
+        if (comm_id >= static_cast<int>(comms_.size())) {
+            return;
+        }
+
+        const peer_counters& c = comms_[comm_id];
+        for (int i = 0; i < c.n_slots(); i++) {
+            int peer = world_ranks[c.peer_of(i)];
+            if (peer >= 0 && peer < n_procs_ && c.used(i)) {
+                world_.add(peer, c, i);
+            }
+        }
+
+        comm_summary& summary = comm_summary_of(comm_id);
+        for (const auto& slot : c.used_slots()) {
+            int peer = world_ranks[c.peer_of(slot)];
+            if (peer >= 0 && peer < n_procs_) {
+                summary.peers.push_back(peer);
+                summary.tx_bytes.push_back(c.tx_bytes[slot]);
+                summary.rx_bytes.push_back(c.rx_bytes[slot]);
+                summary.tx_messages.push_back(c.tx_messages[slot]);
+                summary.rx_messages.push_back(c.rx_messages[slot]);
+            }
+        }
+    }
+
+    // Name and lineage of a communicator, reported with its traffic
+    void describe_comm(int comm_id, const std::string& name, int parent,
+                       comm_creation creation, int size)
+    {
+        comm_summary& summary = comm_summary_of(comm_id);
+
+        summary.name = name;
+        summary.parent = parent;
+        summary.creation = creation;
+        summary.size = size;
+    }
+
     void set_processor_name(const std::string& processor_name)
     {
         processor_name_ = processor_name;
@@ -64,10 +419,59 @@ public:
     void set_n_procs(int n_procs)
     {
         n_procs_ = n_procs;
-        tx_bytes_.resize(n_procs);
-        rx_bytes_.resize(n_procs);
-        tx_messages_.resize(n_procs);
-        rx_messages_.resize(n_procs);
+        world_.init(n_procs, world_.sampled(), world_.timed(),
+                    world_.tracks_unexpected(), world_.tracks_transfers());
+    }
+
+    // Must be called before any event is fed
+    void configure(const config& cfg)
+    {
+        features_ = cfg.features;
+        sample_rate_ = std::max(cfg.sample_rate, 1);
+        // Seed each trace differently so that shards sample independently
+        rng_state_ ^= reinterpret_cast<uintptr_t>(this);
+        tx_countdown_ = 1 + next_random() % sample_rate_;
+        rx_countdown_ = 1 + next_random() % sample_rate_;
+
+        world_.init(n_procs_, features_ & FEATURE_SAMPLING,
+                    features_ & FEATURE_TIMING,
+                    features_ & FEATURE_UNEXPECTED,
+                    features_ & FEATURE_TRANSFERS);
+
+        if (features_ & FEATURE_TIMING) {
+            tx_latency_by_size_.resize(n_size_buckets);
+            rx_latency_by_size_.resize(n_size_buckets);
+        }
+
+        if (features_ & FEATURE_COLLECTIVES) {
+            collectives_.resize(N_COLLECTIVES);
+        }
+
+        if (features_ & FEATURE_TRANSFERS) {
+            tx_transfers_by_size_.resize(n_size_buckets);
+            rx_transfers_by_size_.resize(n_size_buckets);
+            tx_bandwidth_.init(cfg.bandwidth_window_ms * 1000000ULL);
+            rx_bandwidth_.init(cfg.bandwidth_window_ms * 1000000ULL);
+        }
+
+        if (features_ & FEATURE_OVERHEAD) {
+            overhead_.init();
+        }
+
+        if (features_ & FEATURE_EPOCHS) {
+            epochs_.init(cfg.epoch_ms * 1000000ULL, cfg.epoch_ring);
+        }
+
+        if (features_ & FEATURE_TAGS) {
+            tags_.init(cfg.tag_limit);
+        }
+
+        queue_epoch_ns_ = cfg.epoch_ms * 1000000ULL;
+
+        if (features_ & FEATURE_SIZES) {
+            tx_message_sizes_.init(cfg.size_precision, cfg.exact_sizes);
+            rx_message_sizes_.init(cfg.size_precision, cfg.exact_sizes);
+        }
     }
 
     void set_duration(double duration)
@@ -75,56 +479,1202 @@ public:
         duration_ = duration;
     }
 
+    int rank() const
+    {
+        return rank_;
+    }
+
+    const std::string& processor_name() const
+    {
+        return processor_name_;
+    }
+
+    const std::string& description() const
+    {
+        return description_;
+    }
+
+    uint64_t n_events() const
+    {
+        return n_events_;
+    }
+
+    double duration() const
+    {
+        return duration_;
+    }
+
+    uint32_t sample_rate() const
+    {
+        return sample_rate_;
+    }
+
+    // Counters by MPI_COMM_WORLD rank, once translated
+    const peer_counters& world() const
+    {
+        return world_;
+    }
+
+    const size_histogram& tx_message_sizes() const
+    {
+        return tx_message_sizes_;
+    }
+
+    const size_histogram& rx_message_sizes() const
+    {
+        return rx_message_sizes_;
+    }
+
+    // Rate of read_cycles() ticks, to report self-overhead in time
+    void set_cycles_per_ns(double cycles_per_ns)
+    {
+        cycles_per_ns_ = cycles_per_ns;
+    }
+
+    // Alignment of the timestamps of the rank on the clock of rank 0 (see
+    // clock_sync.hpp): a time t in s after initialization is start + t *
+    // (1 + drift) after the initialization of rank 0, within error s
+    void set_clock(double start, double drift, double error)
+    {
+        clock_synced_ = true;
+        clock_start_ = start;
+        clock_drift_ = drift;
+        clock_error_ = error;
+    }
+
+    // Transfers not timed because the transfer table was full
+    // (FEATURE_TRANSFERS)
+    void set_transfers_dropped(uint64_t dropped)
+    {
+        transfers_dropped_ = dropped;
+    }
+
+    // Unexpected messages not tracked because the unexpected message table
+    // was full (FEATURE_UNEXPECTED)
+    void set_unexpected_dropped(uint64_t dropped)
+    {
+        unexpected_dropped_ = dropped;
+    }
+
+    // State of the in-flight request table at finalize
+    void set_inflight(size_t capacity, uint64_t dropped)
+    {
+        inflight_capacity_ = capacity;
+        inflight_dropped_ = dropped;
+    }
+
+    // Statistics of the binary event trace (FEATURE_EVENTS)
+    void set_event_log(const std::string& path, uint64_t records,
+                       uint64_t dropped, uint64_t bytes)
+    {
+        event_log_path_ = path;
+        event_log_records_ = records;
+        event_log_dropped_ = dropped;
+        event_log_bytes_ = bytes;
+    }
+
+    class overhead& overhead()
+    {
+        return overhead_;
+    }
+
+    // Accumulate the counters of another trace (e.g. a per-thread shard)
+    void merge(const trace& other)
+    {
+        n_events_ += other.n_events_;
+        first_event_time_ = std::min(first_event_time_,
+                                     other.first_event_time_);
+        last_event_time_ = std::max(last_event_time_, other.last_event_time_);
+
+        world_.merge(other.world_);
+
+        if (comms_.size() < other.comms_.size()) {
+            comms_.resize(other.comms_.size());
+        }
+        for (size_t i = 0; i < other.comms_.size(); i++) {
+            comms_[i].merge(other.comms_[i]);
+        }
+
+        tx_message_sizes_.merge(other.tx_message_sizes_);
+        rx_message_sizes_.merge(other.rx_message_sizes_);
+
+        unmatched_completions_ += other.unmatched_completions_;
+        merge_histograms(tx_latency_by_size_, other.tx_latency_by_size_);
+        merge_histograms(rx_latency_by_size_, other.rx_latency_by_size_);
+
+        if (features_ & FEATURE_EPOCHS) {
+            epochs_.merge(other.epochs_);
+        }
+
+        if (features_ & FEATURE_TAGS) {
+            tags_.merge(other.tags_);
+        }
+
+        if (queues_.size() < other.queues_.size()) {
+            queues_.resize(other.queues_.size());
+        }
+        for (size_t i = 0; i < other.queues_.size(); i++) {
+            queues_[i].merge(other.queues_[i]);
+        }
+
+        if (features_ & FEATURE_TRANSFERS) {
+            merge_transfers(tx_transfers_by_size_,
+                            other.tx_transfers_by_size_);
+            merge_transfers(rx_transfers_by_size_,
+                            other.rx_transfers_by_size_);
+            tx_bandwidth_.merge(other.tx_bandwidth_);
+            rx_bandwidth_.merge(other.rx_bandwidth_);
+            unmatched_transfers_ += other.unmatched_transfers_;
+        }
+
+        if (collectives_.size() < other.collectives_.size()) {
+            collectives_.resize(other.collectives_.size());
+        }
+        for (size_t i = 0; i < other.collectives_.size(); i++) {
+            collectives_[i].merge(other.collectives_[i]);
+        }
+
+        overhead_.merge(other.overhead_);
+    }
+
+    // Writes compact JSON straight from the counters, without building a
+    // document in memory
     void write_result(const std::string& path)
     {
-        nlohmann::json j;
+        json_writer w;
+
+        if (!w.open(path)) {
+            std::cout << "Unable to open " << path << std::endl;
+            return;
+        }
+
+        write_json(w);
+
+        if (!w.close()) {
+            std::cout << "Unable to write " << path << std::endl;
+        }
+    }
+
+    // Result of the rank, as written by write_result()
+    void write_json(json_writer& w)
+    {
+        uint64_t start = read_cycles();
+
+        w.begin_object();
 
         // Meta data
-        j["processor_name"] = processor_name_;
-        j["rank"] = rank_;
-        j["n_procs"] = n_procs_;
-        j["description"] = description_;
-        j["n_events"] = n_events_;
-        j["duration"] = duration_;
-
-        j["tx_bytes"] = tx_bytes_;
-        j["rx_bytes"] = rx_bytes_;
-        j["tx_messages"] = tx_messages_;
-        j["rx_messages"] = rx_messages_;
-
-        j["tx_message_sizes"] = nlohmann::json::array();
-        for (const auto& kv : tx_message_sizes_) {
-            j["tx_message_sizes"].push_back({
-                {"message_size", kv.first},
-                {"frequency", kv.second},
+        w.field("processor_name", processor_name_);
+        w.field("rank", rank_);
+        w.field("n_procs", n_procs_);
+        w.field("description", description_);
+        w.field("n_events", n_events_);
+        w.field("duration", duration_);
+
+        if ((features_ & FEATURE_TIMING) && n_events_ > 0) {
+            w.field("first_event_time", first_event_time_ / 1000000000.0);
+            w.field("last_event_time", last_event_time_ / 1000000000.0);
+        }
+
+        if (clock_synced_) {
+            w.field("clock", nlohmann::json{
+                {"start", clock_start_},
+                {"drift", clock_drift_},
+                {"error", clock_error_},
             });
         }
 
-        j["rx_message_sizes"] = nlohmann::json::array();
-        for (const auto& kv : rx_message_sizes_) {
-            j["rx_message_sizes"].push_back({
-                {"message_size", kv.first},
-                {"frequency", kv.second},
+        // Counters of peers without traffic are left out; all arrays are
+        // aligned with peers
+        std::vector<int> slots = world_.used_slots();
+        w.key("peers");
+        w.begin_array();
+        for (const auto& slot : slots) {
+            w.value(world_.peer_of(slot));
+        }
+        w.end_array();
+
+        if (features_ & FEATURE_SAMPLING) {
+            write_sampled_counters(w, slots);
+        } else {
+            write_column(w, "tx_bytes", world_.tx_bytes, slots);
+            write_column(w, "rx_bytes", world_.rx_bytes, slots);
+            write_column(w, "tx_messages", world_.tx_messages, slots);
+            write_column(w, "rx_messages", world_.rx_messages, slots);
+        }
+
+        if (features_ & FEATURE_UNEXPECTED) {
+            write_column(w, "unexpected_messages",
+                         world_.unexpected_messages, slots);
+            write_column(w, "unexpected_bytes", world_.unexpected_bytes,
+                         slots);
+        }
+
+        // Sampled frequencies are extrapolated as the other counters
+        const uint64_t scale = (features_ & FEATURE_SAMPLING) ?
+            sample_rate_ : 1;
+        w.key("tx_message_sizes");
+        write_size_histogram(w, tx_message_sizes_, scale);
+        w.key("rx_message_sizes");
+        write_size_histogram(w, rx_message_sizes_, scale);
+
+        if (features_ & FEATURE_TIMING) {
+            write_latencies(w, slots);
+        }
+
+        write_comms(w);
+
+        if (features_ & FEATURE_EPOCHS) {
+            write_epochs(w);
+        }
+
+        if (features_ & FEATURE_TAGS) {
+            write_tags(w);
+        }
+
+        if (features_ & FEATURE_QUEUES) {
+            write_queues(w);
+        }
+
+        if (features_ & FEATURE_UNEXPECTED) {
+            write_unexpected(w);
+        }
+
+        if (features_ & FEATURE_TRANSFERS) {
+            write_transfers(w, slots);
+        }
+
+        if (features_ & FEATURE_COLLECTIVES) {
+            write_collectives(w);
+        }
+
+        if (features_ & FEATURE_EVENTS) {
+            w.field("event_log", nlohmann::json{
+                {"path", event_log_path_},
+                {"records", event_log_records_},
+                {"dropped", event_log_dropped_},
+                {"bytes", event_log_bytes_},
             });
         }
 
-        std::ofstream ofs(path);
-        ofs << std::setw(4) << j << std::endl;
+        if (features_ & FEATURE_OVERHEAD) {
+            overhead_.write_result.add(read_cycles() - start);
+            w.field("overhead", overhead_.to_json(cycles_per_ns_, duration_));
+        }
+
+        w.end_object();
+    }
+
+    // Same values as write_result(), as columns (see binary_result.hpp).
+    // Self-overhead and event trace statistics are left out.
+    bool write_binary(const std::string& path) const
+    {
+        binary_result_writer w;
+        binary_result_header& h = w.header();
+
+        h.rank = rank_;
+        h.n_procs = n_procs_;
+        h.features = features_;
+        h.sample_rate = sample_rate_;
+        h.n_events = n_events_;
+        h.duration = duration_;
+        if ((features_ & FEATURE_TIMING) && n_events_ > 0) {
+            h.first_event_time = first_event_time_ / 1000000000.0;
+            h.last_event_time = last_event_time_ / 1000000000.0;
+        }
+
+        w.add(COLUMN_PROCESSOR_NAME, processor_name_);
+        w.add(COLUMN_DESCRIPTION, description_);
+
+        clock_record clock = {clock_start_, clock_drift_, clock_error_};
+        if (clock_synced_) {
+            w.add(COLUMN_CLOCK, &clock, 1);
+        }
+
+        std::vector<int> slots = world_.used_slots();
+        std::vector<int32_t> peers;
+        for (const auto& slot : slots) {
+            peers.push_back(world_.peer_of(slot));
+        }
+        w.add(COLUMN_PEERS, peers);
+
+        const uint64_t scale = (features_ & FEATURE_SAMPLING) ?
+            sample_rate_ : 1;
+        std::vector<uint64_t> counters[4] = {
+            gather(world_.tx_bytes, slots, scale),
+            gather(world_.rx_bytes, slots, scale),
+            gather(world_.tx_messages, slots, scale),
+            gather(world_.rx_messages, slots, scale),
+        };
+        w.add(COLUMN_TX_BYTES, counters[0]);
+        w.add(COLUMN_RX_BYTES, counters[1]);
+        w.add(COLUMN_TX_MESSAGES, counters[2]);
+        w.add(COLUMN_RX_MESSAGES, counters[3]);
+
+        std::vector<uint64_t> unexpected[2];
+        if (features_ & FEATURE_UNEXPECTED) {
+            unexpected[0] = gather(world_.unexpected_messages, slots, 1);
+            unexpected[1] = gather(world_.unexpected_bytes, slots, 1);
+            w.add(COLUMN_UNEXPECTED_MESSAGES, unexpected[0]);
+            w.add(COLUMN_UNEXPECTED_BYTES, unexpected[1]);
+        }
+
+        std::vector<uint64_t> sampled[4];
+        std::vector<double> ci95[4];
+        if (features_ & FEATURE_SAMPLING) {
+            const double z = 1.96;
+            const double var_scale =
+                static_cast<double>(sample_rate_) * (sample_rate_ - 1);
+
+            sampled[0] = gather(world_.tx_bytes, slots, 1);
+            sampled[1] = gather(world_.rx_bytes, slots, 1);
+            sampled[2] = gather(world_.tx_messages, slots, 1);
+            sampled[3] = gather(world_.rx_messages, slots, 1);
+            for (const auto& slot : slots) {
+                ci95[0].push_back(z * std::sqrt(var_scale *
+                                                world_.tx_bytes_sq[slot]));
+                ci95[1].push_back(z * std::sqrt(var_scale *
+                                                world_.rx_bytes_sq[slot]));
+            }
+            for (const auto& n : sampled[2]) {
+                ci95[2].push_back(z * std::sqrt(var_scale * n));
+            }
+            for (const auto& n : sampled[3]) {
+                ci95[3].push_back(z * std::sqrt(var_scale * n));
+            }
+
+            w.add(COLUMN_SAMPLED_TX_BYTES, sampled[0]);
+            w.add(COLUMN_SAMPLED_RX_BYTES, sampled[1]);
+            w.add(COLUMN_SAMPLED_TX_MESSAGES, sampled[2]);
+            w.add(COLUMN_SAMPLED_RX_MESSAGES, sampled[3]);
+            w.add(COLUMN_TX_BYTES_CI95, ci95[0]);
+            w.add(COLUMN_RX_BYTES_CI95, ci95[1]);
+            w.add(COLUMN_TX_MESSAGES_CI95, ci95[2]);
+            w.add(COLUMN_RX_MESSAGES_CI95, ci95[3]);
+        }
+
+        std::vector<size_bucket_record> tx_sizes =
+            size_buckets(tx_message_sizes_, scale);
+        std::vector<size_bucket_record> rx_sizes =
+            size_buckets(rx_message_sizes_, scale);
+        w.add(COLUMN_TX_MESSAGE_SIZES, tx_sizes);
+        w.add(COLUMN_RX_MESSAGE_SIZES, rx_sizes);
+
+        std::vector<latency_bucket_record> latencies[4];
+        if (features_ & FEATURE_TIMING) {
+            for (const auto& slot : slots) {
+                latency_buckets(world_.tx_latency[slot],
+                                world_.peer_of(slot), latencies[0]);
+                latency_buckets(world_.rx_latency[slot],
+                                world_.peer_of(slot), latencies[1]);
+            }
+            for (size_t i = 0; i < tx_latency_by_size_.size(); i++) {
+                uint64_t size = i == 0 ? 0 : 1ULL << (i - 1);
+                latency_buckets(tx_latency_by_size_[i], size, latencies[2]);
+                latency_buckets(rx_latency_by_size_[i], size, latencies[3]);
+            }
+
+            w.add(COLUMN_TX_LATENCY, latencies[0]);
+            w.add(COLUMN_RX_LATENCY, latencies[1]);
+            w.add(COLUMN_TX_LATENCY_BY_SIZE, latencies[2]);
+            w.add(COLUMN_RX_LATENCY_BY_SIZE, latencies[3]);
+        }
+
+        uint64_t epoch_ns = epochs_.width_ns();
+        std::vector<epoch_record> epochs;
+        if (features_ & FEATURE_EPOCHS) {
+            for (const auto& e : epochs_.world()) {
+                const epoch_counters& c = e.counters;
+                epochs.push_back(epoch_record{
+                    e.epoch, e.key, c.tx_bytes * scale, c.rx_bytes * scale,
+                    c.tx_messages * scale, c.rx_messages * scale});
+            }
+
+            w.add(COLUMN_EPOCH_NS, &epoch_ns, 1);
+            w.add(COLUMN_EPOCHS, epochs);
+        }
+
+        std::vector<comm_record> comms;
+        std::string comm_names;
+        std::vector<comm_peer_record> comm_peers;
+        for (size_t i = 0; i < comm_summaries_.size(); i++) {
+            const comm_summary& c = comm_summaries_[i];
+
+            comms.push_back(comm_record{
+                static_cast<int32_t>(i), c.parent, c.size,
+                static_cast<uint32_t>(c.creation), comm_names.size(),
+                c.name.size(), comm_peers.size(), c.peers.size()});
+            comm_names += c.name;
+            for (size_t j = 0; j < c.peers.size(); j++) {
+                comm_peers.push_back(comm_peer_record{
+                    c.peers[j], c.tx_bytes[j] * scale, c.rx_bytes[j] * scale,
+                    c.tx_messages[j] * scale, c.rx_messages[j] * scale});
+            }
+        }
+        w.add(COLUMN_COMMS, comms);
+        w.add(COLUMN_COMM_NAMES, comm_names);
+        w.add(COLUMN_COMM_PEERS, comm_peers);
+
+        if (features_ & (FEATURE_QUEUES | FEATURE_UNEXPECTED)) {
+            w.add(COLUMN_QUEUE_EPOCH_NS, &queue_epoch_ns_, 1);
+        }
+
+        std::vector<queue_record> queues;
+        std::vector<uint32_t> queue_depths;
+        if (features_ & FEATURE_QUEUES) {
+            for (size_t i = 0; i < queues_.size(); i++) {
+                const queue_stats& q = queues_[i];
+                if (q.posted_empty()) {
+                    continue;
+                }
+
+                queues.push_back(queue_record{
+                    static_cast<int32_t>(i), 0, q.posted_inserts,
+                    q.posted_removes, q.max_posted_depth,
+                    q.posted_search.count(), q.posted_search.total,
+                    q.posted_search.max, q.unexpected_search.count(),
+                    q.unexpected_search.total, q.unexpected_search.max,
+                    queue_depths.size(), q.posted_depth.size()});
+                queue_depths.insert(queue_depths.end(),
+                                    q.posted_depth.begin(),
+                                    q.posted_depth.end());
+            }
+
+            w.add(COLUMN_QUEUES, queues);
+            w.add(COLUMN_QUEUE_DEPTHS, queue_depths);
+        }
+
+        std::vector<unexpected_record> unexpected_queues;
+        std::vector<uint32_t> unexpected_depths;
+        if (features_ & FEATURE_UNEXPECTED) {
+            for (size_t i = 0; i < queues_.size(); i++) {
+                const queue_stats& q = queues_[i];
+                if (q.unexpected_empty()) {
+                    continue;
+                }
+
+                unexpected_queues.push_back(unexpected_record{
+                    static_cast<int32_t>(i), 0, q.arrivals,
+                    q.unexpected_inserts, q.unexpected_removes,
+                    q.max_unexpected_depth, q.max_unexpected_bytes,
+                    q.unexpected_wait.count(), q.unexpected_wait.total,
+                    q.unexpected_wait.max, unexpected_depths.size(),
+                    q.unexpected_depth.size()});
+                unexpected_depths.insert(unexpected_depths.end(),
+                                         q.unexpected_depth.begin(),
+                                         q.unexpected_depth.end());
+            }
+
+            w.add(COLUMN_UNEXPECTED, unexpected_queues);
+            w.add(COLUMN_UNEXPECTED_DEPTHS, unexpected_depths);
+        }
+
+        std::vector<transfer_record> transfers[4];
+        bandwidth_record bandwidth;
+        if (features_ & FEATURE_TRANSFERS) {
+            for (const auto& slot : slots) {
+                int peer = world_.peer_of(slot);
+                transfer_bucket(world_.tx_transfers[slot], peer,
+                                transfers[0]);
+                transfer_bucket(world_.rx_transfers[slot], peer,
+                                transfers[1]);
+            }
+            for (size_t i = 0; i < tx_transfers_by_size_.size(); i++) {
+                int64_t size = i == 0 ? 0 :
+                    static_cast<int64_t>(1ULL << (i - 1));
+                transfer_bucket(tx_transfers_by_size_[i], size,
+                                transfers[2]);
+                transfer_bucket(rx_transfers_by_size_[i], size,
+                                transfers[3]);
+            }
+            bandwidth = bandwidth_record{
+                tx_bandwidth_.window_ns() / 1e9, tx_bandwidth_.peak(),
+                rx_bandwidth_.peak()};
+
+            w.add(COLUMN_TX_TRANSFERS, transfers[0]);
+            w.add(COLUMN_RX_TRANSFERS, transfers[1]);
+            w.add(COLUMN_TX_TRANSFERS_BY_SIZE, transfers[2]);
+            w.add(COLUMN_RX_TRANSFERS_BY_SIZE, transfers[3]);
+            w.add(COLUMN_BANDWIDTH, &bandwidth, 1);
+        }
+
+        std::vector<collective_record> collectives;
+        if (features_ & FEATURE_COLLECTIVES) {
+            for (size_t i = 0; i < collectives_.size(); i++) {
+                const collective_stats& s = collectives_[i];
+                if (!s.empty()) {
+                    collectives.push_back(collective_record{
+                        static_cast<int32_t>(i), 0, s.calls,
+                        s.tx_bytes * scale, s.rx_bytes * scale,
+                        s.tx_messages * scale, s.rx_messages * scale});
+                }
+            }
+            w.add(COLUMN_COLLECTIVES, collectives);
+        }
+
+        std::vector<tag_record> tags;
+        tag_record overflow;
+        if (features_ & FEATURE_TAGS) {
+            for (const auto& e : tags_.entries()) {
+                tags.push_back(tag_record{
+                    e.tag, e.tx_bytes * scale, e.rx_bytes * scale,
+                    e.tx_messages * scale, e.rx_messages * scale});
+            }
+
+            const tag_entry& o = tags_.overflow();
+            overflow = tag_record{
+                0, o.tx_bytes * scale, o.rx_bytes * scale,
+                o.tx_messages * scale, o.rx_messages * scale};
+
+            w.add(COLUMN_TAGS, tags);
+            w.add(COLUMN_TAG_OVERFLOW, &overflow, 1);
+        }
+
+        return w.write(path);
     }
 private:
+    // Sampled counters are reported raw (sampled_*), extrapolated to totals
+    // (tx_bytes etc.), and with the half-width of the 95% confidence
+    // interval of each total (*_ci95). The estimator is Horvitz-Thompson
+    // under sampling probability 1 / sample_rate.
+    void write_sampled_counters(json_writer& w,
+                                const std::vector<int>& slots) const
+    {
+        const double z = 1.96;
+        const uint64_t n = sample_rate_;
+        const double var_scale = static_cast<double>(n) * (n - 1);
+
+        auto ci = [&](const char *name, const std::vector<double>& sq) {
+            w.key(name);
+            w.begin_array();
+            for (const auto& slot : slots) {
+                w.value(z * std::sqrt(var_scale * sq[slot]));
+            }
+            w.end_array();
+        };
+        auto count_ci = [&](const char *name,
+                            const std::vector<uint64_t>& messages) {
+            w.key(name);
+            w.begin_array();
+            for (const auto& slot : slots) {
+                w.value(z * std::sqrt(var_scale * messages[slot]));
+            }
+            w.end_array();
+        };
+
+        w.field("sample_rate", sample_rate_);
+
+        write_column(w, "sampled_tx_bytes", world_.tx_bytes, slots);
+        write_column(w, "sampled_rx_bytes", world_.rx_bytes, slots);
+        write_column(w, "sampled_tx_messages", world_.tx_messages, slots);
+        write_column(w, "sampled_rx_messages", world_.rx_messages, slots);
+
+        write_column(w, "tx_bytes", world_.tx_bytes, slots, n);
+        write_column(w, "rx_bytes", world_.rx_bytes, slots, n);
+        write_column(w, "tx_messages", world_.tx_messages, slots, n);
+        write_column(w, "rx_messages", world_.rx_messages, slots, n);
+
+        ci("tx_bytes_ci95", world_.tx_bytes_sq);
+        ci("rx_bytes_ci95", world_.rx_bytes_sq);
+        count_ci("tx_messages_ci95", world_.tx_messages);
+        count_ci("rx_messages_ci95", world_.rx_messages);
+    }
+
+    // Latencies in ns of matched requests, per MPI_COMM_WORLD peer and per
+    // power-of-two message size bucket; only non-empty histograms are
+    // written
+    void write_latencies(json_writer& w,
+                         const std::vector<int>& slots) const
+    {
+        auto by_peer = [&](const char *name,
+                           const std::vector<histogram>& latency) {
+            w.key(name);
+            w.begin_array();
+            for (const auto& slot : slots) {
+                if (!latency[slot].empty()) {
+                    w.begin_object();
+                    w.field("peer", world_.peer_of(slot));
+                    write_latency(w, latency[slot]);
+                    w.end_object();
+                }
+            }
+            w.end_array();
+        };
+        auto by_size = [&](const char *name,
+                           const std::vector<histogram>& latency) {
+            w.key(name);
+            w.begin_array();
+            for (size_t i = 0; i < latency.size(); i++) {
+                if (!latency[i].empty()) {
+                    w.begin_object();
+                    w.field("message_size", i == 0 ? 0 : 1ULL << (i - 1));
+                    w.field("message_size_max", i == 0 ? 0 :
+                            (i == 64 ? UINT64_MAX : (1ULL << i) - 1));
+                    write_latency(w, latency[i]);
+                    w.end_object();
+                }
+            }
+            w.end_array();
+        };
+
+        by_peer("tx_latency", world_.tx_latency);
+        by_peer("rx_latency", world_.rx_latency);
+        by_size("tx_latency_by_size", tx_latency_by_size_);
+        by_size("rx_latency_by_size", rx_latency_by_size_);
+
+        w.field("inflight", nlohmann::json{
+            {"capacity", inflight_capacity_},
+            {"dropped", inflight_dropped_},
+            {"unmatched", unmatched_completions_},
+        });
+    }
+
+    // Fields of a latency histogram, inside an object
+    static void write_latency(json_writer& w, const histogram& h)
+    {
+        w.field("count", h.total());
+        w.field("p50", h.percentile(0.5));
+        w.field("p99", h.percentile(0.99));
+
+        w.key("histogram");
+        w.begin_array();
+        for (size_t i = 0; i < h.n_buckets(); i++) {
+            if (h.count(i) > 0) {
+                w.begin_object();
+                w.field("latency", h.lower_bound(i));
+                w.field("latency_max", h.upper_bound(i));
+                w.field("frequency", h.count(i));
+                w.end_object();
+            }
+        }
+        w.end_array();
+    }
+
+    // Time series of the traffic with every peer, one entry per epoch with
+    // traffic; counters are extrapolated when sampling
+    void write_epochs(json_writer& w) const
+    {
+        const uint64_t scale = (features_ & FEATURE_SAMPLING) ?
+            sample_rate_ : 1;
+        std::vector<epoch_entry> world = epochs_.world();
+
+        w.key("epochs");
+        w.begin_object();
+        w.field("epoch_ms", epochs_.width_ns() / 1000000);
+        w.field("spilled", epochs_.n_spilled());
+        w.field("dropped", epochs_.n_dropped());
+
+        w.key("series");
+        w.begin_array();
+        for (size_t begin = 0, end; begin < world.size(); begin = end) {
+            uint64_t index = world[begin].epoch;
+            for (end = begin; end < world.size() && world[end].epoch == index;
+                 end++) {
+            }
+
+            w.begin_object();
+            w.field("epoch", index);
+            w.field("start", index * epochs_.width_ns() / 1000000000.0);
+
+            w.key("peers");
+            w.begin_array();
+            for (size_t i = begin; i < end; i++) {
+                w.value(world[i].key);
+            }
+            w.end_array();
+
+            const char *names[] = {
+                "tx_bytes", "rx_bytes", "tx_messages", "rx_messages"
+            };
+            uint64_t epoch_counters::*counters[] = {
+                &epoch_counters::tx_bytes, &epoch_counters::rx_bytes,
+                &epoch_counters::tx_messages, &epoch_counters::rx_messages
+            };
+            for (size_t k = 0; k < 4; k++) {
+                w.key(names[k]);
+                w.begin_array();
+                for (size_t i = begin; i < end; i++) {
+                    w.value(world[i].counters.*counters[k] * scale);
+                }
+                w.end_array();
+            }
+            w.end_object();
+        }
+        w.end_array();
+
+        w.end_object();
+    }
+
+    // Traffic of every communicator, extrapolated when sampling
+    void write_comms(json_writer& w) const
+    {
+        static const char *creations[] = {
+            "predefined", "dup", "split", "create"
+        };
+        const uint64_t scale = (features_ & FEATURE_SAMPLING) ?
+            sample_rate_ : 1;
+
+        w.key("comms");
+        w.begin_array();
+        for (size_t i = 0; i < comm_summaries_.size(); i++) {
+            const comm_summary& c = comm_summaries_[i];
+
+            w.begin_object();
+            w.field("id", i);
+            w.field("name", c.name);
+            w.field("parent", c.parent);
+            w.field("creation", creations[c.creation]);
+            w.field("size", c.size);
+            w.field("peers", c.peers);
+            write_scaled(w, "tx_bytes", c.tx_bytes, scale);
+            write_scaled(w, "rx_bytes", c.rx_bytes, scale);
+            write_scaled(w, "tx_messages", c.tx_messages, scale);
+            write_scaled(w, "rx_messages", c.rx_messages, scale);
+            w.end_object();
+        }
+        w.end_array();
+    }
+
+    // Matching queues of every communicator that used them
+    void write_queues(json_writer& w) const
+    {
+        w.key("queues");
+        w.begin_object();
+        w.field("epoch_ms", queue_epoch_ns_ / 1000000);
+
+        w.key("comms");
+        w.begin_array();
+        for (size_t i = 0; i < queues_.size(); i++) {
+            const queue_stats& q = queues_[i];
+            if (q.posted_empty()) {
+                continue;
+            }
+
+            w.begin_object();
+            w.field("comm", i);
+            w.field("posted_inserts", q.posted_inserts);
+            w.field("posted_removes", q.posted_removes);
+            w.field("max_posted_depth", q.max_posted_depth);
+            w.field("posted_depth", q.posted_depth);
+            w.key("posted_search");
+            write_time_stats(w, q.posted_search);
+            w.key("unexpected_search");
+            write_time_stats(w, q.unexpected_search);
+            w.end_object();
+        }
+        w.end_array();
+
+        w.end_object();
+    }
+
+    // Unexpected message queue of every communicator that received
+    // messages
+    void write_unexpected(json_writer& w) const
+    {
+        w.key("unexpected");
+        w.begin_object();
+        w.field("epoch_ms", queue_epoch_ns_ / 1000000);
+        w.field("dropped", unexpected_dropped_);
+
+        w.key("comms");
+        w.begin_array();
+        for (size_t i = 0; i < queues_.size(); i++) {
+            const queue_stats& q = queues_[i];
+            if (q.unexpected_empty()) {
+                continue;
+            }
+
+            w.begin_object();
+            w.field("comm", i);
+            w.field("arrivals", q.arrivals);
+            w.field("inserts", q.unexpected_inserts);
+            w.field("removes", q.unexpected_removes);
+            w.field("max_depth", q.max_unexpected_depth);
+            w.field("max_bytes", q.max_unexpected_bytes);
+            w.field("depth", q.unexpected_depth);
+            w.key("wait");
+            write_time_stats(w, q.unexpected_wait);
+            w.end_object();
+        }
+        w.end_array();
+
+        w.end_object();
+    }
+
+    // Payload transfers per peer and per power-of-two message size, with
+    // the peak bandwidths over a sliding window
+    void write_transfers(json_writer& w, const std::vector<int>& slots) const
+    {
+        auto fields = [&](const transfer_stats& t) {
+            w.field("transfers", t.transfers);
+            w.field("bytes", t.bytes);
+            w.field("ns", t.ns);
+            w.field("bandwidth", t.bandwidth());
+            w.field("fragments", t.fragments);
+            w.field("eager", t.transfers - t.rendezvous);
+            w.field("eager_bytes", t.bytes - t.rendezvous_bytes);
+            w.field("rendezvous", t.rendezvous);
+            w.field("rendezvous_bytes", t.rendezvous_bytes);
+            w.field("handshake_ns", t.handshake_ns);
+            w.field("handshake_max", t.handshake_max);
+        };
+        auto by_peer = [&](const char *name,
+                           const std::vector<transfer_stats>& transfers) {
+            w.key(name);
+            w.begin_array();
+            for (const auto& slot : slots) {
+                if (!transfers[slot].empty()) {
+                    w.begin_object();
+                    w.field("peer", world_.peer_of(slot));
+                    fields(transfers[slot]);
+                    w.end_object();
+                }
+            }
+            w.end_array();
+        };
+        auto by_size = [&](const char *name,
+                           const std::vector<transfer_stats>& transfers) {
+            w.key(name);
+            w.begin_array();
+            for (size_t i = 0; i < transfers.size(); i++) {
+                if (!transfers[i].empty()) {
+                    w.begin_object();
+                    w.field("message_size", i == 0 ? 0 : 1ULL << (i - 1));
+                    w.field("message_size_max", i == 0 ? 0 :
+                            (i == 64 ? UINT64_MAX : (1ULL << i) - 1));
+                    fields(transfers[i]);
+                    w.end_object();
+                }
+            }
+            w.end_array();
+        };
+
+        w.key("transfers");
+        w.begin_object();
+        w.field("window_ms", tx_bandwidth_.window_ns() / 1000000);
+        w.field("tx_peak_bandwidth", tx_bandwidth_.peak());
+        w.field("rx_peak_bandwidth", rx_bandwidth_.peak());
+        w.field("dropped", transfers_dropped_);
+        w.field("unmatched", unmatched_transfers_);
+        by_peer("tx", world_.tx_transfers);
+        by_peer("rx", world_.rx_transfers);
+        by_size("tx_by_size", tx_transfers_by_size_);
+        by_size("rx_by_size", rx_transfers_by_size_);
+        w.end_object();
+    }
+
+    // Traffic of every collective with calls or traffic, and of application
+    // point-to-point; extrapolated when sampling
+    void write_collectives(json_writer& w) const
+    {
+        const uint64_t scale = (features_ & FEATURE_SAMPLING) ?
+            sample_rate_ : 1;
+
+        w.key("collectives");
+        w.begin_array();
+        for (size_t i = 0; i < collectives_.size(); i++) {
+            const collective_stats& s = collectives_[i];
+            if (s.empty()) {
+                continue;
+            }
+
+            w.begin_object();
+            w.field("collective", collective_name(i));
+            w.field("calls", s.calls);
+            w.field("tx_bytes", s.tx_bytes * scale);
+            w.field("rx_bytes", s.rx_bytes * scale);
+            w.field("tx_messages", s.tx_messages * scale);
+            w.field("rx_messages", s.rx_messages * scale);
+            w.end_object();
+        }
+        w.end_array();
+    }
+
+    static void write_time_stats(json_writer& w, const time_stats& t)
+    {
+        w.begin_object();
+        w.field("count", t.count());
+        w.field("total", t.total);
+        w.field("p50", t.times.empty() ? 0 : t.times.percentile(0.5));
+        w.field("p99", t.times.empty() ? 0 : t.times.percentile(0.99));
+        w.field("max", t.max);
+        w.end_object();
+    }
+
+    static void write_scaled(json_writer& w, const char *name,
+                             const std::vector<uint64_t>& v, uint64_t scale)
+    {
+        w.key(name);
+        w.begin_array();
+        for (const auto& x : v) {
+            w.value(x * scale);
+        }
+        w.end_array();
+    }
+
+    // Traffic by tag, aligned arrays in increasing tag order, and of the
+    // tags beyond the limit; counters are extrapolated when sampling
+    void write_tags(json_writer& w) const
+    {
+        const uint64_t scale = (features_ & FEATURE_SAMPLING) ?
+            sample_rate_ : 1;
+        std::vector<tag_entry> entries = tags_.entries();
+        const char *names[] = {
+            "tx_bytes", "rx_bytes", "tx_messages", "rx_messages"
+        };
+        uint64_t tag_entry::*counters[] = {
+            &tag_entry::tx_bytes, &tag_entry::rx_bytes,
+            &tag_entry::tx_messages, &tag_entry::rx_messages
+        };
+
+        w.key("tags");
+        w.begin_object();
+        w.field("limit", tags_.limit());
+
+        w.key("tags");
+        w.begin_array();
+        for (const auto& e : entries) {
+            w.value(e.tag);
+        }
+        w.end_array();
+
+        for (size_t k = 0; k < 4; k++) {
+            w.key(names[k]);
+            w.begin_array();
+            for (const auto& e : entries) {
+                w.value(e.*counters[k] * scale);
+            }
+            w.end_array();
+        }
+
+        w.key("overflow");
+        w.begin_object();
+        for (size_t k = 0; k < 4; k++) {
+            w.field(names[k], tags_.overflow().*counters[k] * scale);
+        }
+        w.end_object();
+
+        w.end_object();
+    }
+
+    static void merge_histograms(std::vector<histogram>& into,
+                                 const std::vector<histogram>& from)
+    {
+        if (into.size() < from.size()) {
+            into.resize(from.size());
+        }
+        for (size_t i = 0; i < from.size(); i++) {
+            into[i].merge(from[i]);
+        }
+    }
+
+    static void merge_transfers(std::vector<transfer_stats>& into,
+                                const std::vector<transfer_stats>& from)
+    {
+        if (into.size() < from.size()) {
+            into.resize(from.size());
+        }
+        for (size_t i = 0; i < from.size(); i++) {
+            into[i].merge(from[i]);
+        }
+    }
+
+    static int size_bucket(uint64_t len)
+    {
+        return len == 0 ? 0 : 64 - __builtin_clzll(len);
+    }
+
+    // Array of the counters of the given slots, multiplied by scale
+    static void write_column(json_writer& w, const char *name,
+                             const std::vector<uint64_t>& v,
+                             const std::vector<int>& slots,
+                             uint64_t scale = 1)
+    {
+        w.key(name);
+        w.begin_array();
+        for (const auto& slot : slots) {
+            w.value(v[slot] * scale);
+        }
+        w.end_array();
+    }
+
+    static std::vector<uint64_t> gather(const std::vector<uint64_t>& v,
+                                        const std::vector<int>& slots,
+                                        uint64_t scale)
+    {
+        std::vector<uint64_t> column;
+
+        column.reserve(slots.size());
+        for (const auto& slot : slots) {
+            column.push_back(v[slot] * scale);
+        }
+
+        return column;
+    }
+
+    static std::vector<size_bucket_record> size_buckets(
+        const size_histogram& h, uint64_t scale)
+    {
+        std::vector<size_bucket_record> buckets;
+
+        h.for_each([&buckets, scale](uint64_t min_size, uint64_t max_size,
+                                     uint64_t frequency) {
+            buckets.push_back(
+                size_bucket_record{min_size, max_size, frequency * scale});
+        });
+
+        return buckets;
+    }
+
+    static void latency_buckets(const histogram& h, uint64_t key,
+                                std::vector<latency_bucket_record>& buckets)
+    {
+        if (h.empty()) {
+            return;
+        }
+
+        for (size_t i = 0; i < h.n_buckets(); i++) {
+            if (h.count(i) > 0) {
+                buckets.push_back(latency_bucket_record{
+                    key, h.lower_bound(i), h.upper_bound(i), h.count(i)});
+            }
+        }
+    }
+
+    static void transfer_bucket(const transfer_stats& t, int64_t key,
+                                std::vector<transfer_record>& buckets)
+    {
+        if (!t.empty()) {
+            buckets.push_back(transfer_record{
+                key, t.transfers, t.bytes, t.ns, t.fragments, t.rendezvous,
+                t.rendezvous_bytes, t.handshake_ns, t.handshake_max});
+        }
+    }
+
+    // xorshift64, only used to draw sampling intervals
+    uint32_t next_random()
+    {
+        rng_state_ ^= rng_state_ << 13;
+        rng_state_ ^= rng_state_ >> 7;
+        rng_state_ ^= rng_state_ << 17;
+
+        return rng_state_ >> 32;
+    }
+
+    // Exactly counted sizes are written as before; bucketed sizes also carry
+    // the largest size of their bucket
+    static void write_size_histogram(json_writer& w,
+                                     const size_histogram& h, uint64_t scale)
+    {
+        w.begin_array();
+        h.for_each([&w, scale](uint64_t min_size, uint64_t max_size,
+                               uint64_t frequency) {
+            w.begin_object();
+            w.field("message_size", min_size);
+            w.field("frequency", frequency * scale);
+            if (max_size != min_size) {
+                w.field("message_size_max", max_size);
+            }
+            w.end_object();
+        });
+        w.end_array();
+    }
+
+    // Counters are sized on the first event of a communicator, for all the
+    // enabled features at once
+    peer_counters& comm_counters(int comm_id, int comm_size)
+    {
+        if (comm_id >= static_cast<int>(comms_.size())) {
+            comms_.resize(comm_id + 1);
+        }
+
+        peer_counters& c = comms_[comm_id];
+        if (c.size() == 0) {
+            c.init(comm_size, features_ & FEATURE_SAMPLING,
+                   features_ & FEATURE_TIMING,
+                   features_ & FEATURE_UNEXPECTED,
+                   features_ & FEATURE_TRANSFERS);
+        }
+
+        return c;
+    }
+
+    queue_stats& queue_stats_of(int comm_id)
+    {
+        if (comm_id >= static_cast<int>(queues_.size())) {
+            queues_.resize(comm_id + 1);
+        }
+
+        return queues_[comm_id];
+    }
+
+    comm_summary& comm_summary_of(int comm_id)
+    {
+        if (comm_id >= static_cast<int>(comm_summaries_.size())) {
+            comm_summaries_.resize(comm_id + 1);
+        }
+
+        return comm_summaries_[comm_id];
+    }
+
+    unsigned features_;
+    uint32_t sample_rate_;
+    uint64_t rng_state_;
+    // Sampling countdowns for activations without a known peer
+    uint32_t tx_countdown_;
+    uint32_t rx_countdown_;
     std::string processor_name_;
     int rank_;
     int n_procs_;
     std::string description_;
     double duration_;
-    int n_events_;
-
-    std::vector<uint64_t> tx_bytes_;
-    std::vector<uint64_t> rx_bytes_;
-    std::vector<uint64_t> tx_messages_;
-    std::vector<uint64_t> rx_messages_;
-    std::unordered_map<int, uint64_t> tx_message_sizes_;
-    std::unordered_map<int, uint64_t> rx_message_sizes_;
+    double cycles_per_ns_;
+    bool clock_synced_;
+    double clock_start_;
+    double clock_drift_;
+    double clock_error_;
+    uint64_t n_events_;
+    uint64_t first_event_time_;
+    uint64_t last_event_time_;
+
+    // Counters by MPI_COMM_WORLD rank, filled by translate()
+    peer_counters world_;
+    // Counters by communicator id and communicator-local rank
+    std::vector<peer_counters> comms_;
+    // Counters by communicator id and MPI_COMM_WORLD rank, filled by
+    // translate(), with the names and lineage of describe_comm()
+    std::vector<comm_summary> comm_summaries_;
+    size_histogram tx_message_sizes_;
+    size_histogram rx_message_sizes_;
+    // Latency histograms by size_bucket() (FEATURE_TIMING)
+    std::vector<histogram> tx_latency_by_size_;
+    std::vector<histogram> rx_latency_by_size_;
+    uint64_t unmatched_completions_;
+    size_t inflight_capacity_;
+    uint64_t inflight_dropped_;
+    std::string event_log_path_;
+    uint64_t event_log_records_;
+    uint64_t event_log_dropped_;
+    uint64_t event_log_bytes_;
+    // Traffic by time epoch (FEATURE_EPOCHS)
+    epoch_series epochs_;
+    // Traffic by tag (FEATURE_TAGS)
+    tag_counters tags_;
+    // Matching queues by communicator id (FEATURE_QUEUES), and the width in
+    // ns of the epochs of their depth series
+    std::vector<queue_stats> queues_;
+    uint64_t queue_epoch_ns_;
+    uint64_t unexpected_dropped_;
+    // Transfers by size_bucket(), and bytes moved over time
+    // (FEATURE_TRANSFERS)
+    std::vector<transfer_stats> tx_transfers_by_size_;
+    std::vector<transfer_stats> rx_transfers_by_size_;
+    bandwidth_series tx_bandwidth_;
+    bandwidth_series rx_bandwidth_;
+    uint64_t transfers_dropped_;
+    uint64_t unmatched_transfers_;
+    // Traffic by collective (FEATURE_COLLECTIVES)
+    std::vector<collective_stats> collectives_;
+    class overhead overhead_;
 };
 
 }
@@ -0,0 +1,402 @@
+#ifndef __TRANSFER_STATS_HPP__
+#define __TRANSFER_STATS_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace pfprof {
+
+// Payload transfers, from the first to the last byte moved
+// (FEATURE_TRANSFERS). Messages whose payload moves in a single fragment
+// are eager; the others are rendezvous, whose first fragment only carries
+// the header and whose later fragments wait for the receiver to match it.
+// Rendezvous over RDMA (RGET/RPUT) moves the payload without fragment
+// events and cannot be told apart from eager.
+struct transfer_stats
+{
+    uint64_t transfers;
+    uint64_t bytes;
+    // Total transfer time
+    uint64_t ns;
+    uint64_t fragments;
+    uint64_t rendezvous;
+    uint64_t rendezvous_bytes;
+    // Total and largest time from the activation of a send, or the first
+    // fragment of a receive, to the second fragment of rendezvous messages,
+    // the extra latency of their handshake
+    uint64_t handshake_ns;
+    uint64_t handshake_max;
+
+    transfer_stats()
+        : transfers(0), bytes(0), ns(0), fragments(0), rendezvous(0),
+          rendezvous_bytes(0), handshake_ns(0), handshake_max(0)
+    {
+    }
+
+    bool empty() const
+    {
+        return transfers == 0;
+    }
+
+    void record(uint64_t len, uint64_t duration, uint64_t n_fragments)
+    {
+        transfers++;
+        bytes += len;
+        ns += duration;
+        fragments += n_fragments;
+    }
+
+    void record_rendezvous(uint64_t len, uint64_t handshake)
+    {
+        rendezvous++;
+        rendezvous_bytes += len;
+        handshake_ns += handshake;
+        handshake_max = std::max(handshake_max, handshake);
+    }
+
+    void merge(const transfer_stats& other)
+    {
+        transfers += other.transfers;
+        bytes += other.bytes;
+        ns += other.ns;
+        fragments += other.fragments;
+        rendezvous += other.rendezvous;
+        rendezvous_bytes += other.rendezvous_bytes;
+        handshake_ns += other.handshake_ns;
+        handshake_max = std::max(handshake_max, other.handshake_max);
+    }
+
+    // Achieved bandwidth in bytes/s
+    double bandwidth() const
+    {
+        return ns > 0 ? bytes * 1e9 / ns : 0.0;
+    }
+};
+
+// Bytes moved over time, for the peak bandwidth over a sliding window. The
+// window is divided in a fixed number of bins, and the bytes of a transfer
+// are spread evenly over the bins it spans; bins of all threads add up
+// before the peak is taken.
+class bandwidth_series
+{
+public:
+    static const int bins_per_window = 8;
+
+    bandwidth_series() : bin_ns_(1)
+    {
+    }
+
+    void init(uint64_t window_ns)
+    {
+        bin_ns_ = std::max<uint64_t>(window_ns / bins_per_window, 1);
+        bins_.clear();
+    }
+
+    uint64_t window_ns() const
+    {
+        return bin_ns_ * bins_per_window;
+    }
+
+    // Transfer of len bytes from begin to end, in ns
+    void record(uint64_t begin, uint64_t end, uint64_t len)
+    {
+        uint64_t first = begin / bin_ns_;
+        uint64_t last = std::max(end, begin) / bin_ns_;
+
+        if (last >= bins_.size()) {
+            bins_.resize(last + 1, 0);
+        }
+
+        if (first == last) {
+            bins_[first] += len;
+            return;
+        }
+
+        // Whole bins get an equal share, the last one the remainder
+        uint64_t share = len / (last - first + 1);
+        for (uint64_t i = first; i < last; i++) {
+            bins_[i] += share;
+        }
+        bins_[last] += len - share * (last - first);
+    }
+
+    void merge(const bandwidth_series& other)
+    {
+        if (bins_.size() < other.bins_.size()) {
+            bins_.resize(other.bins_.size(), 0);
+        }
+        for (size_t i = 0; i < other.bins_.size(); i++) {
+            bins_[i] += other.bins_[i];
+        }
+    }
+
+    // Largest bandwidth in bytes/s over any window
+    double peak() const
+    {
+        uint64_t sum = 0;
+        uint64_t max = 0;
+
+        for (size_t i = 0; i < bins_.size(); i++) {
+            sum += bins_[i];
+            if (i >= bins_per_window) {
+                sum -= bins_[i - bins_per_window];
+            }
+            max = std::max(max, sum);
+        }
+
+        return max * 1e9 / window_ns();
+    }
+
+private:
+    uint64_t bin_ns_;
+    std::vector<uint64_t> bins_;
+};
+
+// Fixed-capacity, lock-free table of transfers in progress keyed by the
+// PERUSE unique_id, as inflight_table: a transfer may begin, continue and
+// end on different threads. Fragment counters are updated atomically in
+// place.
+class transfer_table
+{
+public:
+    static const int max_probes = 16;
+
+    // Transfer removed from the table
+    struct state
+    {
+        // Activation of the request, if recorded, or 0
+        uint64_t activated;
+        uint64_t begin;
+        // Time of the first fragment after the beginning, if any
+        uint64_t first;
+        // Bytes and number of the fragments after the beginning
+        uint64_t bytes;
+        uint64_t fragments;
+    };
+
+    transfer_table() : mask_(0), dropped_(0)
+    {
+    }
+
+    // capacity is rounded up to a power of two
+    void init(size_t capacity)
+    {
+        size_t n = 1;
+        while (n < capacity) {
+            n <<= 1;
+        }
+
+        entries_.reset(new entry[n]);
+        for (size_t i = 0; i < n; i++) {
+            entries_[i].key.store(empty_key, std::memory_order_relaxed);
+            entries_[i].activated.store(0, std::memory_order_relaxed);
+            entries_[i].begin.store(0, std::memory_order_relaxed);
+            entries_[i].first.store(0, std::memory_order_relaxed);
+            entries_[i].bytes.store(0, std::memory_order_relaxed);
+            entries_[i].fragments.store(0, std::memory_order_relaxed);
+        }
+        mask_ = n - 1;
+    }
+
+    // Transfers that found no free slot and are not timed
+    uint64_t dropped() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    // Activation of a request whose transfer is to be timed from it. A
+    // transfer whose activation found no free slot is timed from its
+    // beginning.
+    void activate(uintptr_t id, uint64_t time)
+    {
+        bool claimed;
+        entry *e = claim(id, &claimed);
+
+        if (e != nullptr) {
+            e->activated.store(time, std::memory_order_relaxed);
+            e->begin.store(0, std::memory_order_relaxed);
+            reset(e, id, claimed);
+        }
+    }
+
+    void begin(uintptr_t id, uint64_t time)
+    {
+        bool claimed;
+        entry *e = claim(id, &claimed);
+
+        if (e != nullptr) {
+            // Transfers of requests whose activation was not recorded
+            if (claimed) {
+                e->activated.store(0, std::memory_order_relaxed);
+            }
+            e->begin.store(time, std::memory_order_relaxed);
+            reset(e, id, claimed);
+        } else {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Completion of a request. The activation of a send that completes
+    // without a transfer, e.g. cancelled, is removed; transfers that began
+    // are removed by end(), which may follow the completion of eager sends.
+    void complete(uintptr_t id)
+    {
+        entry *e = find(id);
+
+        if (e != nullptr && e->begin.load(std::memory_order_acquire) == 0) {
+            uintptr_t k = id;
+            e->key.compare_exchange_strong(k, tombstone_key,
+                                           std::memory_order_acq_rel);
+        }
+    }
+
+    // Fragment of len bytes of a transfer in progress
+    void add(uintptr_t id, uint64_t len, uint64_t time)
+    {
+        entry *e = find(id);
+
+        if (e != nullptr) {
+            e->bytes.fetch_add(len, std::memory_order_relaxed);
+            if (e->fragments.fetch_add(1, std::memory_order_acq_rel) == 0) {
+                e->first.store(time, std::memory_order_release);
+            }
+        }
+    }
+
+    // Removes a transfer, or returns false if its beginning was not
+    // recorded
+    bool end(uintptr_t id, state *s)
+    {
+        entry *e = find(id);
+
+        if (e == nullptr) {
+            return false;
+        }
+
+        s->activated = e->activated.load(std::memory_order_acquire);
+        s->begin = e->begin.load(std::memory_order_acquire);
+        s->first = e->first.load(std::memory_order_acquire);
+        s->bytes = e->bytes.load(std::memory_order_relaxed);
+        s->fragments = e->fragments.load(std::memory_order_relaxed);
+
+        // Fails if another thread ended it first
+        uintptr_t k = id;
+        return e->key.compare_exchange_strong(k, tombstone_key,
+                                              std::memory_order_acq_rel);
+    }
+
+private:
+    static const uintptr_t empty_key = 0;
+    static const uintptr_t tombstone_key = 1;
+    static const uintptr_t busy_key = 2;
+
+    struct entry
+    {
+        std::atomic<uintptr_t> key;
+        std::atomic<uint64_t> activated;
+        std::atomic<uint64_t> begin;
+        std::atomic<uint64_t> first;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> fragments;
+    };
+
+    size_t slot_of(uintptr_t id) const
+    {
+        return ((id >> 3) * 0x9e3779b97f4a7c15ULL >> 16) & mask_;
+    }
+
+    // Returns the entry of id, or a free entry held busy (claimed) that
+    // reset() publishes, or nullptr if the probe sequence is full. As
+    // inflight_table, the whole chain is searched before a tombstone is
+    // reused, so that an id is never in the table twice.
+    entry *claim(uintptr_t id, bool *claimed)
+    {
+        if (id == empty_key || id == tombstone_key || id == busy_key) {
+            return nullptr;
+        }
+
+        size_t slot = slot_of(id);
+
+        // Retried when another thread takes the free slot first
+        for (int attempt = 0; attempt < max_probes; attempt++) {
+            entry *free = nullptr;
+            uintptr_t free_key = empty_key;
+
+            for (int i = 0; i < max_probes; i++) {
+                entry& e = entries_[(slot + i) & mask_];
+                uintptr_t k = e.key.load(std::memory_order_acquire);
+
+                // Persistent requests transfer again with the same id
+                if (k == id) {
+                    *claimed = false;
+                    return &e;
+                }
+                if (free == nullptr &&
+                    (k == empty_key || k == tombstone_key)) {
+                    free = &e;
+                    free_key = k;
+                }
+                if (k == empty_key) {
+                    break;
+                }
+            }
+
+            if (free == nullptr) {
+                break;
+            }
+
+            if (free->key.compare_exchange_strong(free_key, busy_key,
+                                                  std::memory_order_acquire)) {
+                *claimed = true;
+                return free;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Clears the fragments of an entry and publishes it if claimed
+    void reset(entry *e, uintptr_t id, bool claimed)
+    {
+        e->bytes.store(0, std::memory_order_relaxed);
+        e->fragments.store(0, std::memory_order_relaxed);
+        if (claimed) {
+            e->key.store(id, std::memory_order_release);
+        }
+    }
+
+    entry *find(uintptr_t id)
+    {
+        if (id == empty_key || id == tombstone_key || id == busy_key) {
+            return nullptr;
+        }
+
+        size_t slot = slot_of(id);
+
+        for (int i = 0; i < max_probes; i++) {
+            entry& e = entries_[(slot + i) & mask_];
+            uintptr_t k = e.key.load(std::memory_order_acquire);
+
+            if (k == id) {
+                return &e;
+            }
+            if (k == empty_key) {
+                break;
+            }
+        }
+
+        return nullptr;
+    }
+
+    std::unique_ptr<entry[]> entries_;
+    size_t mask_;
+    std::atomic<uint64_t> dropped_;
+};
+
+}
+
+#endif
@@ -0,0 +1,143 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "binary_result.hpp"
+#include "check.hpp"
+#include "config.hpp"
+#include "trace.hpp"
+
+using namespace pfprof;
+
+// Columns written by binary_result_writer read back identically, whatever
+// their element type
+static void test_round_trip()
+{
+    std::string path = temp_path();
+
+    std::vector<int32_t> peers = {1, 5, 9};
+    std::vector<uint64_t> tx_bytes = {10, 0, 1ULL << 40};
+    std::vector<size_bucket_record> sizes = {{8, 8, 3}, {1024, 1087, 2}};
+    std::string name = "node-17";
+
+    binary_result_writer w;
+    w.header().rank = 3;
+    w.header().n_procs = 16;
+    w.header().features = FEATURE_SIZES;
+    w.header().sample_rate = 1;
+    w.header().n_events = 42;
+    w.header().duration = 1.5;
+    w.add(COLUMN_PROCESSOR_NAME, name);
+    w.add(COLUMN_PEERS, peers);
+    w.add(COLUMN_TX_BYTES, tx_bytes);
+    w.add(COLUMN_TX_MESSAGE_SIZES, sizes);
+    // Empty columns are still listed
+    w.add(COLUMN_RX_BYTES, std::vector<uint64_t>());
+    CHECK(w.write(path));
+
+    binary_result r;
+    CHECK(r.open(path));
+    CHECK(r.header().rank == 3);
+    CHECK(r.header().n_procs == 16);
+    CHECK(r.header().features == FEATURE_SIZES);
+    CHECK(r.header().n_events == 42);
+    CHECK(r.header().duration == 1.5);
+    CHECK(r.processor_name() == name);
+
+    CHECK(std::vector<int32_t>(r.peers().begin(), r.peers().end()) == peers);
+    CHECK(std::vector<uint64_t>(r.tx_bytes().begin(), r.tx_bytes().end()) ==
+          tx_bytes);
+    CHECK(r.rx_bytes().empty());
+
+    column<size_bucket_record> s = r.tx_message_sizes();
+    CHECK(s.size() == sizes.size());
+    for (size_t i = 0; i < s.size() && i < sizes.size(); i++) {
+        CHECK(s[i].message_size == sizes[i].message_size);
+        CHECK(s[i].message_size_max == sizes[i].message_size_max);
+        CHECK(s[i].frequency == sizes[i].frequency);
+    }
+
+    // Missing columns and mismatched element sizes read as empty
+    CHECK(r.get<uint64_t>(COLUMN_TAGS).empty());
+    CHECK(r.get<uint32_t>(COLUMN_TX_BYTES).empty());
+
+    r.close();
+    std::remove(path.c_str());
+}
+
+static void test_invalid()
+{
+    std::string path = temp_path();
+
+    FILE *f = std::fopen(path.c_str(), "wb");
+    std::vector<char> garbage(sizeof(binary_result_header) + 64, 'x');
+    std::fwrite(garbage.data(), 1, garbage.size(), f);
+    std::fclose(f);
+
+    binary_result r;
+    CHECK(!r.open(path));
+    CHECK(!r.open(path + ".missing"));
+
+    std::remove(path.c_str());
+}
+
+// Result of a rank of 4 that sent messages of 100 and 5000 bytes to peers
+// 1 and 3
+static void feed(trace& t)
+{
+    for (int i = 0; i < 30; i++) {
+        t.feed_event<EV_BEGIN_SEND, FEATURE_SIZES | FEATURE_SAMPLING>(
+            0, 4, 1, 100, 0, 0);
+    }
+    for (int i = 0; i < 10; i++) {
+        t.feed_event<EV_BEGIN_SEND, FEATURE_SIZES | FEATURE_SAMPLING>(
+            0, 4, 3, 5000, 0, 0);
+    }
+    t.translate(0, std::vector<int>{0, 1, 2, 3});
+}
+
+// trace::write_binary() under sampling: counters and message size
+// frequencies are both extrapolated, so they add up to the same totals
+static void test_trace_sampled()
+{
+    std::string path = temp_path();
+
+    config cfg;
+    cfg.features = FEATURE_SIZES | FEATURE_SAMPLING;
+    cfg.sample_rate = 10;
+    trace t;
+    t.configure(cfg);
+    t.set_n_procs(4);
+    feed(t);
+    CHECK(t.write_binary(path));
+
+    binary_result r;
+    CHECK(r.open(path));
+    CHECK(r.header().sample_rate == 10);
+    CHECK(std::vector<int32_t>(r.peers().begin(), r.peers().end()) ==
+          std::vector<int32_t>({1, 3}));
+    CHECK(std::vector<uint64_t>(r.tx_messages().begin(),
+                                r.tx_messages().end()) ==
+          std::vector<uint64_t>({300, 100}));
+    CHECK(std::vector<uint64_t>(r.tx_bytes().begin(), r.tx_bytes().end()) ==
+          std::vector<uint64_t>({30000, 500000}));
+
+    uint64_t messages = 0;
+    for (const auto& b : r.tx_message_sizes()) {
+        messages += b.frequency;
+        CHECK(b.frequency == (b.message_size == 100 ? 300u : 100u));
+    }
+    CHECK(messages == 400);
+
+    r.close();
+    std::remove(path.c_str());
+}
+
+int main()
+{
+    test_round_trip();
+    test_invalid();
+    test_trace_sampled();
+
+    return check_status();
+}
@@ -0,0 +1,42 @@
+#ifndef __CHECK_HPP__
+#define __CHECK_HPP__
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+// Minimal self-checking test support: CHECK() reports failed conditions
+// and a test returns check_status() from main().
+
+static int check_failures = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " << #cond       \
+                      << std::endl;                                         \
+            check_failures++;                                               \
+        }                                                                   \
+    } while (0)
+
+static inline int check_status()
+{
+    return check_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Path of a new empty temporary file, removed by the test
+static inline std::string temp_path()
+{
+    char path[] = "/tmp/pfprof-testXXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    return path;
+}
+
+#endif
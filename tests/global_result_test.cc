@@ -0,0 +1,124 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "config.hpp"
+#include "global_result.hpp"
+#include "json.hpp"
+#include "trace.hpp"
+
+using namespace pfprof;
+
+static const int n_procs = 4;
+
+// Rank that sent `messages` messages of len bytes to every other rank
+template <unsigned Features>
+static void feed(trace& t, int rank, int messages, uint64_t len)
+{
+    t.set_rank(rank);
+    t.set_processor_name("node-" + std::to_string(rank));
+
+    for (int peer = 0; peer < n_procs; peer++) {
+        if (peer == rank) {
+            continue;
+        }
+        for (int i = 0; i < messages; i++) {
+            t.feed_event<EV_BEGIN_SEND, Features>(0, n_procs, peer, len, 0,
+                                                  0);
+        }
+    }
+    t.translate(0, std::vector<int>{0, 1, 2, 3});
+}
+
+// Every rank packs its result and merges those of others along a tree, as
+// write_global_result() does; the root writes the job-wide result
+static nlohmann::json gather(int sample_rate)
+{
+    config cfg;
+    cfg.features = FEATURE_SIZES;
+    if (sample_rate > 1) {
+        cfg.features |= FEATURE_SAMPLING;
+        cfg.sample_rate = sample_rate;
+    }
+
+    std::vector<global_result> results(n_procs);
+    for (int rank = 0; rank < n_procs; rank++) {
+        trace t;
+        t.configure(cfg);
+        t.set_n_procs(n_procs);
+        int messages = rank + 1;
+        uint64_t len = rank == 3 ? 4096 : 64;
+        if (sample_rate > 1) {
+            feed<FEATURE_SIZES | FEATURE_SAMPLING>(t, rank, messages, len);
+        } else {
+            feed<FEATURE_SIZES>(t, rank, messages, len);
+        }
+        results[rank].add(t);
+    }
+
+    for (int mask = 1; mask < n_procs; mask <<= 1) {
+        for (int rank = 0; rank < n_procs; rank++) {
+            if ((rank & (2 * mask - 1)) == mask) {
+                std::vector<uint64_t> buf;
+                results[rank].pack(buf);
+                results[rank ^ mask].merge(buf);
+            }
+        }
+    }
+
+    std::string path = temp_path();
+    CHECK(results[0].write(path, "test", n_procs, sample_rate));
+
+    nlohmann::json j;
+    std::ifstream ifs(path);
+    ifs >> j;
+    std::remove(path.c_str());
+
+    return j;
+}
+
+static void test_merge(int sample_rate)
+{
+    nlohmann::json j = gather(sample_rate);
+    const uint64_t scale = sample_rate;
+
+    CHECK(j["n_procs"] == n_procs);
+    CHECK(j["ranks"].size() == static_cast<size_t>(n_procs));
+
+    uint64_t small = 0, large = 0;
+    for (int rank = 0; rank < n_procs; rank++) {
+        const nlohmann::json& r = j["ranks"][rank];
+        uint64_t len = rank == 3 ? 4096 : 64;
+
+        // Ranks come in rank order with their own sparse row
+        CHECK(r["rank"] == rank);
+        CHECK(r["processor_name"] == "node-" + std::to_string(rank));
+        CHECK(r["peers"].size() == static_cast<size_t>(n_procs - 1));
+        for (size_t i = 0; i < r["peers"].size(); i++) {
+            CHECK(r["peers"][i] != rank);
+            CHECK(r["tx_messages"][i] == (rank + 1) * scale);
+            CHECK(r["tx_bytes"][i] == (rank + 1) * len * scale);
+            CHECK(r["rx_messages"][i] == 0);
+        }
+
+        (rank == 3 ? large : small) +=
+            (n_procs - 1) * (rank + 1) * scale;
+    }
+
+    // Histograms of all ranks are summed
+    CHECK(j["tx_message_sizes"].size() == 2);
+    for (const auto& b : j["tx_message_sizes"]) {
+        CHECK(b["frequency"] == (b["message_size"] == 64 ? small : large));
+    }
+    CHECK(j["rx_message_sizes"].empty());
+}
+
+int main()
+{
+    test_merge(1);
+    test_merge(10);
+
+    return check_status();
+}
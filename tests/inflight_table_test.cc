@@ -0,0 +1,133 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "inflight_table.hpp"
+
+using pfprof::inflight_table;
+
+// Request ids are pointers, so multiples of 8
+static uintptr_t id_of(int i)
+{
+    return 8 * (i + 1);
+}
+
+static void test_insert_remove()
+{
+    inflight_table t;
+    t.init(100);
+    CHECK(t.capacity() == 128);
+
+    uint64_t time = 0;
+    CHECK(!t.remove(id_of(0), &time));
+
+    for (int i = 0; i < 64; i++) {
+        t.insert(id_of(i), 1000 + i);
+    }
+    for (int i = 0; i < 64; i++) {
+        CHECK(t.remove(id_of(i), &time));
+        CHECK(time == static_cast<uint64_t>(1000 + i));
+        CHECK(!t.remove(id_of(i), &time));
+    }
+    CHECK(t.dropped() == 0);
+
+    // Persistent requests are activated again with the same id
+    t.insert(id_of(0), 1);
+    t.insert(id_of(0), 2);
+    CHECK(t.remove(id_of(0), &time));
+    CHECK(time == 2);
+    CHECK(!t.remove(id_of(0), &time));
+}
+
+// In a table of two slots, every pair of ids shares its probe chain. When
+// the first id leaves a tombstone ahead of the second one, reactivating the
+// second id must not reuse the tombstone and leave a stale duplicate.
+static void test_tombstone_reuse()
+{
+    for (int i = 0; i < 64; i++) {
+        inflight_table t;
+        t.init(2);
+
+        uintptr_t a = id_of(2 * i), b = id_of(2 * i + 1);
+        uint64_t time = 0;
+
+        t.insert(a, 1);
+        t.insert(b, 2);
+        CHECK(t.remove(a, &time));
+        CHECK(time == 1);
+
+        t.insert(b, 3);
+        CHECK(t.remove(b, &time));
+        CHECK(time == 3);
+        CHECK(!t.remove(b, &time));
+
+        // Both slots are free again
+        t.insert(a, 4);
+        t.insert(b, 5);
+        CHECK(t.dropped() == 0);
+        CHECK(t.remove(b, &time));
+        CHECK(time == 5);
+        CHECK(t.remove(a, &time));
+        CHECK(time == 4);
+    }
+}
+
+static void test_dropped()
+{
+    inflight_table t;
+    t.init(2);
+
+    t.insert(id_of(0), 1);
+    t.insert(id_of(1), 2);
+    t.insert(id_of(2), 3);
+    CHECK(t.dropped() == 1);
+
+    uint64_t time = 0;
+    CHECK(!t.remove(id_of(2), &time));
+}
+
+// Threads activate and complete their own requests through one table, as
+// requests of MPI_THREAD_MULTIPLE applications do: every completion must
+// find the time of its own activation.
+static void test_threads()
+{
+    const int n_threads = 4;
+    const int n_requests = 100000;
+    const int window = 64;
+    inflight_table t;
+    t.init(1024);
+
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < n_threads; thread++) {
+        threads.emplace_back([&t, &mismatches, thread]() {
+            for (int i = 0; i < n_requests; i++) {
+                uintptr_t id = id_of(thread * window + i % window);
+                uint64_t time = 0;
+
+                t.insert(id, thread * n_requests + i);
+                if (!t.remove(id, &time) ||
+                    time != static_cast<uint64_t>(thread * n_requests + i)) {
+                    mismatches++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    CHECK(mismatches.load() == 0);
+    CHECK(t.dropped() == 0);
+}
+
+int main()
+{
+    test_insert_remove();
+    test_tombstone_reuse();
+    test_dropped();
+    test_threads();
+
+    return check_status();
+}
@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <vector>
+
+#include "check.hpp"
+#include "peer_counters.hpp"
+
+using pfprof::peer_counters;
+
+// Counts a message to peer with distinct counters per peer
+static void count(peer_counters& c, int peer)
+{
+    int slot = c.slot_of(peer);
+
+    c.tx_bytes[slot] += 1000 + peer;
+    c.tx_messages[slot]++;
+    c.rx_bytes[slot] += 2000 + peer;
+    c.rx_messages[slot] += 2;
+    c.tx_transfers[slot].record(1000 + peer, 10, 1);
+}
+
+static void check_peer(const peer_counters& c, int slot, int peer, int times)
+{
+    CHECK(c.peer_of(slot) == peer);
+    CHECK(c.tx_bytes[slot] == static_cast<uint64_t>(times * (1000 + peer)));
+    CHECK(c.tx_messages[slot] == static_cast<uint64_t>(times));
+    CHECK(c.rx_bytes[slot] == static_cast<uint64_t>(times * (2000 + peer)));
+    CHECK(c.rx_messages[slot] == static_cast<uint64_t>(2 * times));
+    CHECK(c.tx_transfers[slot].transfers == static_cast<uint64_t>(times));
+}
+
+static void test_small_dense()
+{
+    peer_counters c;
+    c.init(16, false, false, false, true);
+
+    CHECK(c.dense());
+    CHECK(c.n_slots() == 16);
+    CHECK(c.slot_of(5) == 5);
+    CHECK(c.used_slots().empty());
+}
+
+// Peers are counted sparsely until a quarter of them have been seen, then
+// every counter moves to the slot of its peer
+static void test_sparse_to_dense()
+{
+    const int size = 1024;
+    peer_counters c;
+    c.init(size, false, false, false, true);
+
+    CHECK(!c.dense());
+    CHECK(c.n_slots() == 0);
+
+    // Spread over the table so that it rehashes on the way
+    std::vector<int> peers;
+    for (int i = 0; i < size / peer_counters::dense_ratio; i++) {
+        peers.push_back((i * 37 + 11) % size);
+    }
+    for (const auto& peer : peers) {
+        count(c, peer);
+    }
+    count(c, peers[0]);
+
+    CHECK(!c.dense());
+    CHECK(c.n_slots() == static_cast<int>(peers.size()));
+
+    // Slots are stable and used slots come in increasing peer order
+    std::vector<int> slots = c.used_slots();
+    CHECK(slots.size() == peers.size());
+    for (size_t i = 1; i < slots.size(); i++) {
+        CHECK(c.peer_of(slots[i - 1]) < c.peer_of(slots[i]));
+    }
+    for (const auto& peer : peers) {
+        check_peer(c, c.slot_of(peer), peer, peer == peers[0] ? 2 : 1);
+    }
+
+    // One more peer crosses the threshold
+    int last = 0;
+    while (std::find(peers.begin(), peers.end(), last) != peers.end()) {
+        last++;
+    }
+    CHECK(c.slot_of(last) == last);
+    count(c, last);
+
+    CHECK(c.dense());
+    CHECK(c.n_slots() == size);
+    CHECK(c.tx_transfers.size() == static_cast<size_t>(size));
+    CHECK(c.used_slots().size() == peers.size() + 1);
+    for (const auto& peer : peers) {
+        CHECK(c.slot_of(peer) == peer);
+        check_peer(c, peer, peer, peer == peers[0] ? 2 : 1);
+    }
+    check_peer(c, last, last, 1);
+}
+
+// Sparse counters merged into dense ones and the other way round
+static void test_merge()
+{
+    const int size = 256;
+    peer_counters sparse, dense;
+    sparse.init(size, false, false, false, true);
+    dense.init(size, false, false, false, true);
+
+    count(sparse, 3);
+    count(sparse, 200);
+    for (int peer = 0; peer < size; peer += 2) {
+        count(dense, peer);
+    }
+    CHECK(!sparse.dense());
+    CHECK(dense.dense());
+
+    peer_counters merged;
+    merged.merge(sparse);
+    CHECK(!merged.dense());
+    merged.merge(dense);
+    CHECK(merged.dense());
+
+    check_peer(merged, 3, 3, 1);
+    check_peer(merged, 200, 200, 2);
+    check_peer(merged, 4, 4, 1);
+    CHECK(merged.used_slots().size() == size / 2 + 1);
+}
+
+int main()
+{
+    test_small_dense();
+    test_sparse_to_dense();
+    test_merge();
+
+    return check_status();
+}
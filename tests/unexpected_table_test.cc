@@ -0,0 +1,142 @@
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "queue_stats.hpp"
+
+using pfprof::unexpected_queue;
+using pfprof::unexpected_table;
+
+// Messages of a sender and tag are removed oldest first, whatever the
+// other senders and tags queue in between
+static void test_order()
+{
+    unexpected_table t;
+    unexpected_queue q;
+    t.init(64);
+
+    unexpected_queue::state s = t.insert(q, 0, 1, 7, 100, 10);
+    CHECK(s.depth == 1 && s.bytes == 100);
+    t.insert(q, 0, 2, 7, 200, 20);
+    t.insert(q, 0, 1, 8, 300, 30);
+    s = t.insert(q, 0, 1, 7, 400, 40);
+    CHECK(s.depth == 4 && s.bytes == 1000);
+
+    uint64_t wait = 0;
+    CHECK(t.remove(q, 0, 1, 7, 50, &s, &wait));
+    CHECK(s.depth == 4 && s.bytes == 1000);
+    CHECK(wait == 40);
+    CHECK(t.remove(q, 0, 1, 7, 50, &s, &wait));
+    CHECK(s.depth == 3 && s.bytes == 900);
+    CHECK(wait == 10);
+    CHECK(!t.remove(q, 0, 1, 7, 50, &s, &wait));
+
+    // Same sender and tag on another communicator
+    CHECK(!t.remove(q, 1, 2, 7, 50, &s, &wait));
+    CHECK(t.remove(q, 0, 2, 7, 50, &s, &wait));
+    CHECK(wait == 30);
+    CHECK(t.remove(q, 0, 1, 8, 50, &s, &wait));
+    CHECK(s.depth == 1 && s.bytes == 300);
+
+    CHECK(q.depth.load() == 0 && q.bytes.load() == 0);
+    CHECK(t.dropped() == 0);
+}
+
+// Messages queued before the profiler subscribed are not found, and
+// neither are those dropped when the table is full
+static void test_dropped()
+{
+    unexpected_table t;
+    unexpected_queue q;
+    t.init(4);
+
+    unexpected_queue::state s;
+    uint64_t wait = 0;
+    CHECK(!t.remove(q, 0, 1, 7, 0, &s, &wait));
+
+    for (int i = 0; i < 6; i++) {
+        t.insert(q, 0, 1, 7, 1, i);
+    }
+    CHECK(t.dropped() == 2);
+    CHECK(q.depth.load() == 4);
+
+    int found = 0;
+    for (int i = 0; i < 6; i++) {
+        if (t.remove(q, 0, 1, 7, 10, &s, &wait)) {
+            found++;
+        }
+    }
+    CHECK(found == 4);
+    CHECK(q.depth.load() == 0);
+
+    // Freed slots are reused
+    t.insert(q, 0, 1, 7, 1, 20);
+    CHECK(t.remove(q, 0, 1, 7, 30, &s, &wait));
+    CHECK(wait == 10);
+    CHECK(t.dropped() == 2);
+}
+
+// Streams are freed with their last message, so many more communicators,
+// senders and tags than the table holds come and go
+static void test_streams()
+{
+    unexpected_table t;
+    unexpected_queue q;
+    t.init(16);
+
+    unexpected_queue::state s;
+    uint64_t wait = 0;
+    for (int i = 0; i < 100000; i++) {
+        t.insert(q, i % 7, i % 13, i, 1, i);
+        CHECK(t.remove(q, i % 7, i % 13, i, i, &s, &wait));
+    }
+    CHECK(t.dropped() == 0);
+    CHECK(q.depth.load() == 0);
+}
+
+// Threads queue and remove messages of their own tags concurrently
+static void test_threads()
+{
+    const int n_threads = 4;
+    const int n_messages = 10000;
+
+    unexpected_table t;
+    unexpected_queue q;
+    t.init(1024);
+
+    std::vector<int> lost(n_threads, 0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n_threads; i++) {
+        threads.push_back(std::thread([&t, &q, &lost, i] {
+            unexpected_queue::state s;
+            uint64_t wait;
+            for (int m = 0; m < n_messages; m++) {
+                t.insert(q, 0, i, m % 3, 1, m);
+                t.insert(q, 0, i, m % 3, 1, m);
+                if (!t.remove(q, 0, i, m % 3, m, &s, &wait) ||
+                    !t.remove(q, 0, i, m % 3, m, &s, &wait)) {
+                    lost[i]++;
+                }
+            }
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    CHECK(t.dropped() == 0);
+    for (int i = 0; i < n_threads; i++) {
+        CHECK(lost[i] == 0);
+    }
+    CHECK(q.depth.load() == 0);
+}
+
+int main()
+{
+    test_order();
+    test_dropped();
+    test_streams();
+    test_threads();
+
+    return check_status();
+}
@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+
+#include "binary_result.hpp"
+#include "json.hpp"
+#include "json_writer.hpp"
+#include "traffic_matrix.hpp"
+#include "work_stealing_pool.hpp"
+
+// Merges the per-rank results of a job (oxton-result<rank>.bin, or .json
+// where no binary result exists) into:
+//   oxton-matrix.bin            traffic matrix, see traffic_matrix.hpp
+//   oxton-matrix-bytes.mtx      bytes sent, in MatrixMarket format
+//   oxton-matrix-messages.mtx   messages sent, in MatrixMarket format
+//   oxton-summary.json          per-rank totals and job-wide message size
+//                               histograms
+// Files are read and parsed in parallel. Counters of sampled results are
+// the extrapolated totals.
+
+namespace {
+
+struct options
+{
+    std::string input;
+    std::string output;
+    int threads;
+};
+
+// What is kept of a per-rank result
+struct rank_result
+{
+    std::string path;
+    std::string error;
+    int rank;
+    int n_procs;
+    uint64_t n_events;
+    double duration;
+    std::string processor_name;
+    std::string description;
+    // Row of the traffic matrix
+    std::vector<int32_t> peers;
+    std::vector<uint64_t> tx_bytes;
+    std::vector<uint64_t> tx_messages;
+    uint64_t total_tx_bytes;
+    uint64_t total_rx_bytes;
+    uint64_t total_tx_messages;
+    uint64_t total_rx_messages;
+    std::vector<pfprof::size_bucket_record> tx_sizes;
+    std::vector<pfprof::size_bucket_record> rx_sizes;
+
+    rank_result()
+        : rank(-1), n_procs(0), n_events(0), duration(0.0),
+          total_tx_bytes(0), total_rx_bytes(0), total_tx_messages(0),
+          total_rx_messages(0)
+    {
+    }
+};
+
+// Frequencies by (smallest, largest) size of a bucket
+typedef std::map<std::pair<uint64_t, uint64_t>, uint64_t> bucket_map;
+
+uint64_t sum(const std::vector<uint64_t>& v)
+{
+    uint64_t total = 0;
+
+    for (const auto& x : v) {
+        total += x;
+    }
+
+    return total;
+}
+
+template <typename T>
+std::vector<T> to_vector(const pfprof::column<T>& c)
+{
+    return std::vector<T>(c.begin(), c.end());
+}
+
+void load_binary(rank_result& r)
+{
+    pfprof::binary_result b;
+
+    if (!b.open(r.path)) {
+        r.error = "not a valid binary result";
+        return;
+    }
+
+    const pfprof::binary_result_header& h = b.header();
+    r.rank = h.rank;
+    r.n_procs = h.n_procs;
+    r.n_events = h.n_events;
+    r.duration = h.duration;
+    r.processor_name = b.processor_name();
+    r.description = b.description();
+
+    r.peers = to_vector(b.peers());
+    r.tx_bytes = to_vector(b.tx_bytes());
+    r.tx_messages = to_vector(b.tx_messages());
+    r.total_tx_bytes = sum(r.tx_bytes);
+    r.total_tx_messages = sum(r.tx_messages);
+    for (const auto& x : b.rx_bytes()) {
+        r.total_rx_bytes += x;
+    }
+    for (const auto& x : b.rx_messages()) {
+        r.total_rx_messages += x;
+    }
+
+    r.tx_sizes = to_vector(b.tx_message_sizes());
+    r.rx_sizes = to_vector(b.rx_message_sizes());
+}
+
+std::vector<pfprof::size_bucket_record> size_buckets(const nlohmann::json& j)
+{
+    std::vector<pfprof::size_bucket_record> buckets;
+
+    for (const auto& b : j) {
+        uint64_t size = b["message_size"];
+        uint64_t size_max = b.count("message_size_max") ?
+            b["message_size_max"].get<uint64_t>() : size;
+        buckets.push_back(pfprof::size_bucket_record{
+            size, size_max, b["frequency"].get<uint64_t>()});
+    }
+
+    return buckets;
+}
+
+void load_json(rank_result& r)
+{
+    try {
+        std::ifstream ifs(r.path);
+        nlohmann::json j;
+        ifs >> j;
+
+        r.rank = j["rank"];
+        r.n_procs = j["n_procs"];
+        r.n_events = j["n_events"];
+        r.duration = j["duration"];
+        r.processor_name = j["processor_name"];
+        r.description = j["description"];
+
+        r.peers = j["peers"].get<std::vector<int32_t>>();
+        r.tx_bytes = j["tx_bytes"].get<std::vector<uint64_t>>();
+        r.tx_messages = j["tx_messages"].get<std::vector<uint64_t>>();
+        r.total_tx_bytes = sum(r.tx_bytes);
+        r.total_tx_messages = sum(r.tx_messages);
+        r.total_rx_bytes = sum(j["rx_bytes"].get<std::vector<uint64_t>>());
+        r.total_rx_messages =
+            sum(j["rx_messages"].get<std::vector<uint64_t>>());
+
+        r.tx_sizes = size_buckets(j["tx_message_sizes"]);
+        r.rx_sizes = size_buckets(j["rx_message_sizes"]);
+    } catch (const std::exception& e) {
+        r.error = e.what();
+    }
+}
+
+void load(rank_result& r)
+{
+    const std::string suffix = ".bin";
+
+    if (r.path.size() > suffix.size() &&
+        r.path.compare(r.path.size() - suffix.size(), suffix.size(),
+                       suffix) == 0) {
+        load_binary(r);
+    } else {
+        load_json(r);
+    }
+
+    if (r.error.empty() &&
+        (r.peers.size() != r.tx_bytes.size() ||
+         r.peers.size() != r.tx_messages.size())) {
+        r.error = "columns are not aligned with peers";
+    }
+}
+
+// Rank of a per-rank result file name, or -1
+long rank_of(const std::string& name, bool& binary)
+{
+    const std::string prefix = "oxton-result";
+
+    if (name.compare(0, prefix.size(), prefix) != 0) {
+        return -1;
+    }
+
+    size_t end = prefix.size();
+    while (end < name.size() && name[end] >= '0' && name[end] <= '9') {
+        end++;
+    }
+
+    std::string suffix = name.substr(end);
+    if (end == prefix.size() || (suffix != ".bin" && suffix != ".json")) {
+        return -1;
+    }
+    binary = suffix == ".bin";
+
+    return std::atol(name.c_str() + prefix.size());
+}
+
+// One file per rank, binary results preferred
+bool list_results(const std::string& dir, std::vector<std::string>& paths)
+{
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return false;
+    }
+
+    std::map<long, std::pair<bool, std::string>> files;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != nullptr) {
+        bool binary = false;
+        long rank = rank_of(entry->d_name, binary);
+        if (rank < 0) {
+            continue;
+        }
+
+        auto it = files.find(rank);
+        if (it == files.end() || (binary && !it->second.first)) {
+            files[rank] = std::make_pair(binary, dir + "/" + entry->d_name);
+        }
+    }
+    closedir(d);
+
+    for (const auto& f : files) {
+        paths.push_back(f.second.second);
+    }
+
+    return true;
+}
+
+pfprof::traffic_matrix build_matrix(const std::vector<rank_result>& results,
+                                    int n_procs)
+{
+    pfprof::traffic_matrix m;
+    std::vector<const rank_result *> rows(n_procs, nullptr);
+
+    for (const auto& r : results) {
+        rows[r.rank] = &r;
+    }
+
+    m.n_procs = n_procs;
+    m.row_offsets.assign(n_procs + 1, 0);
+    for (int i = 0; i < n_procs; i++) {
+        size_t nnz = 0;
+        if (rows[i] != nullptr) {
+            for (const auto& n : rows[i]->tx_messages) {
+                nnz += n != 0;
+            }
+        }
+        m.row_offsets[i + 1] = m.row_offsets[i] + nnz;
+    }
+
+    m.columns.reserve(m.row_offsets[n_procs]);
+    m.bytes.reserve(m.row_offsets[n_procs]);
+    m.messages.reserve(m.row_offsets[n_procs]);
+    for (int i = 0; i < n_procs; i++) {
+        if (rows[i] == nullptr) {
+            continue;
+        }
+
+        // Peers are sorted already
+        const rank_result& r = *rows[i];
+        for (size_t j = 0; j < r.peers.size(); j++) {
+            if (r.tx_messages[j] != 0) {
+                m.columns.push_back(r.peers[j]);
+                m.bytes.push_back(r.tx_bytes[j]);
+                m.messages.push_back(r.tx_messages[j]);
+            }
+        }
+    }
+
+    return m;
+}
+
+void write_histogram(pfprof::json_writer& w, const bucket_map& h)
+{
+    w.begin_array();
+    for (const auto& kv : h) {
+        w.begin_object();
+        w.field("message_size", kv.first.first);
+        w.field("frequency", kv.second);
+        if (kv.first.second != kv.first.first) {
+            w.field("message_size_max", kv.first.second);
+        }
+        w.end_object();
+    }
+    w.end_array();
+}
+
+bool write_summary(const std::string& path,
+                   const std::vector<rank_result>& results, int n_procs)
+{
+    bucket_map tx_sizes, rx_sizes;
+    uint64_t n_events = 0;
+    double duration = 0.0;
+
+    for (const auto& r : results) {
+        n_events += r.n_events;
+        duration = std::max(duration, r.duration);
+        for (const auto& b : r.tx_sizes) {
+            tx_sizes[std::make_pair(b.message_size, b.message_size_max)] +=
+                b.frequency;
+        }
+        for (const auto& b : r.rx_sizes) {
+            rx_sizes[std::make_pair(b.message_size, b.message_size_max)] +=
+                b.frequency;
+        }
+    }
+
+    pfprof::json_writer w;
+    if (!w.open(path)) {
+        return false;
+    }
+
+    w.begin_object();
+    w.field("description", results.empty() ? "" : results[0].description);
+    w.field("n_procs", n_procs);
+    w.field("n_results", results.size());
+    w.field("n_events", n_events);
+    w.field("duration", duration);
+
+    w.key("ranks");
+    w.begin_array();
+    for (const auto& r : results) {
+        w.begin_object();
+        w.field("rank", r.rank);
+        w.field("processor_name", r.processor_name);
+        w.field("n_events", r.n_events);
+        w.field("duration", r.duration);
+        w.field("n_peers", r.peers.size());
+        w.field("tx_bytes", r.total_tx_bytes);
+        w.field("rx_bytes", r.total_rx_bytes);
+        w.field("tx_messages", r.total_tx_messages);
+        w.field("rx_messages", r.total_rx_messages);
+        w.end_object();
+    }
+    w.end_array();
+
+    w.key("tx_message_sizes");
+    write_histogram(w, tx_sizes);
+    w.key("rx_message_sizes");
+    write_histogram(w, rx_sizes);
+    w.end_object();
+
+    return w.close();
+}
+
+void usage(const char *argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [--threads N] [--output DIR] DIR"
+              << std::endl;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    options opts = {
+        "", "", static_cast<int>(std::thread::hardware_concurrency())
+    };
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--threads" && i + 1 < argc) {
+            opts.threads = std::atoi(argv[++i]);
+        } else if (arg == "--output" && i + 1 < argc) {
+            opts.output = argv[++i];
+        } else if (opts.input.empty() && arg[0] != '-') {
+            opts.input = arg;
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (opts.input.empty()) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (opts.output.empty()) {
+        opts.output = opts.input;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+
+    std::vector<std::string> paths;
+    if (!list_results(opts.input, paths)) {
+        std::cerr << "Unable to read " << opts.input << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (paths.empty()) {
+        std::cerr << "No results in " << opts.input << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<rank_result> results(paths.size());
+    pfprof::work_stealing_pool pool(opts.threads);
+    for (size_t i = 0; i < paths.size(); i++) {
+        results[i].path = paths[i];
+        rank_result *r = &results[i];
+        pool.submit([r]() { load(*r); });
+    }
+    pool.run();
+
+    auto t1 = std::chrono::steady_clock::now();
+
+    // Results are checked once all are read, so that errors are reported
+    // in rank order
+    int n_procs = 0;
+    std::vector<bool> seen;
+    for (const auto& r : results) {
+        if (!r.error.empty()) {
+            std::cerr << r.path << ": " << r.error << std::endl;
+            return EXIT_FAILURE;
+        }
+        n_procs = std::max(n_procs, r.n_procs);
+    }
+    seen.assign(n_procs, false);
+    for (const auto& r : results) {
+        if (r.rank < 0 || r.rank >= n_procs || seen[r.rank]) {
+            std::cerr << r.path << ": unexpected rank " << r.rank
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+        seen[r.rank] = true;
+
+        for (const auto& peer : r.peers) {
+            if (peer < 0 || peer >= n_procs) {
+                std::cerr << r.path << ": unexpected peer " << peer
+                          << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    if (static_cast<int>(results.size()) < n_procs) {
+        std::cerr << "Warning: " << n_procs - results.size()
+                  << " of " << n_procs << " ranks have no result"
+                  << std::endl;
+    }
+
+    pfprof::traffic_matrix m = build_matrix(results, n_procs);
+
+    // Outputs are independent, write them in parallel as well
+    const std::string prefix = opts.output + "/oxton-";
+    bool ok[4] = {false, false, false, false};
+    pfprof::work_stealing_pool writers(std::min(opts.threads, 4));
+    writers.submit([&]() { ok[0] = m.write(prefix + "matrix.bin"); });
+    writers.submit([&]() {
+        ok[1] = m.write_matrix_market(prefix + "matrix-bytes.mtx", m.bytes,
+                                      "bytes sent from row to column rank");
+    });
+    writers.submit([&]() {
+        ok[2] = m.write_matrix_market(prefix + "matrix-messages.mtx",
+                                      m.messages,
+                                      "messages sent from row to column rank");
+    });
+    writers.submit([&]() {
+        ok[3] = write_summary(prefix + "summary.json", results, n_procs);
+    });
+    writers.run();
+
+    if (!(ok[0] && ok[1] && ok[2] && ok[3])) {
+        std::cerr << "Unable to write results to " << opts.output
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto t2 = std::chrono::steady_clock::now();
+
+    std::cout << "Merged " << results.size() << " results (" << n_procs
+              << " ranks, " << m.columns.size() << " matrix entries): read "
+              << std::chrono::duration<double>(t1 - t0).count() << " s, wrote "
+              << std::chrono::duration<double>(t2 - t1).count() << " s"
+              << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+#ifndef __TRAFFIC_MATRIX_HPP__
+#define __TRAFFIC_MATRIX_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace pfprof {
+
+// Job-wide traffic matrix written by pfprof-merge, in compressed sparse row
+// form and native byte order:
+//   traffic_matrix_header
+//   uint64_t row_offsets[n_procs + 1]
+//   int32_t columns[nnz], padded to a multiple of 8 bytes
+//   uint64_t bytes[nnz]
+//   uint64_t messages[nnz]
+// Row r holds what rank r sent: entries row_offsets[r] to
+// row_offsets[r + 1] - 1, in increasing column (receiver) order.
+
+static const char traffic_matrix_magic[8] = {
+    'P', 'F', 'P', 'R', 'O', 'F', 'T', 'M'
+};
+static const uint32_t traffic_matrix_version = 1;
+
+struct traffic_matrix_header
+{
+    // "PFPROFTM"
+    char magic[8];
+    uint32_t version;
+    int32_t n_procs;
+    uint64_t nnz;
+};
+
+struct traffic_matrix
+{
+    int n_procs;
+    std::vector<uint64_t> row_offsets;
+    std::vector<int32_t> columns;
+    std::vector<uint64_t> bytes;
+    std::vector<uint64_t> messages;
+
+    bool write(const std::string& path) const
+    {
+        traffic_matrix_header h;
+        std::copy(traffic_matrix_magic, traffic_matrix_magic + 8, h.magic);
+        h.version = traffic_matrix_version;
+        h.n_procs = n_procs;
+        h.nnz = columns.size();
+
+        std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+        ofs.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        write_vector(ofs, row_offsets);
+        write_vector(ofs, columns);
+        if (columns.size() % 2 != 0) {
+            const int32_t padding = 0;
+            ofs.write(reinterpret_cast<const char *>(&padding),
+                      sizeof(padding));
+        }
+        write_vector(ofs, bytes);
+        write_vector(ofs, messages);
+        ofs.close();
+
+        return !ofs.fail();
+    }
+
+    // Coordinate format with 1-based indices, one of the values per entry
+    bool write_matrix_market(const std::string& path,
+                             const std::vector<uint64_t>& values,
+                             const char *comment) const
+    {
+        std::ofstream ofs(path, std::ios::trunc);
+        std::string buf;
+
+        buf += "%%MatrixMarket matrix coordinate integer general\n% ";
+        buf += comment;
+        buf += '\n';
+        append(buf, n_procs);
+        buf += ' ';
+        append(buf, n_procs);
+        buf += ' ';
+        append(buf, columns.size());
+        buf += '\n';
+
+        for (int row = 0; row < n_procs; row++) {
+            for (uint64_t i = row_offsets[row]; i < row_offsets[row + 1];
+                 i++) {
+                append(buf, row + 1);
+                buf += ' ';
+                append(buf, columns[i] + 1);
+                buf += ' ';
+                append(buf, values[i]);
+                buf += '\n';
+            }
+
+            if (buf.size() >= 1 << 20) {
+                ofs.write(buf.data(), buf.size());
+                buf.clear();
+            }
+        }
+        ofs.write(buf.data(), buf.size());
+        ofs.close();
+
+        return !ofs.fail();
+    }
+
+private:
+    template <typename T>
+    static void write_vector(std::ofstream& ofs, const std::vector<T>& v)
+    {
+        ofs.write(reinterpret_cast<const char *>(v.data()),
+                  v.size() * sizeof(T));
+    }
+
+    static void append(std::string& buf, uint64_t v)
+    {
+        char digits[20];
+        int n = 0;
+
+        do {
+            digits[n++] = '0' + v % 10;
+            v /= 10;
+        } while (v != 0);
+
+        while (n > 0) {
+            buf += digits[--n];
+        }
+    }
+};
+
+}
+
+#endif
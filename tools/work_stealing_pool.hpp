@@ -0,0 +1,116 @@
+#ifndef __WORK_STEALING_POOL_HPP__
+#define __WORK_STEALING_POOL_HPP__
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pfprof {
+
+// Runs a fixed set of tasks on a pool of threads. Tasks are dealt round
+// robin to per-thread queues; every thread runs tasks from the back of its
+// own queue and, once it is empty, steals from the front of the others, so
+// that a few large tasks do not leave the other threads idle. Tasks may not
+// submit further tasks.
+class work_stealing_pool
+{
+public:
+    typedef std::function<void()> task;
+
+    explicit work_stealing_pool(size_t n_threads) : next_(0)
+    {
+        if (n_threads == 0) {
+            n_threads = 1;
+        }
+
+        for (size_t i = 0; i < n_threads; i++) {
+            queues_.emplace_back(new queue);
+        }
+    }
+
+    size_t n_threads() const
+    {
+        return queues_.size();
+    }
+
+    void submit(task t)
+    {
+        queue& q = *queues_[next_++ % queues_.size()];
+        q.tasks.push_back(std::move(t));
+    }
+
+    // Runs every submitted task and returns once all have completed
+    void run()
+    {
+        std::vector<std::thread> threads;
+
+        for (size_t i = 1; i < queues_.size(); i++) {
+            threads.emplace_back(&work_stealing_pool::work, this, i);
+        }
+        work(0);
+
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+private:
+    struct queue
+    {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    void work(size_t self)
+    {
+        task t;
+
+        while (pop(self, t) || steal(self, t)) {
+            t();
+        }
+    }
+
+    bool pop(size_t self, task& t)
+    {
+        queue& q = *queues_[self];
+        std::lock_guard<std::mutex> lock(q.mutex);
+
+        if (q.tasks.empty()) {
+            return false;
+        }
+
+        t = std::move(q.tasks.back());
+        q.tasks.pop_back();
+
+        return true;
+    }
+
+    // No task is ever added while running, so all queues being empty at
+    // once means that the work is done
+    bool steal(size_t self, task& t)
+    {
+        for (size_t i = 1; i < queues_.size(); i++) {
+            queue& q = *queues_[(self + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+
+            if (!q.tasks.empty()) {
+                t = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    std::vector<std::unique_ptr<queue>> queues_;
+    size_t next_;
+};
+
+}
+
+#endif